@@ -0,0 +1,200 @@
+#include "telemetry.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+constexpr int kTelemetryJsonVersion = 1;
+constexpr size_t kBinaryHeaderBytes = 4 + 8 + 8 + 8 + 4;
+constexpr size_t kBinaryStatusBytes = 9 * 8;
+constexpr size_t kBinaryCrcBytes = 4;
+constexpr size_t kMaxField = 255; // length prefixes are one byte
+
+constexpr std::array<uint32_t, 256> MakeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+constexpr std::array<uint32_t, 256> kCrcTable = MakeCrcTable();
+
+// CRC-32 (IEEE 802.3), same as zlib's crc32()
+uint32_t Crc32(const unsigned char *data, size_t len) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i) {
+        c = kCrcTable[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+// explicit byte order so the wire format does not depend on the host
+void PutU64(std::string &out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutU32(std::string &out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutF64(std::string &out, double v) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    PutU64(out, bits);
+}
+
+uint64_t GetU64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+uint32_t GetU32(const unsigned char *p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+double GetF64(const unsigned char *p) {
+    const uint64_t bits = GetU64(p);
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+} // namespace
+
+std::string TelemetryDatagram::EncodeJson() const {
+    DeviceStatus copy = status;
+    json j;
+    j["v"] = kTelemetryJsonVersion;
+    j["id"] = global_id;
+    j["epoch"] = epoch;
+    j["seq"] = seq;
+    j["ts_ms"] = ts_ms;
+    j["interval_ms"] = interval_ms;
+    j["status"] = copy.to_json();
+    j["services"] = services;
+    return j.dump();
+}
+
+std::optional<TelemetryDatagram> TelemetryDatagram::DecodeJson(const char *data, size_t len) {
+    try {
+        const json j = json::parse(data, data + len);
+        if (j.value("v", 0) != kTelemetryJsonVersion) {
+            return std::nullopt;
+        }
+        TelemetryDatagram out;
+        out.global_id = j.at("id").get<std::string>();
+        out.epoch = j.value("epoch", static_cast<int64_t>(0));
+        out.seq = j.at("seq").get<uint64_t>();
+        out.ts_ms = j.value("ts_ms", static_cast<int64_t>(0));
+        out.interval_ms = j.value("interval_ms", 0);
+        out.status.from_json(j.at("status"));
+        if (j.contains("services") && j["services"].is_array()) {
+            for (const auto &sv : j["services"]) {
+                if (sv.is_string()) {
+                    out.services.push_back(sv.get<std::string>());
+                }
+            }
+        }
+        return out;
+    } catch (const json::exception &) {
+        return std::nullopt;
+    }
+}
+
+std::string TelemetryDatagram::EncodeBinary() const {
+    const size_t id_len = std::min(global_id.size(), kMaxField);
+    const size_t svc_count = std::min(services.size(), kMaxField);
+    std::string out;
+    out.reserve(kBinaryHeaderBytes + kBinaryStatusBytes + id_len + svc_count * 16 + kBinaryCrcBytes);
+    out.push_back(static_cast<char>(kTelemetryBinaryMagic));
+    out.push_back(static_cast<char>(kTelemetryBinaryVersion));
+    out.push_back(static_cast<char>(id_len));
+    out.push_back(static_cast<char>(svc_count));
+    PutU64(out, static_cast<uint64_t>(epoch));
+    PutU64(out, seq);
+    PutU64(out, static_cast<uint64_t>(ts_ms));
+    PutU32(out, static_cast<uint32_t>(interval_ms));
+    PutF64(out, status.mem_used);
+    PutF64(out, status.cpu_used);
+    PutF64(out, status.xpu_used);
+    PutF64(out, status.net_latency);
+    PutF64(out, status.net_bandwidth);
+    PutF64(out, status.last_runtime);
+    PutF64(out, status.disconnectTime);
+    PutF64(out, status.reconnectTime);
+    PutF64(out, status.timeWindow);
+    out.append(global_id, 0, id_len);
+    for (size_t i = 0; i < svc_count; ++i) {
+        const size_t n = std::min(services[i].size(), kMaxField);
+        out.push_back(static_cast<char>(n));
+        out.append(services[i], 0, n);
+    }
+    PutU32(out, Crc32(reinterpret_cast<const unsigned char *>(out.data()), out.size()));
+    return out;
+}
+
+std::optional<TelemetryDatagram> TelemetryDatagram::DecodeBinary(const char *data, size_t len) {
+    const auto *p = reinterpret_cast<const unsigned char *>(data);
+    if (len < kBinaryHeaderBytes + kBinaryStatusBytes + kBinaryCrcBytes ||
+        p[0] != kTelemetryBinaryMagic || p[1] != kTelemetryBinaryVersion) {
+        return std::nullopt;
+    }
+    const size_t body = len - kBinaryCrcBytes;
+    if (Crc32(p, body) != GetU32(p + body)) {
+        return std::nullopt;
+    }
+    const size_t id_len = p[2];
+    const size_t svc_count = p[3];
+    TelemetryDatagram out;
+    out.epoch = static_cast<int64_t>(GetU64(p + 4));
+    out.seq = GetU64(p + 12);
+    out.ts_ms = static_cast<int64_t>(GetU64(p + 20));
+    out.interval_ms = static_cast<int32_t>(GetU32(p + 28));
+    const unsigned char *s = p + kBinaryHeaderBytes;
+    out.status.mem_used = GetF64(s);
+    out.status.cpu_used = GetF64(s + 8);
+    out.status.xpu_used = GetF64(s + 16);
+    out.status.net_latency = GetF64(s + 24);
+    out.status.net_bandwidth = GetF64(s + 32);
+    out.status.last_runtime = GetF64(s + 40);
+    out.status.disconnectTime = GetF64(s + 48);
+    out.status.reconnectTime = GetF64(s + 56);
+    out.status.timeWindow = GetF64(s + 64);
+    size_t off = kBinaryHeaderBytes + kBinaryStatusBytes;
+    if (off + id_len > body) {
+        return std::nullopt;
+    }
+    out.global_id.assign(data + off, id_len);
+    off += id_len;
+    out.services.reserve(svc_count);
+    for (size_t i = 0; i < svc_count; ++i) {
+        if (off >= body || off + 1 + p[off] > body) {
+            return std::nullopt;
+        }
+        const size_t n = p[off];
+        out.services.emplace_back(data + off + 1, n);
+        off += 1 + n;
+    }
+    if (off != body) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+std::optional<TelemetryDatagram> TelemetryDatagram::Decode(const char *data, size_t len) {
+    if (len > 0 && static_cast<unsigned char>(data[0]) == kTelemetryBinaryMagic) {
+        return DecodeBinary(data, len);
+    }
+    return DecodeJson(data, len);
+}
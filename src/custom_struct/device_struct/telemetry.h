@@ -0,0 +1,45 @@
+#ifndef DOCKER_SCHEDULER_TELEMETRY_H
+#define DOCKER_SCHEDULER_TELEMETRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "device.h"
+
+// agent 上报给 gateway 的一条遥测样本：UDP 推送时一个数据报一条，/usage/device_info 协商为二进制时即响应体。
+// seq 每条样本加一，gateway 据此丢弃乱序/重复的样本并统计丢包；agent 重启后 epoch 变大，seq 重新计数。
+constexpr size_t kMaxTelemetryDatagram = 1400; // stays below a typical path MTU, no IP fragmentation
+// agent --push-port default; the gateway only receives pushes when started with --telemetry-udp-port on the same port
+constexpr int kDefaultTelemetryUdpPort = 6666;
+
+// 二进制编码（v1，小端，定长头 + 变长 id/服务名 + CRC32）：
+//   u8 magic(0xD5) | u8 version | u8 id_len | u8 service_count | i64 epoch | u64 seq | i64 ts_ms | i32 interval_ms
+//   | 9 x f64 DeviceStatus（字段顺序同结构体） | id | service_count x (u8 len | name) | u32 crc32(之前所有字节)
+// JSON 第一个字节总是 '{'，所以 UDP 上按首字节区分两种编码；HTTP 上按 Content-Type 协商。
+constexpr uint8_t kTelemetryBinaryMagic = 0xD5;
+constexpr uint8_t kTelemetryBinaryVersion = 1;
+constexpr const char *kTelemetryBinaryContentType = "application/x-device-status";
+
+struct TelemetryDatagram {
+    std::string global_id;
+    int64_t epoch{0};                  // pusher start time (ms), identifies one agent run
+    uint64_t seq{0};
+    int64_t ts_ms{0};                  // agent clock when sampled
+    int interval_ms{0};                // agent push period, tells the gateway when a sample is overdue
+    DeviceStatus status{};
+    std::vector<std::string> services; // running backends, same as /usage/device_info "services"
+
+    std::string EncodeJson() const;
+    /// @brief nullopt on malformed input or an unknown version
+    static std::optional<TelemetryDatagram> DecodeJson(const char *data, size_t len);
+    /// @brief ids/service names longer than 255 bytes and services beyond 255 are cut
+    std::string EncodeBinary() const;
+    /// @brief nullopt on a bad magic/version/length or a CRC mismatch
+    static std::optional<TelemetryDatagram> DecodeBinary(const char *data, size_t len);
+    /// @brief binary or JSON, picked by the first byte
+    static std::optional<TelemetryDatagram> Decode(const char *data, size_t len);
+};
+
+#endif // DOCKER_SCHEDULER_TELEMETRY_H
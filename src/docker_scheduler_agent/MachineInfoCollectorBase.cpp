@@ -6,22 +6,122 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #ifdef _WIN32
 #include <cstdlib>
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <netdb.h>
+#include <unistd.h>
 #endif
 
 const char *kConfigFilePath = ".agent_config.json";
 
+namespace {
+// 手写的十进制扫描：跳过空白后读一个无符号整数，没有数字时返回 nullptr
+const char *ScanU64(const char *p, const char *end, uint64_t &out) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return nullptr;
+    }
+    uint64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + static_cast<uint64_t>(*p - '0');
+        ++p;
+    }
+    out = v;
+    return p;
+}
+
+const char *LineEnd(const char *p, const char *end) {
+    const void *nl = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return nl != nullptr ? static_cast<const char *>(nl) : nullptr;
+}
+
+bool HasPrefix(const char *p, const char *end, const char *prefix, size_t len) {
+    return static_cast<size_t>(end - p) >= len && std::memcmp(p, prefix, len) == 0;
+}
+
+// counters after the "cpu"/"cpuN" label; columns an old kernel does not have stay 0
+bool ParseCpuCounters(const char *p, const char *end, CpuUsageInfo &out) {
+    uint64_t *fields[] = {&out.user, &out.nice, &out.system, &out.idle,
+                          &out.iowait, &out.irq, &out.softirq, &out.steal};
+    out = CpuUsageInfo{};
+    size_t parsed = 0;
+    for (uint64_t *field : fields) {
+        p = ScanU64(p, end, *field);
+        if (p == nullptr) {
+            break;
+        }
+        parsed++;
+    }
+    return parsed >= 4;
+}
+
+// counters may step back when a core goes offline and comes back
+uint64_t Delta(uint64_t curr, uint64_t prev) {
+    return curr >= prev ? curr - prev : 0;
+}
+
+double BusyRatio(const CpuUsageInfo &prev, const CpuUsageInfo &curr) {
+    const uint64_t total = Delta(curr.Total(), prev.Total());
+    if (total == 0) {
+        return 0.0;
+    }
+    const uint64_t idle = Delta(curr.idle + curr.iowait, prev.idle + prev.iowait);
+    return 1.0 - static_cast<double>(std::min(idle, total)) / static_cast<double>(total);
+}
+} // namespace
+
+ProcFile::ProcFile(const char *path) : path(path) {
+#ifndef _WIN32
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+ProcFile::~ProcFile() {
+#ifndef _WIN32
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+}
+
+size_t ProcFile::Read(char *buf, size_t cap) {
+#ifdef _WIN32
+    (void) buf;
+    (void) cap;
+    return 0;
+#else
+    if (fd < 0) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+    }
+    // procfs regenerates the content for a read at offset 0, so the descriptor never needs reopening
+    ssize_t n;
+    do {
+        n = pread(fd, buf, cap, 0);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+#endif
+}
+
 double MachineInfoCollectorBase::GetCpuUsage() {
     std::lock_guard lock(collectorMutex);
+    return cpuBreakdown.usage;
+}
 
-    double sum = std::accumulate(cpuUsageQueue.begin(), cpuUsageQueue.end(), 0.0);
-    double avg = sum / cpuUsageQueue.size();
-    return avg;
+CpuBreakdown MachineInfoCollectorBase::GetCpuBreakdown() {
+    std::lock_guard lock(collectorMutex);
+    return cpuBreakdown;
 }
 
 double MachineInfoCollectorBase::GetMemoryUsage() {
@@ -29,31 +129,29 @@ double MachineInfoCollectorBase::GetMemoryUsage() {
     // Windows: not implemented; return 0 for now
     return 0.0;
 #else
-    std::ifstream memFile("/proc/meminfo");
-    if (!memFile.is_open()) {
-        throw std::runtime_error("Failed to open /proc/meminfo");
+    std::lock_guard lock(memMutex);
+    const size_t n = meminfoFile.Read(memBuf.data(), memBuf.size());
+    if (n == 0) {
+        throw std::runtime_error("Failed to read /proc/meminfo");
     }
 
-    unsigned long totalMem = 0;    // 总内存（单位：KB）
-    unsigned long availableMem = 0;// 实际可用内存（单位：KB，含可回收缓存）
-    std::string line, key;
-    unsigned long value;
-    std::string unit;
-
-    // 遍历/proc/meminfo，提取MemTotal和MemAvailable字段
-    while (std::getline(memFile, line)) {
-        std::istringstream iss(line);
-        if (iss >> key >> value >> unit) {
-            if (key == "MemTotal:") {
-                totalMem = value;
-            } else if (key == "MemAvailable:") {
-                availableMem = value;
-            }
-            // 两个字段都获取到后可提前退出，减少循环
-            if (totalMem != 0 && availableMem != 0) {
-                break;
-            }
+    uint64_t totalMem = 0;    // 总内存（单位：KB）
+    uint64_t availableMem = 0;// 实际可用内存（单位：KB，含可回收缓存）
+
+    // MemTotal 和 MemAvailable 在文件开头几行，1KB 缓冲区足够；两个字段都拿到后提前退出
+    const char *p = memBuf.data();
+    const char *end = p + n;
+    while (p < end && (totalMem == 0 || availableMem == 0)) {
+        const char *eol = LineEnd(p, end);
+        if (eol == nullptr) {
+            break;
         }
+        if (HasPrefix(p, eol, "MemTotal:", 9)) {
+            ScanU64(p + 9, eol, totalMem);
+        } else if (HasPrefix(p, eol, "MemAvailable:", 13)) {
+            ScanU64(p + 13, eol, availableMem);
+        }
+        p = eol + 1;
     }
 
     // 校验数据有效性
@@ -65,7 +163,7 @@ double MachineInfoCollectorBase::GetMemoryUsage() {
     }
 
     // 计算内存使用率（0.0~1.0）：1 - 可用内存/总内存
-    return 1.0 - static_cast<double>(availableMem) / totalMem;
+    return 1.0 - static_cast<double>(availableMem) / static_cast<double>(totalMem);
 #endif
 }
 
@@ -81,6 +179,7 @@ double MachineInfoCollectorBase::GetNetBandwidth() {
 
 void MachineInfoCollectorBase::StartCollect() {
     collectorThread = std::thread(&MachineInfoCollectorBase::CollectThread, this);
+    cpuThread = std::thread(&MachineInfoCollectorBase::CpuSampleThread, this);
 }
 
 void MachineInfoCollectorBase::StopCollect() {
@@ -88,20 +187,33 @@ void MachineInfoCollectorBase::StopCollect() {
     if (collectorThread.joinable()) {
         collectorThread.join();
     }
+    if (cpuThread.joinable()) {
+        cpuThread.join();
+    }
+}
+
+void MachineInfoCollectorBase::SetCpuSampleIntervalMs(int interval_ms) {
+    cpuSampleMs.store(std::max(1, interval_ms));
 }
 
 MachineInfoCollectorBase::~MachineInfoCollectorBase() {
     StopCollect();
 }
 
-void MachineInfoCollectorBase::CollectThread() {
+void MachineInfoCollectorBase::CpuSampleThread() {
+    // CPU 采样单独一个线程：不被网络探测（最长 200ms 超时）拖慢，可以配到 10~20ms
     while (!stop_.load()) {
         try {
             CollectCpuUsage();
         } catch (const std::exception &e) {
             spdlog::error("Failed to collect CPU usage: {}", e.what());
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(cpuSampleMs.load()));
+    }
+}
 
+void MachineInfoCollectorBase::CollectThread() {
+    while (!stop_.load()) {
         try {
             CollectNetLatency();
         } catch (const std::exception &e) {
@@ -122,44 +234,76 @@ void MachineInfoCollectorBase::CollectThread() {
 void MachineInfoCollectorBase::CollectCpuUsage() {
 #ifdef _WIN32
     // Windows: not implemented; keep CPU usage at 0
-    std::lock_guard lock(collectorMutex);
-    cpuUsageQueue.pop_front();
-    cpuUsageQueue.push_back(0.0);
     return;
 #else
-    CpuUsageInfo cpuUsage{};
+    // window / period + 1 samples: the oldest and the newest lie kCpuUsageWindowMs apart
+    const size_t slots = static_cast<size_t>(kCpuUsageWindowMs / cpuSampleMs.load()) + 1;
+    if (cpuHistory.size() != std::max<size_t>(slots, 2)) {
+        cpuHistory.assign(std::max<size_t>(slots, 2), CpuSnapshot{});
+        cpuHistoryNext = 0;
+        cpuHistoryCount = 0;
+    }
+    const size_t ring = cpuHistory.size();
+    // the slot written now is the oldest sample once the ring is full; it is no longer valid from here on
+    cpuHistoryCount = std::min(cpuHistoryCount, ring - 1);
 
-    std::ifstream file("/proc/stat");
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open /proc/stat");
+    const size_t n = statFile.Read(statBuf.data(), statBuf.size());
+    if (n == 0) {
+        throw std::runtime_error("Failed to read /proc/stat");
     }
 
-    std::string name;
-    file >> name;
-    if (name != "cpu") {
+    // "cpu" 汇总行在最前，随后是 cpu0..cpuN；遇到第一行非 cpu 行即停止（intr 等长行不解析）
+    CpuSnapshot &curr = cpuHistory[cpuHistoryNext];
+    bool hasTotal = false;
+    size_t cores = 0;
+    const char *p = statBuf.data();
+    const char *end = p + n;
+    while (p < end) {
+        const char *eol = LineEnd(p, end);
+        if (eol == nullptr || !HasPrefix(p, eol, "cpu", 3)) {
+            break;
+        }
+        const char *q = p + 3;
+        if (q < eol && *q == ' ') {
+            hasTotal = ParseCpuCounters(q, eol, curr.total);
+        } else {
+            uint64_t index = 0;
+            q = ScanU64(q, eol, index);
+            if (q != nullptr) {
+                if (cores == curr.cores.size()) {
+                    curr.cores.emplace_back(); // grows only when cores show up
+                }
+                if (ParseCpuCounters(q, eol, curr.cores[cores])) {
+                    cores++;
+                }
+            }
+        }
+        p = eol + 1;
+    }
+    if (!hasTotal) {
         throw std::runtime_error("Failed to parse /proc/stat");
     }
+    curr.cores.resize(cores);
+    cpuHistoryCount++;
+    cpuHistoryNext = (cpuHistoryNext + 1) % ring;
+    if (cpuHistoryCount < 2) {
+        return;
+    }
 
-    uint64_t nice;
-    file >> cpuUsage.user >> nice >> cpuUsage.system >> cpuUsage.idle;
-
-    // update
-    {
-        std::lock_guard lock(collectorMutex);
-        prevCpuUsage = currCpuUsage;
-        currCpuUsage = cpuUsage;
-
-        uint64_t prevTotal = prevCpuUsage.user + prevCpuUsage.system + prevCpuUsage.idle;
-        uint64_t currTotal = currCpuUsage.user + currCpuUsage.system + currCpuUsage.idle;
-
-        uint64_t totalDiff = currTotal - prevTotal;
-        uint64_t idleDiff = currCpuUsage.idle - prevCpuUsage.idle;
-
-        if (totalDiff != 0) {
-            double usage = 1.0 - (double) idleDiff / totalDiff;
-            cpuUsageQueue.pop_front();
-            cpuUsageQueue.push_back(usage);
-        }
+    // one counter delta across the whole window: at USER_HZ=100 a 10ms period alone is a single jiffy per core
+    const CpuSnapshot &prev = cpuHistory[(cpuHistoryNext + ring - cpuHistoryCount) % ring];
+    const uint64_t totalDiff = Delta(curr.total.Total(), prev.total.Total());
+    if (totalDiff == 0) {
+        return;
+    }
+    const double total = static_cast<double>(totalDiff);
+    std::lock_guard lock(collectorMutex);
+    cpuBreakdown.usage = BusyRatio(prev.total, curr.total);
+    cpuBreakdown.iowait = static_cast<double>(Delta(curr.total.iowait, prev.total.iowait)) / total;
+    cpuBreakdown.steal = static_cast<double>(Delta(curr.total.steal, prev.total.steal)) / total;
+    cpuBreakdown.per_core.resize(cores);
+    for (size_t i = 0; i < cores; ++i) {
+        cpuBreakdown.per_core[i] = i < prev.cores.size() ? BusyRatio(prev.cores[i], curr.cores[i]) : 0.0;
     }
 #endif
 }
@@ -1,35 +1,76 @@
 #ifndef DOCKER_SCHEDULER_AGENT_MACHINEINFOCOLLECTORBASE_H
 #define DOCKER_SCHEDULER_AGENT_MACHINEINFOCOLLECTORBASE_H
 
+#include <array>
 #include <thread>
 #include <mutex>
 #include <string>
-#include <queue>
 #include <atomic>
+#include <cstdint>
+#include <vector>
 
-const static size_t kCpuUsageQueueSize = 5;
 const static double DISCONNECTTIME = 30.0;
 const static double RECONNECTTIME = 10.0;
+const static int kDefaultCpuSampleMs = 50;
+// CPU 占用按这段时间内的一次计数差计算，与采样周期无关：周期变短只让结果更新得更勤，不会让窗口变窄
+const static int kCpuUsageWindowMs = 250;
 
+// /proc/stat 一行 cpu 计数（单位 jiffies），guest 已计入 user，不单独累加
 struct CpuUsageInfo {
     uint64_t user;
+    uint64_t nice;
     uint64_t system;
     uint64_t idle;
+    uint64_t iowait;
+    uint64_t irq;
+    uint64_t softirq;
+    uint64_t steal;
+
+    uint64_t Total() const { return user + nice + system + idle + iowait + irq + softirq + steal; }
+};
+
+// /proc/stat 一次采样：汇总行和每核一行
+struct CpuSnapshot {
+    CpuUsageInfo total{};
+    std::vector<CpuUsageInfo> cores;
+};
+
+// 最近 kCpuUsageWindowMs 内的 CPU 占用拆分（0.0~1.0）
+struct CpuBreakdown {
+    double usage{0.0};   // busy = 1 - (idle + iowait) / total
+    double iowait{0.0};
+    double steal{0.0};
+    std::vector<double> per_core; // busy per core, cpu0..cpuN
+};
+
+// procfs 文件常开，每次采样用 pread 从偏移 0 重新读到调用方的固定缓冲区：不再 open/close，也不经过 ifstream/istringstream。
+class ProcFile {
+public:
+    explicit ProcFile(const char *path);
+    ~ProcFile();
+    ProcFile(const ProcFile &) = delete;
+    ProcFile &operator=(const ProcFile &) = delete;
+
+    /// @brief current content, at most cap bytes; 0 when the file is not available
+    size_t Read(char *buf, size_t cap);
+
+private:
+    const char *path;
+    int fd{-1};
 };
 
 class MachineInfoCollectorBase {
 public:
     MachineInfoCollectorBase(std::string gatewayIp, int gatewayPort)
             : gatewayIp(std::move(gatewayIp)), gatewayPort(gatewayPort) {
-        for (size_t i = 0; i < kCpuUsageQueueSize; i++) {
-            cpuUsageQueue.push_back(0.0);
-        }
         StartCollect();
     }
     virtual ~MachineInfoCollectorBase();
 
     double GetCpuUsage();
 
+    CpuBreakdown GetCpuBreakdown();
+
     double GetMemoryUsage();
 
     double GetNetLatency();
@@ -40,14 +81,32 @@ public:
 
     std::string GetGlobalId();
 
+    /// @brief period of the /proc/stat sampling thread (the network probes keep their own pace)
+    void SetCpuSampleIntervalMs(int interval_ms);
+
 private:
     std::thread collectorThread;
+    std::thread cpuThread;
     std::mutex collectorMutex;
     std::atomic<bool> stop_{false};
+    std::atomic<int> cpuSampleMs{kDefaultCpuSampleMs};
+
+    // owned by cpuThread; only the derived numbers below are shared
+    ProcFile statFile{"/proc/stat"};
+    std::array<char, 16384> statBuf{};
+    // ring of the samples spanning kCpuUsageWindowMs, sized from the sample period; slots keep their
+    // per-core storage, so a sample allocates nothing once the ring went round
+    std::vector<CpuSnapshot> cpuHistory;
+    size_t cpuHistoryNext{0};
+    size_t cpuHistoryCount{0};
 
-    CpuUsageInfo prevCpuUsage{};
-    CpuUsageInfo currCpuUsage{};
-    std::deque<double> cpuUsageQueue;
+    // guarded by collectorMutex
+    CpuBreakdown cpuBreakdown;
+
+    // /proc/meminfo is read on demand by the device_info handlers
+    std::mutex memMutex;
+    ProcFile meminfoFile{"/proc/meminfo"};
+    std::array<char, 1024> memBuf{};
 
     const std::string gatewayIp;
     const int gatewayPort{};
@@ -60,6 +119,8 @@ private:
 
     void CollectThread();
 
+    void CpuSampleThread();
+
     void CollectCpuUsage();
 
     void CollectNetLatency();
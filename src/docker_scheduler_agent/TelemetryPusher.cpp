@@ -0,0 +1,158 @@
+#include "TelemetryPusher.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+TelemetryPusher::TelemetryPusher(std::string gateway_ip, int push_port, std::string global_id, int interval_ms,
+                                 SampleFn sample)
+        : gatewayIp(std::move(gateway_ip)), pushPort(push_port), globalId(std::move(global_id)),
+          intervalMs(interval_ms), sample(std::move(sample)) {
+}
+
+TelemetryPusher::~TelemetryPusher() {
+    Stop();
+}
+
+bool TelemetryPusher::Start() {
+#ifdef _WIN32
+    spdlog::warn("telemetry push is not supported on Windows, gateway keeps polling /usage/device_info");
+    return false;
+#else
+    if (intervalMs <= 0 || pushThread.joinable()) {
+        return false;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(pushPort));
+    if (inet_pton(AF_INET, gatewayIp.c_str(), &addr.sin_addr) != 1) {
+        spdlog::error("telemetry push: invalid gateway ip {}", gatewayIp);
+        return false;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        spdlog::error("telemetry push: socket failed: {}", std::strerror(errno));
+        return false;
+    }
+    // connect() fixes the peer once, every send() is then a plain syscall without address lookups
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        spdlog::error("telemetry push: connect {}:{} failed: {}", gatewayIp, pushPort, std::strerror(errno));
+        close(sock);
+        sock = -1;
+        return false;
+    }
+    epoch = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    seq = 0;
+    hasReported = false;
+    stop_ = false;
+    pushThread = std::thread(&TelemetryPusher::PushLoop, this);
+    spdlog::info("telemetry push to {}:{}/udp every {}ms", gatewayIp, pushPort, intervalMs);
+    return true;
+#endif
+}
+
+void TelemetryPusher::Stop() {
+    stop_ = true;
+    if (pushThread.joinable()) {
+        pushThread.join();
+    }
+#ifndef _WIN32
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+#endif
+}
+
+void TelemetryPusher::SetChangeDriven(double epsilon, int heartbeat_ms) {
+    changeEpsilon = std::max(0.0, epsilon);
+    heartbeatMs = std::max(0, heartbeat_ms);
+}
+
+bool TelemetryPusher::Changed(const TelemetryDatagram &dgram) const {
+    if (!hasReported || dgram.services != reportedServices) {
+        return true;
+    }
+    const DeviceStatus &a = dgram.status;
+    const DeviceStatus &b = reportedStatus;
+    // utilisations are fractions: absolute threshold; latency/bandwidth have units: relative threshold
+    auto moved_abs = [this](double x, double y) { return std::fabs(x - y) > changeEpsilon; };
+    auto moved_rel = [this](double x, double y) { return std::fabs(x - y) > changeEpsilon * std::max(std::fabs(y), 1.0); };
+    return moved_abs(a.cpu_used, b.cpu_used) || moved_abs(a.mem_used, b.mem_used) || moved_abs(a.xpu_used, b.xpu_used) ||
+           moved_rel(a.net_latency, b.net_latency) || moved_rel(a.net_bandwidth, b.net_bandwidth) ||
+           a.disconnectTime != b.disconnectTime || a.reconnectTime != b.reconnectTime || a.timeWindow != b.timeWindow;
+}
+
+void TelemetryPusher::PushLoop() {
+#ifndef _WIN32
+    // sleep_until keeps the period fixed, sampling/sending time does not accumulate as drift
+    auto next = std::chrono::steady_clock::now();
+    while (!stop_) {
+        TelemetryDatagram dgram;
+        dgram.global_id = globalId;
+        dgram.epoch = epoch;
+        // change-driven: the gateway may see nothing for up to one heartbeat, so that is the period it expects
+        dgram.interval_ms = heartbeatMs > 0 ? std::max(heartbeatMs, intervalMs) : intervalMs;
+        try {
+            sample(dgram);
+            const auto now = std::chrono::steady_clock::now();
+            bool send_now = true;
+            if (heartbeatMs > 0) {
+                if (Changed(dgram)) {
+                    reportedStatus = dgram.status;
+                    reportedServices = dgram.services;
+                    hasReported = true;
+                } else if (now - lastSent >= std::chrono::milliseconds(heartbeatMs)) {
+                    // heartbeat repeats the last report verbatim, the gateway recognises it as "unchanged"
+                    dgram.status = reportedStatus;
+                } else {
+                    send_now = false;
+                    suppressed++;
+                }
+            }
+            if (send_now) {
+                dgram.seq = ++seq;
+                dgram.ts_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                std::string out = dgram.EncodeBinary();
+                if (out.size() > kMaxTelemetryDatagram) {
+                    spdlog::warn("telemetry datagram too large ({} bytes), services list dropped", out.size());
+                    dgram.services.clear();
+                    out = dgram.EncodeBinary();
+                }
+                lastSent = now;
+                if (send(sock, out.data(), out.size(), 0) < 0) {
+                    // ECONNREFUSED etc. just mean the gateway is not listening right now; retry next period
+                    if (sendFailed++ % 100 == 0) {
+                        spdlog::warn("telemetry push send failed: {} (x{})", std::strerror(errno), sendFailed);
+                    }
+                }
+                if (seq % 1000 == 0) {
+                    spdlog::debug("telemetry push: sent {}, suppressed {} unchanged samples", seq, suppressed);
+                }
+            }
+        } catch (const std::exception &e) {
+            spdlog::error("telemetry push error: {}", e.what());
+        }
+        next += std::chrono::milliseconds(intervalMs);
+        const auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now; // fell behind (suspend, slow sampling): skip the missed periods instead of bursting
+        }
+        // wake up in small steps so Stop() does not wait a whole period
+        while (!stop_ && std::chrono::steady_clock::now() < next) {
+            std::this_thread::sleep_until(std::min(next, std::chrono::steady_clock::now() + std::chrono::milliseconds(100)));
+        }
+    }
+#endif
+}
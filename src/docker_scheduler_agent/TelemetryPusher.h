@@ -0,0 +1,60 @@
+#ifndef DOCKER_SCHEDULER_AGENT_TELEMETRYPUSHER_H
+#define DOCKER_SCHEDULER_AGENT_TELEMETRYPUSHER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "telemetry.h"
+
+// 按固定周期把本机 DeviceStatus 以 UDP 数据报推给 gateway，gateway 不再需要逐台轮询。
+// 推送丢了也没关系：下一周期的样本会覆盖它，gateway 只保留每台设备最新的一条。
+// SetChangeDriven 开启按变化上报：每周期仍采样，但只在某项指标变化超过 epsilon 或服务列表变化时发送，
+// 否则最多每 heartbeat_ms 发一次心跳（原样重复上次上报的状态），空闲集群的遥测流量与 gateway 开销随之下降。
+class TelemetryPusher {
+public:
+    // fills status + services; seq/ts_ms/interval_ms are stamped by the pusher
+    using SampleFn = std::function<void(TelemetryDatagram &)>;
+
+    // push_port is the gateway's UDP telemetry port (--telemetry-udp-port), not its HTTP port
+    TelemetryPusher(std::string gateway_ip, int push_port, std::string global_id, int interval_ms, SampleFn sample);
+    ~TelemetryPusher();
+    TelemetryPusher(const TelemetryPusher &) = delete;
+    TelemetryPusher &operator=(const TelemetryPusher &) = delete;
+
+    /// @brief report only changes beyond epsilon, heartbeat at least every heartbeat_ms (0 = send every period); call before Start
+    void SetChangeDriven(double epsilon, int heartbeat_ms);
+    /// @brief open the socket and start the push thread; false when the socket cannot be set up
+    bool Start();
+    void Stop();
+
+private:
+    void PushLoop();
+    /// @brief the sample differs from the last report by more than the threshold
+    bool Changed(const TelemetryDatagram &dgram) const;
+
+    const std::string gatewayIp;
+    const int pushPort;
+    const std::string globalId;
+    const int intervalMs;
+    SampleFn sample;
+
+    int sock{-1};
+    int64_t epoch{0};
+    uint64_t seq{0};
+    uint64_t sendFailed{0};
+    double changeEpsilon{0.0};
+    int heartbeatMs{0};
+    bool hasReported{false};
+    DeviceStatus reportedStatus{};
+    std::vector<std::string> reportedServices;
+    std::chrono::steady_clock::time_point lastSent{};
+    uint64_t suppressed{0};
+    std::atomic<bool> stop_{false};
+    std::thread pushThread;
+};
+
+#endif // DOCKER_SCHEDULER_AGENT_TELEMETRYPUSHER_H
@@ -1,4 +1,5 @@
 #include "MachineInfoCollector.h"
+#include "TelemetryPusher.h"
 #include <httplib.h>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
@@ -508,7 +509,8 @@ static void StartSlaveServices(const std::string &device_id) {
     } else {
         rst_send_cmd =
             "{PYTHON} src/modules/slave/rst_send.py --config config_files/slave_backend.json "
-            "--input-dir workspace/slave/data --interval 5 --target-port 8888";
+            "--input-dir workspace/slave/data --interval 5 --target-port 8888 "
+            "--gateway-host {MASTER_IP} --gateway-port {MASTER_PORT} --device-id {DEVICE_ID}";
     }
 
     recv_server_cmd = ReplaceAll(recv_server_cmd, "{PYTHON}", python_bin);
@@ -658,6 +660,41 @@ static void AutoConnectThread(MachineInfoCollector &collector, int disconnect_se
     }
 }
 
+// 采集一次本机状态：/usage/device_info 和 UDP 推送共用
+static DeviceStatus SampleDeviceStatus(MachineInfoCollector &collector, bool bandwidth_fluctuate, int disconnect_sec, int reconnect_sec) {
+    DeviceStatus dev_info{};
+    dev_info.disconnectTime = disconnect_sec;
+    dev_info.reconnectTime = reconnect_sec;
+    dev_info.timeWindow = 5;
+    dev_info.cpu_used = collector.GetCpuUsage();
+    dev_info.mem_used = collector.GetMemoryUsage();
+    dev_info.xpu_used = collector.GetNpuUsage();
+    dev_info.net_latency = collector.GetNetLatency(); // ms
+
+    // 处理带宽波动
+    double bandwidth;
+    if (bandwidth_fluctuate) {
+        bandwidth = bandwidth_dist(gen);
+    } else {
+        bandwidth = collector.GetNetBandwidth();
+    }
+    dev_info.net_bandwidth = bandwidth;
+
+    // 采集日志改为 debug，避免高频刷屏（master 会周期性拉取）
+    spdlog::debug(
+        "device_info cpu={:.2f}% mem={:.2f}% xpu={:.2f}% latency_ms={} bandwidth_mbps={:.2f} disconnect={} reconnect={}",
+        dev_info.cpu_used * 100,
+        dev_info.mem_used * 100,
+        dev_info.xpu_used * 100,
+        dev_info.net_latency,
+        dev_info.net_bandwidth,
+        dev_info.disconnectTime,
+        dev_info.reconnectTime
+    );
+
+    return dev_info;
+}
+
 // 打印帮助信息
 static void PrintHelp(const char* program_name) {
     std::cout << "Usage: " << program_name << " [options]\n"
@@ -671,6 +708,13 @@ static void PrintHelp(const char* program_name) {
               << "  --services-config <path> agent_services.json path (default: config_files/agent_services.json)\n"
               << "  --backend-config <path>  slave_backend.json path (default: config_files/slave_backend.json)\n"
               << "  --allow-remote-control   allow non-local ensure_service calls\n"
+              << "  --push-interval-ms <ms>  Push device status to master via UDP every <ms> (default: 0, off)\n"
+              << "  --push-port <port>       Gateway UDP port for pushed telemetry, must match the gateway's\n"
+              << "                           --telemetry-udp-port (default: 6666)\n"
+              << "  --push-heartbeat-ms <ms> Only push when status changes, at least every <ms> (default: 0, every interval)\n"
+              << "  --push-epsilon <x>       Change threshold for --push-heartbeat-ms (default: 0.05)\n"
+              << "  --cpu-sample-ms <ms>     /proc/stat sampling period (default: 50); usage is taken over the\n"
+              << "                           last 250ms whatever the period, per-core resolution ~4% at USER_HZ=100\n"
               << "  --help                   Show this help message\n" << std::endl;
 }
 
@@ -686,6 +730,11 @@ int main(int argc, char* argv[]) {
     int disconnect_sec = 30;    // 默认断连时间30秒
     int reconnect_sec = 20;     // 默认重连时间20秒
     bool bandwidth_fluctuate = false;  // 默认不开启带宽波动
+    int push_interval_ms = 0;   // 默认不主动推送，由 master 轮询 /usage/device_info
+    int push_heartbeat_ms = 0;  // >0 时只在状态变化时推送，最长每 push_heartbeat_ms 发一次心跳
+    double push_epsilon = 0.05; // 利用率按绝对值、时延/带宽按相对值超过该阈值才算变化
+    int push_port = kDefaultTelemetryUdpPort; // gateway 的 UDP 遥测端口（--telemetry-udp-port），不是 HTTP 端口
+    int cpu_sample_ms = kDefaultCpuSampleMs; // CPU 占用采样周期
 
     // 解析命令行参数（允许disconnect_sec <=0）
     for (int i = 1; i < argc; ++i) {
@@ -727,6 +776,56 @@ int main(int argc, char* argv[]) {
         else if (arg == "--allow-remote-control") {
             g_allow_remote_control = true;
         }
+        else if (arg == "--push-interval-ms" && i + 1 < argc) {
+            try {
+                push_interval_ms = std::stoi(argv[++i]);
+                if (push_interval_ms < 0) throw std::invalid_argument("must not be negative");
+            } catch (const std::exception& e) {
+                spdlog::error("Invalid push interval: {}", e.what());
+                PrintHelp(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--push-port" && i + 1 < argc) {
+            try {
+                push_port = std::stoi(argv[++i]);
+                if (push_port <= 0 || push_port > 65535) throw std::invalid_argument("must be 1..65535");
+            } catch (const std::exception& e) {
+                spdlog::error("Invalid push port: {}", e.what());
+                PrintHelp(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--push-heartbeat-ms" && i + 1 < argc) {
+            try {
+                push_heartbeat_ms = std::stoi(argv[++i]);
+                if (push_heartbeat_ms < 0) throw std::invalid_argument("must not be negative");
+            } catch (const std::exception& e) {
+                spdlog::error("Invalid push heartbeat: {}", e.what());
+                PrintHelp(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--cpu-sample-ms" && i + 1 < argc) {
+            try {
+                cpu_sample_ms = std::stoi(argv[++i]);
+                if (cpu_sample_ms <= 0) throw std::invalid_argument("must be positive");
+            } catch (const std::exception& e) {
+                spdlog::error("Invalid cpu sample period: {}", e.what());
+                PrintHelp(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--push-epsilon" && i + 1 < argc) {
+            try {
+                push_epsilon = std::stod(argv[++i]);
+                if (push_epsilon < 0) throw std::invalid_argument("must not be negative");
+            } catch (const std::exception& e) {
+                spdlog::error("Invalid push epsilon: {}", e.what());
+                PrintHelp(argv[0]);
+                return 1;
+            }
+        }
 
         else if (arg == "--master-ip" && i + 1 < argc) {
             g_gateway_ip = argv[++i];
@@ -759,10 +858,21 @@ int main(int argc, char* argv[]) {
     }
     spdlog::info("Auto-reconnect time: {}s", reconnect_sec);
     spdlog::info("Bandwidth fluctuation: {}", (bandwidth_fluctuate ? "Enabled (50-500Mbps)" : "Disabled"));
+    spdlog::info("CPU sample period: {}ms", cpu_sample_ms);
+    if (push_interval_ms > 0) {
+        spdlog::info("Telemetry push interval: {}ms, to udp port {} (gateway needs --telemetry-udp-port {})",
+                     push_interval_ms, push_port, push_port);
+        if (push_heartbeat_ms > 0) {
+            spdlog::info("Telemetry push on change (epsilon {}), heartbeat: {}ms", push_epsilon, push_heartbeat_ms);
+        }
+    } else {
+        spdlog::info("Telemetry push: Disabled");
+    }
     spdlog::info("===============================\n");
 
     // 使用动态地址初始化 MachineInfoCollector
     MachineInfoCollector collector(g_gateway_ip, g_gateway_port);
+    collector.SetCpuSampleIntervalMs(cpu_sample_ms);
     httplib::Server server;
     // 允许在收到信号后优雅退出 listen，从而走到清理逻辑
     std::thread([&server]() {
@@ -788,6 +898,17 @@ int main(int argc, char* argv[]) {
 
     std::thread auto_connect_thread(AutoConnectThread, std::ref(collector), disconnect_sec, reconnect_sec);
 
+    // 主动推送遥测（--push-interval-ms > 0）；gateway 收到推送后就不再轮询本机 /usage/device_info
+    TelemetryPusher pusher(g_gateway_ip, push_port, collector.GetGlobalId(), push_interval_ms,
+                           [&collector, bandwidth_fluctuate, disconnect_sec, reconnect_sec](TelemetryDatagram &dgram) {
+                               dgram.status = SampleDeviceStatus(collector, bandwidth_fluctuate, disconnect_sec, reconnect_sec);
+                               dgram.services = GetRunningBackendsSnapshot();
+                           });
+    if (push_interval_ms > 0) {
+        pusher.SetChangeDriven(push_epsilon, push_heartbeat_ms);
+        pusher.Start();
+    }
+
     // 异常处理
     server.set_exception_handler([](const auto &req, auto &res, std::exception_ptr ep) {
         res.status = httplib::OK_200;
@@ -804,40 +925,29 @@ int main(int argc, char* argv[]) {
     });
 
     // 设备信息接口（附带打印）
-    server.Get("/usage/device_info", [&collector, bandwidth_fluctuate, disconnect_sec, reconnect_sec](const httplib::Request &, httplib::Response &res) {
-        DeviceStatus dev_info;
-        dev_info.disconnectTime = disconnect_sec;
-        dev_info.reconnectTime = reconnect_sec;
-        dev_info.timeWindow = 5;
-        dev_info.cpu_used = collector.GetCpuUsage();
-        dev_info.mem_used = collector.GetMemoryUsage();
-        dev_info.xpu_used = collector.GetNpuUsage();
-        dev_info.net_latency = collector.GetNetLatency(); // ms
-
-        // 处理带宽波动
-        double bandwidth;
-        if (bandwidth_fluctuate) {
-            bandwidth = bandwidth_dist(gen);
-        } else {
-            bandwidth = collector.GetNetBandwidth();
-        }
-        dev_info.net_bandwidth = bandwidth;
-
-        // 采集日志改为 debug，避免高频刷屏（master 会周期性拉取）
-        spdlog::debug(
-            "device_info cpu={:.2f}% mem={:.2f}% xpu={:.2f}% latency_ms={} bandwidth_mbps={:.2f} disconnect={} reconnect={}",
-            dev_info.cpu_used * 100,
-            dev_info.mem_used * 100,
-            dev_info.xpu_used * 100,
-            dev_info.net_latency,
-            dev_info.net_bandwidth,
-            dev_info.disconnectTime,
-            dev_info.reconnectTime
-        );
+    server.Get("/usage/device_info", [&collector, bandwidth_fluctuate, disconnect_sec, reconnect_sec](const httplib::Request &req, httplib::Response &res) {
+        DeviceStatus dev_info = SampleDeviceStatus(collector, bandwidth_fluctuate, disconnect_sec, reconnect_sec);
+
+        // master 在 Accept 里声明支持二进制编码时返回定长二进制（见 telemetry.h），否则保持原 JSON 格式
+        if (req.get_header_value("Accept").find(kTelemetryBinaryContentType) != std::string::npos) {
+            TelemetryDatagram dgram;
+            dgram.global_id = collector.GetGlobalId();
+            dgram.ts_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            dgram.status = dev_info;
+            dgram.services = GetRunningBackendsSnapshot();
+            res.set_content(dgram.EncodeBinary(), kTelemetryBinaryContentType);
+            return;
+        }
 
         // 构建响应
         json payload = dev_info.to_json();
         payload["services"] = GetRunningBackendsSnapshot();
+        // CPU 拆分只在 JSON 里给出（二进制编码保持 DeviceStatus 定长布局）
+        const CpuBreakdown cpu = collector.GetCpuBreakdown();
+        payload["cpu_iowait"] = cpu.iowait;
+        payload["cpu_steal"] = cpu.steal;
+        payload["cpu_per_core"] = cpu.per_core;
         std::string result = BuildSuccess(payload);
         res.set_content(result, "application/json");
     });
@@ -891,12 +1001,14 @@ int main(int argc, char* argv[]) {
     if (!server.listen("0.0.0.0", kAgentPort)) {
         spdlog::error("Failed to start server");
         g_is_running = false; // 通知线程退出
+        pusher.Stop();
         auto_connect_thread.join(); // 等待线程结束
         return 1;
     }
 
     // 服务器退出时，通知线程并等待结束
     g_is_running = false;
+    pusher.Stop();
     StopAllManagedChildren();
     auto_connect_thread.join();
 
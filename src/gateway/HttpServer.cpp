@@ -1,4 +1,5 @@
 #include "HttpServer.h"
+#include "SchedulePolicy.h"
 #include "httplib.h"
 #include <algorithm>
 #include <spdlog/spdlog.h>
@@ -39,6 +40,7 @@ bool HttpServer::Start() {
     svr.Get(REQ_DETAIL_ROUTE, this->HandleReqDetail);
     svr.Get(SUB_REQ_ROUTE, this->HandleSubReq);
     svr.Get(NODES_ROUTE, this->HandleNodes);
+    svr.Get(QUEUES_ROUTE, this->HandleQueues);
 
     spdlog::info("HttpServer started success，ip:{} port:{}",this->ip, this->port);
     StartHealthCheckThread();
@@ -249,21 +251,41 @@ void HttpServer::HandleSchedule(const httplib::Request &req, httplib::Response &
         if (req_id.empty()) {
             req_id = filenames.front();
         }
+        const int64_t enqueue_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        // 截止时间：deadline_ms 为绝对时间（epoch ms），slo_ms 为相对入队时刻的时长；都不传（或为 null）则无截止时间。
+        // 已经过去的截止时间、非正的 slo_ms 会排到所在流所有真实 SLO 之前，直接拒绝
+        int64_t deadline_ms = 0;
+        auto given = [&body_json](const char *key) { return body_json.contains(key) && !body_json[key].is_null(); };
+        if (given("deadline_ms")) {
+            if (!body_json["deadline_ms"].is_number_integer() ||
+                body_json["deadline_ms"].get<int64_t>() < enqueue_time_ms) {
+                res.status = 400;
+                res.set_content(R"({"status":"error","msg":"deadline_ms must be an integer epoch ms not in the past"})", "application/json");
+                return;
+            }
+            deadline_ms = body_json["deadline_ms"].get<int64_t>();
+        } else if (given("slo_ms")) {
+            if (!body_json["slo_ms"].is_number_integer() || body_json["slo_ms"].get<int64_t>() <= 0) {
+                res.status = 400;
+                res.set_content(R"({"status":"error","msg":"slo_ms must be a positive integer"})", "application/json");
+                return;
+            }
+            deadline_ms = enqueue_time_ms + body_json["slo_ms"].get<int64_t>();
+        }
 
-        // 解析调度策略参数
+        // 解析调度策略参数，可选值见 SchedulePolicies 中注册的策略
         auto strategy_param = req.get_param_value("stargety");
         ScheduleStrategy strategy = ScheduleStrategy::LOAD_BASED; // 默认使用负载贪心策略
 
         if (!strategy_param.empty()) {
-            if (strategy_param == "roundrobin" || strategy_param == "round_robin") {
-                strategy = ScheduleStrategy::ROUND_ROBIN;
-            } else if (strategy_param == "load" || strategy_param == "负载贪心") {
-                strategy = ScheduleStrategy::LOAD_BASED;
-            } else {
+            auto parsed = SchedulePolicies::Parse(strategy_param);
+            if (!parsed.has_value()) {
                 res.status = 400;
                 res.set_content(R"({"status":"error","msg":"invalid stargety parameter"})", "application/json");
                 return;
             }
+            strategy = *parsed;
         }
 
         std::vector<ImageTask> tasks;
@@ -277,6 +299,8 @@ void HttpServer::HandleSchedule(const httplib::Request &req, httplib::Response &
             task.task_type = tasktype;
             task.schedule_strategy = strategy;
             task.req_id = req_id;
+            task.deadline_ms = deadline_ms;
+            task.enqueue_time_ms = enqueue_time_ms;
             tasks.push_back(task);
         }
 
@@ -286,15 +310,15 @@ void HttpServer::HandleSchedule(const httplib::Request &req, httplib::Response &
         client_req.task_type = tasktype;
         client_req.schedule_strategy = strategy;
         client_req.total_num = total_num;
-        client_req.enqueue_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        client_req.enqueue_time_ms = enqueue_time_ms;
+        client_req.deadline_ms = deadline_ms;
         client_req.tasks = std::move(tasks);
 
         Docker_scheduler::GetRequestTracker().OnClientRequest(client_req);
         Docker_scheduler::SubmitClientRequest(client_req);
 
-        spdlog::info("client_req {} enqueued: {} tasks, strategy={}", req_id, total_num,
-                     strategy == ScheduleStrategy::ROUND_ROBIN ? "round-robin" : "load-based");
+        spdlog::info("client_req {} enqueued: {} tasks, strategy={}, deadline_ms={}", req_id, total_num,
+                     SchedulePolicies::Name(strategy), deadline_ms);
         res.status = 202;
         res.set_content(R"({"status":"queued","msg":"task enqueued"})", "application/json");
 
@@ -416,9 +440,16 @@ void HttpServer::HandleTaskResultReady(const httplib::Request &req, httplib::Res
             return;
         }
         std::string task_id = jsonData["task_id"];
+        std::string device_id = jsonData.value("device_id", "");
+        // a speculated task has two copies: only the first one to get here sends its result
+        if (!Docker_scheduler::ClaimTaskResult(task_id, device_id, req.remote_addr)) {
+            res.status = 200;
+            res.set_content("{\"status\":\"ok\",\"action\":\"drop\",\"msg\":\"duplicate result\"}", "application/json");
+            return;
+        }
         Docker_scheduler::GetRequestTracker().OnTaskResultReady(task_id);
         res.status = 200;
-        res.set_content("{\"status\":\"ok\",\"msg\":\"task marked result_ready\"}", "application/json");
+        res.set_content("{\"status\":\"ok\",\"action\":\"send\",\"msg\":\"task marked result_ready\"}", "application/json");
     } catch (const std::exception &e) {
         spdlog::error("HandleTaskResultReady exception: {}", e.what());
         res.status = 400;
@@ -476,6 +507,12 @@ void HttpServer::HandleNodes(const httplib::Request &, httplib::Response &res) {
     res.set_content(payload.dump(), "application/json");
 }
 
+void HttpServer::HandleQueues(const httplib::Request &, httplib::Response &res) {
+    json payload = Docker_scheduler::BuildQueueSnapshot();
+    res.status = 200;
+    res.set_content(payload.dump(), "application/json");
+}
+
 void HttpServer::StartHealthCheckThread() {
     // Start only once; the server runs for the lifetime of the process.
     static std::atomic<bool> started{false};
@@ -510,11 +547,10 @@ void HttpServer::HealthCheckLoop() {
     while (!health_check_stop_.load()) {
         std::vector<DeviceID> to_recover;
         {
-            std::shared_lock<std::shared_mutex> lock(Docker_scheduler::getDeviceMutex());
-            auto &device_status = Docker_scheduler::getDeviceStatus();
+            const ClusterStatePtr state = Docker_scheduler::GetClusterState();
             const auto now = Clock::now();
 
-            for (const auto &[dev_id, status] : device_status) {
+            for (const auto &[dev_id, status] : state->status) {
                 const double latency_sec = status.net_latency / 1000.0; // agent reports ms
                 if (latency_sec <= HEALTH_CHECK_LATENCY_THRESHOLD) {
                     continue;
@@ -21,6 +21,7 @@ const std::string REQ_LIST_ROUTE = "/reqs";
 const std::string REQ_DETAIL_ROUTE = "/req";
 const std::string SUB_REQ_ROUTE = "/sub_req";
 const std::string NODES_ROUTE = "/nodes";
+const std::string QUEUES_ROUTE = "/queues";
 
 class HttpServer {
 public:
@@ -39,6 +40,7 @@ private:
     static void HandleReqDetail(const httplib::Request &req, httplib::Response &res);
     static void HandleSubReq(const httplib::Request &req, httplib::Response &res);
     static void HandleNodes(const httplib::Request &req, httplib::Response &res);
+    static void HandleQueues(const httplib::Request &req, httplib::Response &res);
 
     void StartHealthCheckThread();
     void HealthCheckLoop();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 
 struct Args {
     // Directory containing config files (e.g. static_info.json).
@@ -12,4 +13,46 @@ struct Args {
 
     // Keep uploaded files after successful completion (default: delete).
     bool keep_upload = false;
+
+    // Dispatch workers per slave device; each device drains its own queue.
+    int dispatch_workers = 1;
+
+    // Upload a sub-request (meta + all images) to the slave in one multipart request.
+    bool batch_dispatch = false;
+
+    // Finished requests stay fully queryable for this long / up to this many,
+    // then only a summary is kept in a fixed-size archive ring for /req.
+    int req_ttl_sec = 600;
+    int max_finished_reqs = 1000;
+    int req_archive_size = 10000;
+
+    // Pending work is ordered by deadline; work older than this ages in ahead of fresh work.
+    int max_queue_wait_ms = 30000;
+
+    // A device's share of a request is split into sub-requests of at most this many tasks (0 = no split).
+    int max_sub_req_tasks = 128;
+
+    // Single-task placement scores d random candidates instead of all of them (0 = exhaustive).
+    int sample_choices = 0;
+
+    // An idle dispatch worker steals queued work from clearly more backlogged devices after waiting this long (0 = no stealing).
+    int steal_idle_ms = 0;
+
+    // Backup copies of straggling tail tasks, at most this percent of dispatched tasks (0 = no speculation).
+    int speculation_budget = 0;
+
+    // Agents are polled for telemetry concurrently; a round waits at most this long for each of them.
+    int telemetry_deadline_ms = 1000;
+
+    // UDP port for telemetry pushed by agents (--push-interval-ms on the agent); 0 = polling only.
+    // Off by default like the agent's push; only datagrams from a device's registered address are accepted.
+    int telemetry_udp_port = 0;
+
+    // In-flight task limit per device: --credit-limit <key>=<n> with key "*", a DeviceType, a TaskType
+    // or "<DeviceType>:<TaskType>"; the most specific key wins, unset or 0 = unlimited.
+    std::unordered_map<std::string, int> credit_limits;
+
+    // Weighted fair queuing between (client_ip, tasktype) flows; weight = client weight * tasktype weight.
+    std::unordered_map<std::string, int> client_weights;   // --client-weight <ip>=<w>
+    std::unordered_map<std::string, int> tasktype_weights; // --tasktype-weight <TaskType>=<w>
 };
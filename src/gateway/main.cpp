@@ -1,10 +1,86 @@
 #include "HttpServer.h"
 #include "scheduler.h"
+#include "telemetry.h"
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
 
+// "RK3588" -> RK3588; false for anything that is not a DeviceType name
+static bool parse_device_type(const std::string &name, DeviceType &out) {
+    for (DeviceType dtype : {RK3588, ATLAS_L, ATLAS_H, ORIN}) {
+        if (nlohmann::json(dtype).get<std::string>() == name) {
+            out = dtype;
+            return true;
+        }
+    }
+    return false;
+}
+
+// --credit-limit keys -> CreditLimits
+static CreditLimits build_credit_limits(const std::unordered_map<std::string, int> &specs) {
+    CreditLimits limits;
+    for (const auto &[key, limit] : specs) {
+        const size_t n = static_cast<size_t>(limit);
+        const size_t colon = key.find(':');
+        DeviceType dtype;
+        if (key == "*") {
+            limits.default_limit = n;
+        } else if (colon != std::string::npos && parse_device_type(key.substr(0, colon), dtype) &&
+                   StrToTaskType(key.substr(colon + 1)) != TaskType::Unknown) {
+            limits.by_pair[{dtype, StrToTaskType(key.substr(colon + 1))}] = n;
+        } else if (colon == std::string::npos && parse_device_type(key, dtype)) {
+            limits.by_device[dtype] = n;
+        } else if (colon == std::string::npos && StrToTaskType(key) != TaskType::Unknown) {
+            limits.by_tasktype[StrToTaskType(key)] = n;
+        } else {
+            spdlog::warn("ignore credit limit '{}', expect *, <DeviceType>, <TaskType> or <DeviceType>:<TaskType>", key);
+            continue;
+        }
+        spdlog::info("credit limit {}={}", key, n);
+    }
+    return limits;
+}
+
+// whole string as an int; std::invalid_argument / std::out_of_range otherwise ("8x" is not 8)
+static int parse_int(const std::string &text) {
+    size_t used = 0;
+    const int value = std::stoi(text, &used);
+    if (used != text.size()) {
+        throw std::invalid_argument("not an integer: '" + text + "'");
+    }
+    return value;
+}
+
+// "<key>=<weight>" -> (key, weight); throws on a non-numeric weight
+static bool parse_weight(const std::string &spec, std::unordered_map<std::string, int> &out) {
+    const size_t eq = spec.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        spdlog::warn("ignore weight spec '{}', expect <key>=<weight>", spec);
+        return false;
+    }
+    out[spec.substr(0, eq)] = std::max(1, parse_int(spec.substr(eq + 1)));
+    return true;
+}
+
+// "<key>=<n>" -> (key, n); unlike a weight, 0 is meaningful (unlimited) and is kept as given.
+// A malformed or negative n throws like any other numeric flag; unknown keys are left to build_credit_limits
+static void parse_credit_limit(const std::string &spec, std::unordered_map<std::string, int> &out) {
+    const size_t eq = spec.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        throw std::invalid_argument("expect <key>=<n>");
+    }
+    const int n = parse_int(spec.substr(eq + 1));
+    if (n < 0) {
+        throw std::invalid_argument("expect n >= 0 (0 = unlimited)");
+    }
+    out[spec.substr(0, eq)] = n;
+}
+
+// a malformed numeric value ends the process with the offending flag named, instead of an uncaught exception
 static Args parse_arguments(int argc, char *argv[]) {
     Args args;
     args.config_path = "./myapp";
@@ -12,17 +88,82 @@ static Args parse_arguments(int argc, char *argv[]) {
 
     for (int i = 1; i < argc; ++i) {
         const std::string arg = argv[i];
-        if ((arg == "--config" || arg == "-c") && i + 1 < argc) {
-            args.config_path = argv[++i];
-            continue;
-        }
-        if ((arg == "--task" || arg == "-t") && i + 1 < argc) {
-            args.task_path = argv[++i];
-            continue;
-        }
-        if (arg == "--keep-upload") {
-            args.keep_upload = true;
-            continue;
+        try {
+            if ((arg == "--config" || arg == "-c") && i + 1 < argc) {
+                args.config_path = argv[++i];
+                continue;
+            }
+            if ((arg == "--task" || arg == "-t") && i + 1 < argc) {
+                args.task_path = argv[++i];
+                continue;
+            }
+            if (arg == "--keep-upload") {
+                args.keep_upload = true;
+                continue;
+            }
+            if (arg == "--dispatch-workers" && i + 1 < argc) {
+                args.dispatch_workers = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--batch-dispatch") {
+                args.batch_dispatch = true;
+                continue;
+            }
+            if (arg == "--req-ttl-sec" && i + 1 < argc) {
+                args.req_ttl_sec = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--max-finished-reqs" && i + 1 < argc) {
+                args.max_finished_reqs = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--req-archive-size" && i + 1 < argc) {
+                args.req_archive_size = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--max-queue-wait-ms" && i + 1 < argc) {
+                args.max_queue_wait_ms = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--max-sub-req-tasks" && i + 1 < argc) {
+                args.max_sub_req_tasks = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--sample-choices" && i + 1 < argc) {
+                args.sample_choices = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--steal-idle-ms" && i + 1 < argc) {
+                args.steal_idle_ms = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--speculation-budget" && i + 1 < argc) {
+                args.speculation_budget = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--telemetry-deadline-ms" && i + 1 < argc) {
+                args.telemetry_deadline_ms = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--telemetry-udp-port" && i + 1 < argc) {
+                args.telemetry_udp_port = parse_int(argv[++i]);
+                continue;
+            }
+            if (arg == "--credit-limit" && i + 1 < argc) {
+                parse_credit_limit(argv[++i], args.credit_limits);
+                continue;
+            }
+            if (arg == "--client-weight" && i + 1 < argc) {
+                parse_weight(argv[++i], args.client_weights);
+                continue;
+            }
+            if (arg == "--tasktype-weight" && i + 1 < argc) {
+                parse_weight(argv[++i], args.tasktype_weights);
+                continue;
+            }
+        } catch (const std::exception &e) {
+            spdlog::error("invalid value '{}' for {}: {}", argv[i], arg, e.what());
+            std::exit(1);
         }
     }
     return args;
@@ -31,10 +172,51 @@ static Args parse_arguments(int argc, char *argv[]) {
 int main(int argc, char *argv[]) {
     Args args = parse_arguments(argc, argv);
     spdlog::set_level(spdlog::level::info);
-    spdlog::info("parse params config_path: {}, task_path: {}, keep_upload: {}",
-                 args.config_path, args.task_path, args.keep_upload);
+    spdlog::info("parse params config_path: {}, task_path: {}, keep_upload: {}, dispatch_workers: {}, batch_dispatch: {}",
+                 args.config_path, args.task_path, args.keep_upload, args.dispatch_workers, args.batch_dispatch);
+    spdlog::info("request retention: ttl={}s, max_finished={}, archive_size={}, max_queue_wait_ms={}",
+                 args.req_ttl_sec, args.max_finished_reqs, args.req_archive_size, args.max_queue_wait_ms);
 
+    Docker_scheduler::SetDispatchWorkersPerDevice(args.dispatch_workers);
+    Docker_scheduler::SetBatchUpload(args.batch_dispatch);
+    Docker_scheduler::SetMaxQueueWait(args.max_queue_wait_ms);
+    Docker_scheduler::SetMaxSubRequestTasks(args.max_sub_req_tasks);
+    Docker_scheduler::SetSampleChoices(args.sample_choices);
+    Docker_scheduler::SetStealIdleMs(args.steal_idle_ms);
+    Docker_scheduler::SetSpeculationBudget(args.speculation_budget);
+    Docker_scheduler::SetCreditLimits(build_credit_limits(args.credit_limits));
+    Docker_scheduler::SetTelemetryDeadlineMs(args.telemetry_deadline_ms);
+    Docker_scheduler::SetTelemetryUdpPort(args.telemetry_udp_port);
+    if (args.telemetry_udp_port <= 0) {
+        spdlog::info("telemetry push receiver off, agents are polled (enable with --telemetry-udp-port {})",
+                     kDefaultTelemetryUdpPort);
+    } else if (args.telemetry_udp_port != kDefaultTelemetryUdpPort) {
+        spdlog::warn("telemetry push on udp {}: agents push to {} unless started with --push-port {}",
+                     args.telemetry_udp_port, kDefaultTelemetryUdpPort, args.telemetry_udp_port);
+    }
+    std::unordered_map<TaskType, int> tasktype_weights;
+    for (const auto &pair : args.tasktype_weights) {
+        const TaskType ttype = StrToTaskType(pair.first);
+        if (ttype == TaskType::Unknown) {
+            spdlog::warn("ignore tasktype weight '{}={}', not a TaskType name", pair.first, pair.second);
+            continue;
+        }
+        tasktype_weights[ttype] = pair.second;
+        spdlog::info("tasktype weight {}={}", pair.first, pair.second);
+    }
+    for (const auto &pair : args.client_weights) {
+        spdlog::info("client weight {}={}", pair.first, pair.second);
+    }
+    Docker_scheduler::SetFlowWeights(args.client_weights, tasktype_weights);
+    RetentionOptions retention;
+    retention.finished_ttl_ms = static_cast<int64_t>(std::max(0, args.req_ttl_sec)) * 1000;
+    retention.max_finished = static_cast<size_t>(std::max(0, args.max_finished_reqs));
+    retention.archive_capacity = static_cast<size_t>(std::max(0, args.req_archive_size));
+    Docker_scheduler::GetRequestTracker().SetRetention(retention);
     Docker_scheduler::init(args.config_path + "/static_info.json");
+    if (!Docker_scheduler::loadModel(args.config_path + "/latency_model.json")) {
+        spdlog::warn("latency model not loaded, ?stargety=predict falls back to round robin");
+    }
     Docker_scheduler::startDeviceInfoCollection();
 
     const std::string addr = "0.0.0.0";
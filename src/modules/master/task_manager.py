@@ -309,8 +309,10 @@ if __name__ == "__main__":
 
     parser = argparse.ArgumentParser(description="gRPC ImageUpload server")
     parser.add_argument("-p", "--port", type=int, default=9999, help="gRPC listen port (default: 50051)")
-    parser.add_argument("-s", "--strategy", choices=["load", "roundrobin"], default="load",
-                        help="Scheduling strategy: load=load-based priority, roundrobin=round-robin scheduling (default: load)")
+    parser.add_argument("-s", "--strategy", choices=["load", "roundrobin", "completion", "predict"], default="load",
+                        help="Scheduling strategy: load=load-based priority, roundrobin=round-robin scheduling, "
+                             "completion=earliest estimated finish time from profiled proc_time, "
+                             "predict=lowest end-to-end time from the latency model (default: load)")
     # 添加新的上传路径参数
     parser.add_argument("-u", "--upload_path", type=str, default=None,
                         help=f"Custom upload directory path (default: {DEFAULT_UPLOAD_ROOT})")
@@ -10,6 +10,7 @@ import argparse
 from concurrent.futures import ThreadPoolExecutor
 
 from flask import Flask, jsonify, request
+from werkzeug.serving import WSGIRequestHandler
 
 # 基本配置 - 使用固定路径，不再使用环境变量
 CURRENT_DIR = os.path.dirname(os.path.abspath(__file__))
@@ -292,19 +293,24 @@ def bump_and_maybe_log():
             lf.write(line)
 
 
+# ===== master 连接池健康检查（keep-alive 连接空闲较久时探测） =====
+@app.get("/healthz")
+def healthz():
+    return build_success({"status": "ok"})
+
+
 # ===== /srv：接收图片并落盘（线程池执行写盘） =====
-@app.post("/recv_sub_req_meta")
-def recv_sub_req_meta():
-    payload = request.get_json(force=True, silent=True) or {}
+def _register_sub_req(payload: dict):
+    """登记一个 sub_req（meta）；返回 (state, error)。"""
     sub_req_id = payload.get("sub_req_id")
     req_id = payload.get("req_id")
     sub_req_count = payload.get("sub_req_count")
     if not isinstance(sub_req_id, str) or not sub_req_id.strip():
-        return build_failed("sub_req_id required")
+        return None, "sub_req_id required"
     if not isinstance(req_id, str) or not req_id.strip():
-        return build_failed("req_id required")
+        return None, "req_id required"
     if not isinstance(sub_req_count, int) or sub_req_count <= 0:
-        return build_failed("sub_req_count must be positive int")
+        return None, "sub_req_count must be positive int"
 
     entry = {
         "req_id": req_id,
@@ -316,7 +322,7 @@ def recv_sub_req_meta():
         "enqueue_time_ms": payload.get("enqueue_time_ms", 0),
         "meta_time": time.time(),
         "start_time_ms": None,
-        "expected_end_time_ms": 0,
+        "expected_end_time_ms": payload.get("expected_end_time_ms", 0),
         "queue_len_at_start": None,
         "client_ip": "",
         "service": "",
@@ -339,9 +345,8 @@ def recv_sub_req_meta():
     ready_root = os.path.join(input_root, "_sub_reqs_ready", service_dir, sub_dir_name)
     os.makedirs(staging_root, exist_ok=True)
 
-    with SUB_REQ_QUEUE_LOCK:
-        SUB_REQ_QUEUE.setdefault(service_name, []).append(sub_req_id)
-    SUB_REQ_STATE[sub_req_id] = {
+    state = {
+        "sub_req_id": sub_req_id,
         "expected": sub_req_count,
         "received": 0,
         "service_name": service_name,
@@ -351,64 +356,29 @@ def recv_sub_req_meta():
         "seq": seq,
         "promoted": False,
     }
+    with SUB_REQ_QUEUE_LOCK:
+        SUB_REQ_QUEUE.setdefault(service_name, []).append(sub_req_id)
+    SUB_REQ_STATE[sub_req_id] = state
     _ensure_worker(service_name)
+    return state, None
 
-    return build_success({"sub_req_id": sub_req_id})
-
-
-@app.post("/recv_task")
-def srv():
-    if not request.content_type or "multipart/form-data" not in request.content_type:
-        return build_failed("expect multipart/form-data")
-
-    # 1) 图片
-    file_storage = request.files.get("pic_file") or (
-        next(iter(request.files.values())) if request.files else None
-    )
-    if file_storage is None:
-        return build_failed("missing image file part (pic_file)")
-
-    # 2) JSON（优先 pic_info，其次 meta/json，最后遍历表单尝试解析）
-    meta_raw = (
-        request.form.get("pic_info")
-        or request.form.get("meta")
-        or request.form.get("json")
-    )
-    meta = None
-    if meta_raw:
-        try:
-            meta = json.loads(meta_raw)
-        except Exception as ex:
-            return build_failed(f"bad meta json: {ex}")
-    else:
-        for v in request.form.values():
-            try:
-                cand = json.loads(v)
-                if isinstance(cand, dict) and "ip" in cand and "file_name" in cand:
-                    meta = cand
-                    break
-            except Exception:
-                continue
-        if meta is None:
-            return build_failed("missing meta json (expect fields: ip, file_name)")
 
-    # 3) 取 ip 与 file_name（task_type 暂不使用）
+def _store_task(meta: dict, data: bytes):
+    """校验 meta 并把一张图片落盘；返回 (result, error)。"""
+    # 取 ip 与 file_name（task_type 暂不使用）
     src_ip = meta.get("ip")
     file_name = meta.get("file_name")
     tasktype = _normalize_tasktype(meta.get("tasktype", "Unknown"))
     if not isinstance(src_ip, str) or not src_ip.strip():
-        return build_failed("meta.ip required")
+        return None, "meta.ip required"
     if not isinstance(file_name, str) or not file_name.strip():
-        return build_failed("meta.file_name required")
+        return None, "meta.file_name required"
 
     ext = os.path.splitext(file_name)[1].lower()
     if ext not in ALLOWED_EXTS:
-        return build_failed("only jpg/jpeg/png/tif/tiff allowed")
-
-    # 4) 读取文件到内存（落盘在线程池执行）
-    data = file_storage.stream.read()
+        return None, "only jpg/jpeg/png/tif/tiff allowed"
 
-    # 5) service 选择：使用 tasktype 作为服务名；缺省时走 default_service
+    # service 选择：使用 tasktype 作为服务名；缺省时走 default_service
     cfg = _load_slave_backend_config(PROJECT_ROOT)
     service_name = tasktype if tasktype and tasktype != "Unknown" else _get_default_service(cfg)
     if not service_name or service_name == "Unknown":
@@ -418,14 +388,14 @@ def srv():
     if not entry:
         entry = {"backend": "local"}
 
-    # 6) 确保后端已启动：统一由 agent 管理（binary/container）
+    # 确保后端已启动：统一由 agent 管理（binary/container）
     try:
         if entry.get("backend") in ("binary", "container"):
             _ensure_backend_via_agent(service_name)
     except Exception as e:
-        return build_failed(f"start backend failed: {e}")
+        return None, f"start backend failed: {e}"
 
-    # 7) 落盘到：<input_dir>/<client_ip>/<file_name>
+    # 落盘到：<input_dir>/<client_ip>/<file_name>
     input_root = _resolve_path(PROJECT_ROOT, entry.get("input_dir", f"workspace/slave/data/input/{service_name}"))
     if not input_root:
         input_root = os.path.join(DATA_ROOT, service_name, "input")
@@ -451,27 +421,136 @@ def srv():
     final_path = os.path.join(dir_path, os.path.basename(file_name))
     tmp_path = final_path + ".part"
 
-    # 8) 写盘（线程池执行，避免阻塞 Flask worker）
+    # 写盘（线程池执行，避免阻塞 Flask worker）
     future = EXECUTOR.submit(save_bytes_to_file, tmp_path, final_path, data)
     try:
         size_bytes = future.result()  # 等待写盘完成后再返回
     finally:
         # 计数 + 每 500 记录一次时间戳
         bump_and_maybe_log()
+
+    return {
+        "service": service_name,
+        "saved_path": final_path,
+        "from_ip": src_ip,
+        "tasktype": tasktype,
+        "size_bytes": size_bytes,
+    }, None
+
+
+@app.post("/recv_sub_req_meta")
+def recv_sub_req_meta():
+    payload = request.get_json(force=True, silent=True) or {}
+    _, err = _register_sub_req(payload)
+    if err:
+        return build_failed(err)
+    return build_success({"sub_req_id": payload.get("sub_req_id")})
+
+
+@app.post("/recv_task")
+def srv():
+    if not request.content_type or "multipart/form-data" not in request.content_type:
+        return build_failed("expect multipart/form-data")
+
+    # 1) 图片
+    file_storage = request.files.get("pic_file") or (
+        next(iter(request.files.values())) if request.files else None
+    )
+    if file_storage is None:
+        return build_failed("missing image file part (pic_file)")
+
+    # 2) JSON（优先 pic_info，其次 meta/json，最后遍历表单尝试解析）
+    meta_raw = (
+        request.form.get("pic_info")
+        or request.form.get("meta")
+        or request.form.get("json")
+    )
+    meta = None
+    if meta_raw:
+        try:
+            meta = json.loads(meta_raw)
+        except Exception as ex:
+            return build_failed(f"bad meta json: {ex}")
+    else:
+        for v in request.form.values():
+            try:
+                cand = json.loads(v)
+                if isinstance(cand, dict) and "ip" in cand and "file_name" in cand:
+                    meta = cand
+                    break
+            except Exception:
+                continue
+        if meta is None:
+            return build_failed("missing meta json (expect fields: ip, file_name)")
+
+    # 3) 读取文件到内存（落盘在线程池执行）
+    data = file_storage.stream.read()
+    try:
+        result, err = _store_task(meta, data)
+    finally:
         # 显式关闭文件流，释放底层资源
         file_storage.stream.close()
         # 主动释放data内存（关键步骤）
         data = None  # 清除引用，让GC可以回收
+    if err:
+        return build_failed(err)
+    return build_success(result)
 
-    return build_success(
-        {
-            "service": service_name,
-            "saved_path": final_path,
-            "from_ip": src_ip,
-            "tasktype": tasktype,
-            "size_bytes": size_bytes,
-        }
-    )
+
+# ===== 批量接收：一次请求携带 sub_req meta + 全部图片，返回逐项状态 =====
+@app.post("/recv_sub_req_batch")
+def recv_sub_req_batch():
+    if not request.content_type or "multipart/form-data" not in request.content_type:
+        return build_failed("expect multipart/form-data")
+    try:
+        payload = json.loads(request.form.get("sub_req_meta") or "{}")
+    except Exception as ex:
+        return build_failed(f"bad sub_req_meta json: {ex}")
+    items = payload.get("items")
+    if not isinstance(items, list):
+        return build_failed("sub_req_meta.items required")
+
+    state, err = _register_sub_req(payload)
+    if err:
+        return build_failed(err)
+
+    files = {f.filename: f for f in request.files.getlist("pic_file")}
+    statuses = []
+    stored = 0
+    for meta in items:
+        file_name = meta.get("file_name") if isinstance(meta, dict) else None
+        file_storage = files.get(file_name) if isinstance(file_name, str) else None
+        if file_storage is None:
+            statuses.append({"file_name": file_name, "status": "failed", "error": "missing image part"})
+            continue
+        try:
+            _, item_err = _store_task(meta, file_storage.stream.read())
+        except Exception as ex:
+            item_err = str(ex)
+        finally:
+            file_storage.stream.close()
+        if item_err:
+            statuses.append({"file_name": file_name, "status": "failed", "error": item_err})
+        else:
+            stored += 1
+            statuses.append({"file_name": file_name, "status": "success"})
+
+    # 失败项由 master 作为新的单任务 sub_req 重试，这里只等已落盘的部分
+    sub_req_id = state.get("sub_req_id")
+    with SUB_REQ_QUEUE_LOCK:
+        state["expected"] = stored
+        if stored == 0:
+            # 一项都没落盘：worker 永远等不到它，直接出队，避免卡住同一服务后面的 sub_req
+            queue = SUB_REQ_QUEUE.get(state["service_name"], [])
+            if sub_req_id in queue:
+                queue.remove(sub_req_id)
+    if stored == 0:
+        SUB_REQ_STATE.pop(sub_req_id, None)
+        try:
+            os.rmdir(state["staging_root"])
+        except OSError:
+            pass
+    return build_success({"sub_req_id": payload.get("sub_req_id"), "stored": stored, "items": statuses})
 
 
 if __name__ == "__main__":
@@ -496,5 +575,7 @@ if __name__ == "__main__":
     print("  Storage: use config_files/slave_backend.json services.<ServiceName>.{input_dir,output_dir,result_dir}")
     print(f"  Logs: {LOG_DIR}")
     
+    # master 通过 keep-alive 连接池分发任务；werkzeug 默认 HTTP/1.0 每次响应后断开连接
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
     # Flask 自身也开线程；我们的落盘再用 4 线程池，二者叠加可应对高并发 demo
     app.run(host="0.0.0.0", port=AGENT_PORT, threaded=True)
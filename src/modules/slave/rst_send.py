@@ -50,7 +50,7 @@ LOAD_SIM_STATE_FILE = os.path.join(LOG_DIR, "load_sim_state.json")
 # 默认配置（仅默认值；建议由命令行显式传入）
 DEFAULT_GATEWAY_HOST = "127.0.0.1"
 DEFAULT_GATEWAY_PORT = 6666
-DEFAULT_DEVICE_ID = "unknown"
+DEFAULT_DEVICE_ID = ""  # agent 注入自己的 global_id；为空时 gateway 按来源 IP 识别设备
 DEFAULT_SLAVE_BACKEND_CONFIG = os.path.join(PROJECT_ROOT, "config_files", "slave_backend.json")
 
 os.makedirs(LOG_DIR, exist_ok=True)
@@ -498,19 +498,28 @@ class StrictIPSender:
             except Exception:
                 pass
 
-    def notify_gateway_task_result_ready(self, task_id: str) -> bool:
-        """Notify gateway that the result is ready to send."""
+    def notify_gateway_task_result_ready(self, task_id: str) -> str:
+        """Notify gateway that the result is ready to send.
+
+        Returns the gateway's action: "drop" when another device already delivered this task
+        (speculative copy), "send" otherwise, including when the gateway cannot be reached.
+        """
         try:
             conn = http.client.HTTPConnection(self.gateway_host, self.gateway_port, timeout=5)
-            payload = json.dumps({"task_id": task_id}).encode("utf-8")
+            payload = json.dumps({"task_id": task_id, "device_id": self.device_id}).encode("utf-8")
             headers = {"Content-Type": "application/json", "Content-Length": str(len(payload))}
             conn.request("POST", "/task_result_ready", body=payload, headers=headers)
             resp = conn.getresponse()
-            _ = resp.read()
-            return resp.status == 200
+            body = resp.read()
+            if resp.status != 200:
+                return "send"
+            try:
+                return json.loads(body.decode("utf-8")).get("action", "send")
+            except ValueError:
+                return "send"
         except Exception as e:
             print(f"gateway result-ready notify error: {e}")
-            return False
+            return "send"
         finally:
             try:
                 conn.close()
@@ -645,7 +654,14 @@ class StrictIPSender:
         success_count = 0
         for filename, file_path in files_to_send:
             self._mark_task_done_once(filename)
-            self.notify_gateway_task_result_ready(task_id=filename)
+            if self.notify_gateway_task_result_ready(task_id=filename) == "drop":
+                # the other copy of a speculated task won, its result already went to the client
+                print(f"[rst_send] duplicate result dropped: {filename}")
+                try:
+                    os.remove(file_path)
+                except Exception as e:
+                    print(f"[rst_send] remove failed {filename}: {e}")
+                continue
             if self._send_single_file(file_path, ip, service):
                 notified = self.notify_gateway_task_completed(task_id=filename, client_ip=ip, service=service, status="success")
                 if not notified:
@@ -794,7 +810,8 @@ def parse_args():
     parser.add_argument(
         "--device-id",
         default=DEFAULT_DEVICE_ID,
-        help=f"device id (default: {DEFAULT_DEVICE_ID})",
+        help="agent global_id (uuid) reported to the gateway; the agent passes it as {DEVICE_ID}. "
+        "Empty: the gateway identifies the device by its source ip",
     )
     parser.add_argument(
         "--csv-path",
@@ -0,0 +1,198 @@
+#include "ConnectionPool.h"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace {
+int64_t ElapsedMs(std::chrono::steady_clock::time_point since, std::chrono::steady_clock::time_point now) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now - since).count();
+}
+} // namespace
+
+ConnectionPool::Lease &ConnectionPool::Lease::operator=(Lease &&other) noexcept {
+    if (this != &other) {
+        Release();
+        pool_ = other.pool_;
+        key_ = std::move(other.key_);
+        conn_ = std::move(other.conn_);
+        broken_ = other.broken_;
+        reused_ = other.reused_;
+        other.pool_ = nullptr;
+    }
+    return *this;
+}
+
+ConnectionPool::Lease::~Lease() {
+    Release();
+}
+
+void ConnectionPool::Lease::Release() {
+    if (pool_ != nullptr && conn_) {
+        pool_->Return(key_, std::move(conn_), broken_);
+    }
+    pool_ = nullptr;
+}
+
+ConnectionPool::ConnectionPool(ConnectionPoolOptions options) : options_(std::move(options)) {
+}
+
+ConnectionPool::~ConnectionPool() {
+    stop_.store(true);
+    stop_cv_.notify_all();
+    if (sweep_thread_.joinable()) {
+        sweep_thread_.join();
+    }
+}
+
+std::string ConnectionPool::Key(const std::string &host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+std::unique_ptr<PooledConnection> ConnectionPool::Open(const std::string &host, int port) {
+    auto conn = std::make_unique<PooledConnection>();
+    conn->id = next_id_.fetch_add(1);
+    conn->client = std::make_unique<httplib::Client>(host, port);
+    conn->client->set_keep_alive(true);
+    conn->client->set_tcp_nodelay(true);
+    conn->client->set_connection_timeout(options_.connect_timeout_ms / 1000, (options_.connect_timeout_ms % 1000) * 1000);
+    conn->client->set_read_timeout(options_.read_timeout_ms / 1000, (options_.read_timeout_ms % 1000) * 1000);
+    conn->client->set_write_timeout(options_.write_timeout_ms / 1000, (options_.write_timeout_ms % 1000) * 1000);
+    conn->created = std::chrono::steady_clock::now();
+    conn->last_used = conn->created;
+    return conn;
+}
+
+bool ConnectionPool::HealthCheck(PooledConnection &conn) {
+    // nothing to verify on a closed socket, the next request simply reconnects
+    if (!conn.client->is_socket_open()) {
+        return true;
+    }
+    auto res = conn.client->Get(options_.health_check_path);
+    return res && res->status == 200;
+}
+
+ConnectionPool::Lease ConnectionPool::Acquire(const std::string &host, int port) {
+    StartSweep();
+    const std::string key = Key(host, port);
+    std::unique_ptr<PooledConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HostPool &hp = hosts_[key];
+        if (!hp.idle.empty()) {
+            // LIFO: the most recently used socket is the least likely to have been closed by the peer
+            conn = std::move(hp.idle.back());
+            hp.idle.pop_back();
+        }
+        hp.leased++;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (conn && ElapsedMs(conn->last_used, now) > options_.health_check_after_ms && !HealthCheck(*conn)) {
+        spdlog::warn("ConnectionPool: health check failed on {} (conn {}), reconnecting", key, conn->id);
+        conn.reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        hosts_[key].health_check_failed++;
+    }
+    const bool opened = !conn;
+    if (opened) {
+        conn = Open(host, port);
+    }
+
+    const bool reused = conn->client->is_socket_open();
+    conn->requests++;
+    if (reused) {
+        conn->reuses++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HostPool &hp = hosts_[key];
+        if (opened) {
+            hp.opened++;
+        }
+        hp.requests++;
+        if (reused) {
+            hp.reuses++;
+        }
+    }
+
+    Lease lease(this, key, std::move(conn));
+    lease.reused_ = reused;
+    return lease;
+}
+
+void ConnectionPool::Return(const std::string &key, std::unique_ptr<PooledConnection> conn, bool broken) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    HostPool &hp = hosts_[key];
+    hp.leased--;
+    if (broken || hp.idle.size() >= options_.max_idle_per_host) {
+        hp.evicted++;
+        return;
+    }
+    conn->last_used = std::chrono::steady_clock::now();
+    hp.idle.push_back(std::move(conn));
+}
+
+void ConnectionPool::EvictIdle() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &pair : hosts_) {
+        HostPool &hp = pair.second;
+        auto keep_end = std::remove_if(hp.idle.begin(), hp.idle.end(), [&](const std::unique_ptr<PooledConnection> &conn) {
+            return ElapsedMs(conn->last_used, now) > options_.idle_timeout_ms || !conn->client->is_socket_open();
+        });
+        hp.evicted += static_cast<uint64_t>(std::distance(keep_end, hp.idle.end()));
+        hp.idle.erase(keep_end, hp.idle.end());
+    }
+}
+
+nlohmann::json ConnectionPool::Stats(const std::string &host, int port) {
+    const auto now = std::chrono::steady_clock::now();
+    nlohmann::json out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = hosts_.find(Key(host, port));
+    if (it == hosts_.end()) {
+        out["opened"] = 0;
+        out["requests"] = 0;
+        out["reuses"] = 0;
+        out["connections"] = nlohmann::json::array();
+        return out;
+    }
+    const HostPool &hp = it->second;
+    out["opened"] = hp.opened;
+    out["evicted"] = hp.evicted;
+    out["health_check_failed"] = hp.health_check_failed;
+    out["requests"] = hp.requests;
+    out["reuses"] = hp.reuses; // each reuse is one TCP handshake (1 RTT) saved
+    out["leased"] = hp.leased;
+    nlohmann::json conns = nlohmann::json::array();
+    for (const auto &conn : hp.idle) {
+        nlohmann::json c;
+        c["id"] = conn->id;
+        c["requests"] = conn->requests;
+        c["reuses"] = conn->reuses;
+        c["idle_ms"] = ElapsedMs(conn->last_used, now);
+        c["age_ms"] = ElapsedMs(conn->created, now);
+        conns.push_back(c);
+    }
+    out["connections"] = conns;
+    return out;
+}
+
+void ConnectionPool::StartSweep() {
+    std::call_once(sweep_once_, [this]() {
+        sweep_thread_ = std::thread(&ConnectionPool::SweepLoop, this);
+    });
+}
+
+void ConnectionPool::SweepLoop() {
+    while (!stop_.load()) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_cv_.wait_for(lock, std::chrono::milliseconds(options_.sweep_interval_ms),
+                              [this]() { return stop_.load(); });
+        }
+        if (stop_.load()) {
+            break;
+        }
+        EvictIdle();
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef DOCKER_SCHEDULER_CONNECTION_POOL_H
+#define DOCKER_SCHEDULER_CONNECTION_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+// 一个复用的 keep-alive 连接；首个请求建连，之后的请求都省掉一次 TCP 握手
+struct PooledConnection {
+    uint64_t id{0};
+    std::unique_ptr<httplib::Client> client;
+    uint64_t requests{0}; // leases handed out on this connection
+    uint64_t reuses{0};   // leases that found the socket already open (saved handshakes)
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point last_used;
+};
+
+struct ConnectionPoolOptions {
+    size_t max_idle_per_host = 4;       // idle connections kept per host:port
+    int idle_timeout_ms = 30000;        // idle connections older than this are evicted
+    int health_check_after_ms = 5000;   // idle longer than this -> probe before reuse
+    int sweep_interval_ms = 5000;       // background eviction interval
+    int connect_timeout_ms = 3000;
+    int read_timeout_ms = 30000;
+    int write_timeout_ms = 30000;
+    std::string health_check_path = "/healthz";
+};
+
+/// @brief per host:port pool of persistent httplib clients shared by the dispatch workers
+class ConnectionPool {
+public:
+    /// @brief RAII handle, the connection goes back to the idle list when the lease dies
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(ConnectionPool *pool, std::string key, std::unique_ptr<PooledConnection> conn)
+            : pool_(pool), key_(std::move(key)), conn_(std::move(conn)) {}
+        Lease(Lease &&other) noexcept = default;
+        Lease &operator=(Lease &&other) noexcept;
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease();
+
+        httplib::Client *operator->() const { return conn_->client.get(); }
+        httplib::Client &client() const { return *conn_->client; }
+        uint64_t id() const { return conn_->id; }
+        bool reused() const { return reused_; }
+        /// @brief the request failed on the transport level, drop the socket instead of pooling it
+        void MarkBroken() { broken_ = true; }
+
+    private:
+        friend class ConnectionPool;
+        void Release();
+
+        ConnectionPool *pool_{nullptr};
+        std::string key_;
+        std::unique_ptr<PooledConnection> conn_;
+        bool broken_{false};
+        bool reused_{false};
+    };
+
+    explicit ConnectionPool(ConnectionPoolOptions options = {});
+    ~ConnectionPool();
+
+    Lease Acquire(const std::string &host, int port);
+    /// @brief drop idle connections past idle_timeout_ms or closed by the peer
+    void EvictIdle();
+    /// @brief counters of one host:port, exposed on /nodes
+    nlohmann::json Stats(const std::string &host, int port);
+
+private:
+    struct HostPool {
+        std::vector<std::unique_ptr<PooledConnection>> idle;
+        uint64_t opened{0};
+        uint64_t evicted{0};
+        uint64_t health_check_failed{0};
+        uint64_t requests{0};
+        uint64_t reuses{0};
+        int leased{0};
+    };
+
+    static std::string Key(const std::string &host, int port);
+    std::unique_ptr<PooledConnection> Open(const std::string &host, int port);
+    bool HealthCheck(PooledConnection &conn);
+    void Return(const std::string &key, std::unique_ptr<PooledConnection> conn, bool broken);
+    void StartSweep();
+    void SweepLoop();
+
+    ConnectionPoolOptions options_;
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    std::once_flag sweep_once_;
+    std::unordered_map<std::string, HostPool> hosts_;
+    std::atomic<uint64_t> next_id_{1};
+    std::atomic<bool> stop_{false};
+    std::thread sweep_thread_;
+};
+
+#endif // DOCKER_SCHEDULER_CONNECTION_POOL_H
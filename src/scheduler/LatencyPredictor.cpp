@@ -0,0 +1,105 @@
+#include "LatencyPredictor.h"
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+const std::array<const char *, LatencyPredictor::kFeatures> LatencyPredictor::kFeatureNames = {
+        "cpu_used", "xpu_used", "cpu_square", "xpu_square", "cpu_xpu", "platform", "tasktype"};
+
+namespace {
+bool ParseCoefficients(const nlohmann::json &j, const char *key, LatencyPredictor::Coefficients &out) {
+    if (!j.contains(key) || !j[key].is_object()) {
+        spdlog::error("latency model: missing \"{}\"", key);
+        return false;
+    }
+    const auto &node = j[key];
+    const auto &weights = node.value("weights", nlohmann::json::array());
+    if (!weights.is_array() || weights.size() != LatencyPredictor::kFeatures) {
+        spdlog::error("latency model: \"{}\".weights needs {} values", key, LatencyPredictor::kFeatures);
+        return false;
+    }
+    out.intercept = node.value("intercept", 0.0);
+    for (size_t i = 0; i < LatencyPredictor::kFeatures; ++i) {
+        out.weights[i] = weights[i].get<double>();
+    }
+    return true;
+}
+} // namespace
+
+void LatencyPredictor::Batch::Clear() {
+    cpu.clear();
+    xpu.clear();
+    platform.clear();
+}
+
+void LatencyPredictor::Batch::Add(double cpu_used, double xpu_used, int platform_code) {
+    cpu.push_back(cpu_used);
+    xpu.push_back(xpu_used);
+    platform.push_back(static_cast<double>(platform_code));
+}
+
+bool LatencyPredictor::Load(const std::string &path) {
+    std::ifstream infile(path);
+    if (!infile.is_open()) {
+        spdlog::error("Failed to open latency model: {}", path);
+        return false;
+    }
+    try {
+        nlohmann::json j;
+        infile >> j;
+        // 特征顺序写在文件里，和训练脚本对不上时拒绝加载，而不是悄悄算错
+        if (j.contains("features")) {
+            const auto &names = j["features"];
+            bool same = names.is_array() && names.size() == kFeatures;
+            for (size_t i = 0; same && i < kFeatures; ++i) {
+                same = names[i].get<std::string>() == kFeatureNames[i];
+            }
+            if (!same) {
+                spdlog::error("latency model {}: feature order does not match the scheduler", path);
+                return false;
+            }
+        }
+        Coefficients ete;
+        Coefficients exec;
+        if (!ParseCoefficients(j, "ete_time", ete) || !ParseCoefficients(j, "exec_time", exec)) {
+            return false;
+        }
+        ete_ = ete;
+        exec_ = exec;
+        placeholder_ = j.value("placeholder", false);
+    } catch (const std::exception &e) {
+        spdlog::error("latency model {}: {}", path, e.what());
+        return false;
+    }
+    if (placeholder_) {
+        spdlog::warn("Latency model loaded from {} has placeholder coefficients, not fitted on measurements", path);
+    } else {
+        spdlog::info("Latency model loaded from {}", path);
+    }
+    return true;
+}
+
+void LatencyPredictor::Score(const Coefficients &c, const Batch &batch, double tasktype, std::vector<double> &out) {
+    const size_t n = batch.size();
+    out.resize(n);
+    // tasktype is the same for the whole batch, fold it into the intercept
+    const double bias = c.intercept + c.weights[6] * tasktype;
+    const double w_cpu = c.weights[0], w_xpu = c.weights[1], w_cpu2 = c.weights[2];
+    const double w_xpu2 = c.weights[3], w_cross = c.weights[4], w_platform = c.weights[5];
+    const double *cpu = batch.cpu.data();
+    const double *xpu = batch.xpu.data();
+    const double *platform = batch.platform.data();
+    double *dst = out.data();
+    // straight-line loop over contiguous arrays, the compiler vectorizes it
+    for (size_t i = 0; i < n; ++i) {
+        const double x0 = cpu[i];
+        const double x1 = xpu[i];
+        dst[i] = bias + x0 * (w_cpu + w_cpu2 * x0 + w_cross * x1) + x1 * (w_xpu + w_xpu2 * x1) + w_platform * platform[i];
+    }
+}
+
+void LatencyPredictor::PredictBatch(Batch &batch, int tasktype_code) const {
+    const double tasktype = static_cast<double>(tasktype_code);
+    Score(ete_, batch, tasktype, batch.ete_ms);
+    Score(exec_, batch, tasktype, batch.exec_ms);
+}
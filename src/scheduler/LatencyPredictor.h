@@ -0,0 +1,56 @@
+#ifndef DOCKER_SCHEDULER_LATENCY_PREDICTOR_H
+#define DOCKER_SCHEDULER_LATENCY_PREDICTOR_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// 端到端时间 / 执行时间的线性回归预测器，替代原来的 onnxruntime 模型。
+// 特征与原模型一致：cpu, xpu, cpu^2, xpu^2, cpu*xpu, platform, tasktype（platform/tasktype 用 encodePlatform/encodeTaskType 的编码）。
+// 系数从 config_files/latency_model.json 读取，单位 ms。仓库里这份文件是占位系数（"placeholder": true），
+// 不是用实测数据拟合的，只用来打通 ?stargety=predict 的流程；platform/tasktype 沿用原模型的标签编码，按数值参与回归。
+class LatencyPredictor {
+public:
+    static constexpr size_t kFeatures = 7;
+    static const std::array<const char *, kFeatures> kFeatureNames;
+
+    /// @brief per-output coefficients: intercept + one weight per feature
+    struct Coefficients {
+        double intercept{0.0};
+        std::array<double, kFeatures> weights{};
+    };
+
+    /// @brief candidate devices as parallel arrays; callers Add() the inputs, PredictBatch fills ete_ms/exec_ms
+    struct Batch {
+        std::vector<double> cpu;
+        std::vector<double> xpu;
+        std::vector<double> platform;
+        std::vector<double> ete_ms;
+        std::vector<double> exec_ms;
+
+        void Clear();
+        void Add(double cpu_used, double xpu_used, int platform_code);
+        size_t size() const { return cpu.size(); }
+    };
+
+    /// @brief read coefficients from a JSON file; false (and the predictor unchanged) on any error
+    bool Load(const std::string &path);
+
+    /// @brief score every device of the batch for one task type in a single pass over contiguous arrays
+    void PredictBatch(Batch &batch, int tasktype_code) const;
+
+    const Coefficients &ete() const { return ete_; }
+    const Coefficients &exec() const { return exec_; }
+    /// @brief the file says its coefficients were not fitted on measurements
+    bool placeholder() const { return placeholder_; }
+
+private:
+    static void Score(const Coefficients &c, const Batch &batch, double tasktype, std::vector<double> &out);
+
+    Coefficients ete_;
+    Coefficients exec_;
+    bool placeholder_{false};
+};
+
+#endif // DOCKER_SCHEDULER_LATENCY_PREDICTOR_H
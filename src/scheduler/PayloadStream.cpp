@@ -0,0 +1,146 @@
+#include "PayloadStream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <spdlog/spdlog.h>
+
+MappedFile::~MappedFile() {
+    if (mapped_ && addr_ != nullptr) {
+        munmap(addr_, size_);
+    }
+}
+
+bool MappedFile::Open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        addr_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr_ != MAP_FAILED) {
+            mapped_ = true;
+            // the whole file is written out once, front to back. The advice values are not flags and
+            // cannot be OR-ed, each needs its own call; failing advice only costs read-ahead
+            if (madvise(addr_, size_, MADV_SEQUENTIAL) != 0) {
+                spdlog::debug("madvise(MADV_SEQUENTIAL) failed for {}: {}", path, std::strerror(errno));
+            }
+            if (madvise(addr_, size_, MADV_WILLNEED) != 0) {
+                spdlog::debug("madvise(MADV_WILLNEED) failed for {}: {}", path, std::strerror(errno));
+            }
+        } else {
+            addr_ = nullptr;
+        }
+    }
+    ::close(fd);
+    if (mapped_ || size_ == 0) {
+        return true;
+    }
+
+    // mmap unavailable (e.g. special filesystems): read the file once into memory
+    spdlog::warn("mmap failed for {}, falling back to buffered read", path);
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        return false;
+    }
+    fallback_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    size_ = fallback_.size();
+    return true;
+}
+
+MultipartStream::MultipartStream() {
+    static const char kChars[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<size_t> dist(0, sizeof(kChars) - 2);
+    boundary_ = "--lite-edge-multipart-";
+    for (int i = 0; i < 16; ++i) {
+        boundary_ += kChars[dist(rng)];
+    }
+    closing_ = "--" + boundary_ + "--\r\n";
+}
+
+std::string MultipartStream::PartHeader(const std::string &name, const std::string &filename,
+                                        const std::string &content_type) const {
+    std::string header = "--" + boundary_ + "\r\n";
+    header += "Content-Disposition: form-data; name=\"" + name + "\"";
+    if (!filename.empty()) {
+        header += "; filename=\"" + filename + "\"";
+    }
+    header += "\r\n";
+    if (!content_type.empty()) {
+        header += "Content-Type: " + content_type + "\r\n";
+    }
+    header += "\r\n";
+    return header;
+}
+
+void MultipartStream::Append(std::string text) {
+    Segment seg;
+    seg.text = std::move(text);
+    seg.start = parts_size_;
+    parts_size_ += seg.size();
+    segments_.push_back(std::move(seg));
+}
+
+void MultipartStream::AppendFile(std::shared_ptr<MappedFile> file) {
+    Segment seg;
+    seg.file = std::move(file);
+    seg.start = parts_size_;
+    parts_size_ += seg.size();
+    segments_.push_back(std::move(seg));
+}
+
+void MultipartStream::AddText(const std::string &name, const std::string &value, const std::string &content_type) {
+    Append(PartHeader(name, "", content_type) + value + "\r\n");
+}
+
+void MultipartStream::AddFile(const std::string &name, const std::string &filename, std::shared_ptr<MappedFile> file,
+                              const std::string &content_type) {
+    Append(PartHeader(name, filename, content_type));
+    AppendFile(std::move(file));
+    Append("\r\n");
+}
+
+size_t MultipartStream::size() const {
+    return parts_size_ + closing_.size();
+}
+
+httplib::ContentProvider MultipartStream::Provider() const {
+    return [this](size_t offset, size_t length, httplib::DataSink &sink) {
+        const size_t end = offset + length;
+        // first segment that ends after offset; segments are few, a linear scan is enough
+        size_t idx = 0;
+        while (idx < segments_.size() && segments_[idx].start + segments_[idx].size() <= offset) {
+            ++idx;
+        }
+        for (; idx < segments_.size() && offset < end; ++idx) {
+            const Segment &seg = segments_[idx];
+            const size_t skip = offset - seg.start;
+            const size_t n = std::min(seg.size() - skip, end - offset);
+            if (n > 0 && !sink.write(seg.data() + skip, n)) {
+                return false;
+            }
+            offset += n;
+        }
+        if (offset < end && offset >= parts_size_) {
+            const size_t skip = offset - parts_size_;
+            const size_t n = std::min(closing_.size() - skip, end - offset);
+            if (!sink.write(closing_.data() + skip, n)) {
+                return false;
+            }
+        }
+        return true;
+    };
+}
@@ -0,0 +1,66 @@
+#ifndef DOCKER_SCHEDULER_PAYLOAD_STREAM_H
+#define DOCKER_SCHEDULER_PAYLOAD_STREAM_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <httplib.h>
+
+// 只读映射一个任务文件，上传时直接从 page cache 写入 socket；映射失败时退化为读入内存
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(const std::string &path);
+    const char *data() const { return mapped_ ? static_cast<const char *>(addr_) : fallback_.data(); }
+    size_t size() const { return size_; }
+    bool mapped() const { return mapped_; }
+    /// @brief bytes copied into user space to produce data(), 0 on the mmap path
+    size_t bytes_copied() const { return mapped_ ? 0 : fallback_.size(); }
+
+private:
+    void *addr_{nullptr};
+    size_t size_{0};
+    bool mapped_{false};
+    std::string fallback_;
+};
+
+/// @brief multipart/form-data body made of inline text parts and mapped files,
+/// streamed through a sized ContentProvider so file bytes are never copied into a request buffer
+class MultipartStream {
+public:
+    MultipartStream();
+
+    void AddText(const std::string &name, const std::string &value, const std::string &content_type);
+    void AddFile(const std::string &name, const std::string &filename, std::shared_ptr<MappedFile> file,
+                 const std::string &content_type);
+
+    std::string content_type() const { return "multipart/form-data; boundary=" + boundary_; }
+    size_t size() const;
+    /// @brief provider for Client::Post(path, size(), Provider(), content_type()); the stream must outlive the call
+    httplib::ContentProvider Provider() const;
+
+private:
+    struct Segment {
+        std::string text;                  // boundary/headers/inline value
+        std::shared_ptr<MappedFile> file;  // set for file bodies
+        size_t start{0};                   // offset of this segment in the body
+        const char *data() const { return file ? file->data() : text.data(); }
+        size_t size() const { return file ? file->size() : text.size(); }
+    };
+
+    void Append(std::string text);
+    void AppendFile(std::shared_ptr<MappedFile> file);
+    std::string PartHeader(const std::string &name, const std::string &filename, const std::string &content_type) const;
+
+    std::string boundary_;
+    std::string closing_;  // "--boundary--\r\n", always the last bytes of the body
+    std::vector<Segment> segments_;
+    size_t parts_size_{0};
+};
+
+#endif // DOCKER_SCHEDULER_PAYLOAD_STREAM_H
@@ -0,0 +1,325 @@
+#include "SchedulePolicy.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <spdlog/spdlog.h>
+
+std::atomic<size_t> RoundRobinPolicy::cursor_{0};
+
+namespace {
+// power-of-d-choices: d distinct random positions out of n (d < n), in a per-thread buffer
+const std::vector<size_t> &SamplePositions(size_t n, size_t d) {
+    thread_local std::mt19937 rng(std::random_device{}());
+    thread_local std::vector<size_t> picks;
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    picks.clear();
+    while (picks.size() < d) {
+        const size_t pos = dist(rng);
+        if (std::find(picks.begin(), picks.end(), pos) == picks.end()) {
+            picks.push_back(pos);
+        }
+    }
+    return picks;
+}
+
+// in-flight counts of every share, taken under a single queue lock
+void SharesInflight(const std::vector<DeviceShare> &shares, std::vector<DeviceInflight> &out) {
+    thread_local std::vector<DeviceID> ids;
+    ids.clear();
+    for (const auto &share : shares) {
+        ids.push_back(share.id);
+    }
+    Docker_scheduler::GetTaskQueueManager().GetDevicesInflight(ids, out);
+}
+
+// ORIN 不在模型的训练数据里，encodePlatform 没有它的编码
+int PlatformCode(DeviceType dtype) {
+    return dtype == DeviceType::ORIN ? -1 : Docker_scheduler::encodePlatform(dtype);
+}
+} // namespace
+
+Device LoadPolicy::Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype) {
+    if (candidates.empty()) {
+        throw std::runtime_error("No candidate devices available for scheduling.");
+    }
+
+    // power-of-d-choices: on a large cluster score d random candidates instead of all of them
+    const size_t choices = static_cast<size_t>(Docker_scheduler::SampleChoices());
+    const bool sampled = choices > 0 && candidates.size() > choices;
+    const std::vector<size_t> *picks = sampled ? &SamplePositions(candidates.size(), choices) : nullptr;
+    const size_t scored = sampled ? choices : candidates.size();
+    // per-device detail costs a formatted string per candidate, only build it when it is logged
+    const bool log_details = spdlog::should_log(spdlog::level::debug);
+    thread_local std::vector<DeviceID> scored_ids;
+    thread_local std::vector<DeviceInflight> inflight;
+    scored_ids.clear();
+    for (size_t k = 0; k < scored; ++k) {
+        scored_ids.push_back(candidates[sampled ? (*picks)[k] : k]);
+    }
+    Docker_scheduler::GetTaskQueueManager().GetDevicesInflight(scored_ids, inflight);
+
+    const Device *best = nullptr;
+    double min_load = std::numeric_limits<double>::max();
+    std::string device_logs; // stays empty, and unallocated, unless debug logging is on
+
+    for (size_t k = 0; k < scored; ++k) {
+        const DeviceID &device_id = scored_ids[k];
+        auto it = state.status.find(device_id);
+        auto dev_it = state.devices.find(device_id);
+        if (it == state.status.end() || dev_it == state.devices.end()) {
+            continue;
+        }
+        const auto &status = it->second;
+        const size_t unsampled = inflight[k].unsampled();
+        const double load = Docker_scheduler::ProjectedLoad(dev_it->second, status, ttype, unsampled);
+
+        if (log_details) {
+            fmt::format_to(std::back_inserter(device_logs),
+                           "{}device {}: cpu_used={}, mem_used={}, xpu_used={}, bandwidth={}, latency={}, unsampled={}, weighted_score={}",
+                           device_logs.empty() ? "" : " | ", dev_it->second.ip_address, status.cpu_used, status.mem_used,
+                           status.xpu_used, status.net_bandwidth, status.net_latency, unsampled, load);
+        }
+
+        if (load < min_load) {
+            min_load = load;
+            best = &dev_it->second;
+        }
+    }
+
+    if (best == nullptr) {
+        throw std::runtime_error("No device statuses available for scheduling.");
+    }
+    if (log_details) {
+        spdlog::debug("Schedule metrics summary (v{}): [{}]", state.version, device_logs);
+    }
+    spdlog::debug("Selected device: {} with weighted_score={} ({}/{} candidates scored, v{})",
+                 best->ip_address, min_load, scored, candidates.size(), state.version);
+    return *best;
+}
+
+void LoadPolicy::Split(const ClusterState &, TaskType ttype, int total, std::vector<DeviceShare> &shares) {
+    std::vector<DeviceInflight> inflight;
+    SharesInflight(shares, inflight);
+    std::vector<double> weights(shares.size());
+    std::vector<double> fractional(shares.size());
+    const double min_load = 1e-6;
+    double weight_sum = 0.0;
+    for (size_t i = 0; i < shares.size(); ++i) {
+        const double load = Docker_scheduler::ProjectedLoad(*shares[i].device, *shares[i].status, ttype, inflight[i].unsampled());
+        weights[i] = 1.0 / std::max(load, min_load);
+        weight_sum += weights[i];
+    }
+    int assigned = 0;
+    for (size_t i = 0; i < shares.size(); ++i) {
+        const double exact = (weights[i] / weight_sum) * total;
+        shares[i].count = static_cast<int>(std::floor(exact));
+        fractional[i] = exact - shares[i].count;
+        assigned += shares[i].count;
+    }
+    // largest fractional parts take the remainder
+    std::vector<size_t> order(shares.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&fractional](size_t a, size_t b) { return fractional[a] > fractional[b]; });
+    const int remainder = total - assigned;
+    for (int i = 0; i < remainder; ++i) {
+        shares[order[i % order.size()]].count += 1;
+    }
+}
+
+Device RoundRobinPolicy::Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (candidates.empty()) {
+        throw std::runtime_error("No available devices for scheduling.");
+    }
+
+    //  取当前索引对应的设备，同时推进索引准备下次轮询
+    const DeviceID &selected_id = candidates[cursor_.fetch_add(1) % candidates.size()];
+    const Device &selected = state.devices.at(selected_id);
+
+    spdlog::info("RoundRobin selected device: {}", selected.ip_address);
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    spdlog::info("[RoundRobin] Execution time: {} ms", duration_ms);
+    return selected;
+}
+
+void RoundRobinPolicy::Split(const ClusterState &, TaskType, int total, std::vector<DeviceShare> &shares) {
+    const int n = static_cast<int>(shares.size());
+    const int base = total / n;
+    const int remainder = total % n;
+    for (auto &share : shares) {
+        share.count = base;
+    }
+    const size_t rr_base = cursor_.fetch_add(static_cast<size_t>(remainder));
+    for (int i = 0; i < remainder; ++i) {
+        shares[(rr_base + i) % shares.size()].count += 1;
+    }
+}
+
+Device CompletionTimePolicy::Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype) {
+    if (candidates.empty()) {
+        throw std::runtime_error("No available devices for scheduling.");
+    }
+    thread_local std::vector<DeviceInflight> inflight;
+    Docker_scheduler::GetTaskQueueManager().GetDevicesInflight(candidates, inflight);
+    const double task_bytes = Docker_scheduler::EstimateTaskBytes();
+    const Device *best = nullptr;
+    double best_finish = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        const DeviceID &device_id = candidates[i];
+        auto status_it = state.status.find(device_id);
+        auto dev_it = state.devices.find(device_id);
+        if (status_it == state.status.end() || dev_it == state.devices.end()) {
+            continue;
+        }
+        const double finish = Docker_scheduler::EstimateFinishMs(dev_it->second, status_it->second, ttype,
+                                                                 inflight[i].outstanding(), 1, task_bytes);
+        if (finish < best_finish) {
+            best_finish = finish;
+            best = &dev_it->second;
+        }
+    }
+    if (best == nullptr) {
+        throw std::runtime_error("No device statuses available for scheduling.");
+    }
+    spdlog::info("CompletionTime selected device: {} (estimated finish {:.1f}ms)", best->ip_address, best_finish);
+    return *best;
+}
+
+void CompletionTimePolicy::Split(const ClusterState &, TaskType ttype, int total, std::vector<DeviceShare> &shares) {
+    // greedy water-filling: every task goes to the device that would finish it earliest,
+    // so the shares end up with roughly equal estimated finish times
+    std::vector<DeviceInflight> inflight;
+    SharesInflight(shares, inflight);
+    const double task_bytes = Docker_scheduler::EstimateTaskBytes();
+    std::vector<size_t> backlogs(shares.size());
+    using Slot = std::pair<double, size_t>; // (finish time with one more task, share index)
+    std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> heap;
+    for (size_t i = 0; i < shares.size(); ++i) {
+        backlogs[i] = inflight[i].outstanding();
+        heap.emplace(Docker_scheduler::EstimateFinishMs(*shares[i].device, *shares[i].status, ttype, backlogs[i], 1, task_bytes), i);
+    }
+    for (int n = 0; n < total; ++n) {
+        const size_t i = heap.top().second;
+        heap.pop();
+        shares[i].count += 1;
+        heap.emplace(Docker_scheduler::EstimateFinishMs(*shares[i].device, *shares[i].status, ttype, backlogs[i],
+                                                        static_cast<size_t>(shares[i].count) + 1, task_bytes), i);
+    }
+}
+
+Device PredictPolicy::Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype) {
+    if (candidates.empty()) {
+        throw std::runtime_error("No available devices for scheduling.");
+    }
+    const auto model = Docker_scheduler::GetLatencyModel();
+    if (!model) {
+        throw std::runtime_error("latency model is not loaded");
+    }
+    const int tasktype_code = Docker_scheduler::encodeTaskType(ttype);
+    thread_local std::vector<DeviceInflight> inflight;
+    Docker_scheduler::GetTaskQueueManager().GetDevicesInflight(candidates, inflight);
+
+    // gather the candidates into contiguous arrays once, then score them all in one pass
+    thread_local LatencyPredictor::Batch batch;
+    thread_local std::vector<const Device *> devices;
+    thread_local std::vector<size_t> unsampled;
+    batch.Clear();
+    devices.clear();
+    unsampled.clear();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        auto status_it = state.status.find(candidates[i]);
+        auto dev_it = state.devices.find(candidates[i]);
+        if (status_it == state.status.end() || dev_it == state.devices.end()) {
+            continue;
+        }
+        const int platform_code = PlatformCode(dev_it->second.type);
+        if (platform_code < 0) {
+            continue;
+        }
+        batch.Add(status_it->second.cpu_used, status_it->second.xpu_used, platform_code);
+        devices.push_back(&dev_it->second);
+        unsampled.push_back(inflight[i].unsampled());
+    }
+    if (devices.empty()) {
+        throw std::runtime_error("No device the latency model can score.");
+    }
+    model->PredictBatch(batch, tasktype_code);
+
+    size_t best = 0;
+    double best_ms = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < devices.size(); ++i) {
+        // tasks dispatched since the sample each hold the device for about one exec time
+        const double ms = batch.ete_ms[i] + static_cast<double>(unsampled[i]) * batch.exec_ms[i];
+        if (ms < best_ms) {
+            best_ms = ms;
+            best = i;
+        }
+    }
+    spdlog::info("Predict selected device: {} (predicted ete {:.1f}ms, exec {:.1f}ms, {} scored, v{})",
+                 devices[best]->ip_address, best_ms, batch.exec_ms[best], devices.size(), state.version);
+    return *devices[best];
+}
+
+void PredictPolicy::Split(const ClusterState &state, TaskType ttype, int total, std::vector<DeviceShare> &shares) {
+    const auto model = Docker_scheduler::GetLatencyModel();
+    int tasktype_code = -1;
+    if (model) {
+        try {
+            tasktype_code = Docker_scheduler::encodeTaskType(ttype);
+        } catch (const std::invalid_argument &) {
+        }
+    }
+    if (tasktype_code < 0) {
+        spdlog::warn("latency model cannot score {}, splitting by completion time", ttype);
+        CompletionTimePolicy::Split(state, ttype, total, shares);
+        return;
+    }
+
+    std::vector<DeviceInflight> inflight;
+    SharesInflight(shares, inflight);
+    LatencyPredictor::Batch batch;
+    std::vector<size_t> scored; // share index of every batch row
+    std::vector<size_t> unsampled;
+    for (size_t i = 0; i < shares.size(); ++i) {
+        const int platform_code = PlatformCode(shares[i].device->type);
+        if (platform_code < 0) {
+            continue;
+        }
+        batch.Add(shares[i].status->cpu_used, shares[i].status->xpu_used, platform_code);
+        scored.push_back(i);
+        unsampled.push_back(inflight[i].unsampled());
+    }
+    if (scored.empty()) {
+        spdlog::warn("latency model cannot score any candidate, splitting by completion time");
+        CompletionTimePolicy::Split(state, ttype, total, shares);
+        return;
+    }
+    model->PredictBatch(batch, tasktype_code);
+
+    // k-th extra task on row r finishes at ete + (unsampled + k - 1) * exec; always fill the earliest slot
+    auto finish = [&](size_t r, size_t k) {
+        return batch.ete_ms[r] + static_cast<double>(unsampled[r] + k - 1) * batch.exec_ms[r];
+    };
+    using Slot = std::pair<double, size_t>; // (finish time of the next task, batch row)
+    std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> heap;
+    for (size_t r = 0; r < scored.size(); ++r) {
+        heap.emplace(finish(r, 1), r);
+    }
+    for (int n = 0; n < total; ++n) {
+        const size_t r = heap.top().second;
+        heap.pop();
+        DeviceShare &share = shares[scored[r]];
+        share.count += 1;
+        heap.emplace(finish(r, static_cast<size_t>(share.count) + 1), r);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef DOCKER_SCHEDULER_SCHEDULE_POLICY_H
+#define DOCKER_SCHEDULER_SCHEDULE_POLICY_H
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+#include "scheduler.h"
+
+// 一个候选设备在批量切分中分到的任务数；指针指向调用方持有的集群快照
+struct DeviceShare {
+    DeviceID id;
+    const Device *device{nullptr};
+    const DeviceStatus *status{nullptr};
+    int count{0};
+};
+
+// 调度策略：Select 为单个任务选一台设备，Split 把 N 个任务切给 shares 中的设备。
+// 策略都是只含静态成员的类型，经 PolicyRegistry 在编译期按 ScheduleStrategy 分派，决策循环里没有虚调用和 std::function。
+// 新策略：加一个 ScheduleStrategy 值，按下面的形状写一个 struct，再加到 SchedulePolicies 里。
+struct LoadPolicy {
+    static constexpr ScheduleStrategy kStrategy = ScheduleStrategy::LOAD_BASED;
+    static constexpr const char *kName = "load";
+    static bool Matches(const std::string &param) { return param == "load" || param == "负载贪心"; }
+    /// @brief lowest projected load; scores d random candidates when --sample-choices is set
+    static Device Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype);
+    /// @brief shares proportional to 1 / projected load
+    static void Split(const ClusterState &state, TaskType ttype, int total, std::vector<DeviceShare> &shares);
+};
+
+struct RoundRobinPolicy {
+    static constexpr ScheduleStrategy kStrategy = ScheduleStrategy::ROUND_ROBIN;
+    static constexpr const char *kName = "roundrobin";
+    static bool Matches(const std::string &param) { return param == "roundrobin" || param == "round_robin"; }
+    static Device Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype);
+    /// @brief equal shares, the remainder rotates over the devices
+    static void Split(const ClusterState &state, TaskType ttype, int total, std::vector<DeviceShare> &shares);
+
+private:
+    static std::atomic<size_t> cursor_; // 轮询用的索引，单任务和批量切分共用
+};
+
+struct CompletionTimePolicy {
+    static constexpr ScheduleStrategy kStrategy = ScheduleStrategy::COMPLETION_TIME;
+    static constexpr const char *kName = "completion";
+    static bool Matches(const std::string &param) { return param == "completion" || param == "ect"; }
+    /// @brief earliest estimated finish time from profiled proc_time, backlog and transfer time
+    static Device Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype);
+    /// @brief water-filling: each task goes to the device that would finish it first
+    static void Split(const ClusterState &state, TaskType ttype, int total, std::vector<DeviceShare> &shares);
+};
+
+struct PredictPolicy {
+    static constexpr ScheduleStrategy kStrategy = ScheduleStrategy::PREDICTED;
+    static constexpr const char *kName = "predict";
+    static bool Matches(const std::string &param) { return param == "predict" || param == "model"; }
+    /// @brief lowest predicted end-to-end time plus predicted exec time of the tasks the last sample has not seen;
+    /// all candidates are scored in one LatencyPredictor::PredictBatch pass
+    static Device Select(const ClusterState &state, const std::vector<DeviceID> &candidates, TaskType ttype);
+    /// @brief water-filling on predicted times; falls back to CompletionTimePolicy when the model cannot score ttype
+    static void Split(const ClusterState &state, TaskType ttype, int total, std::vector<DeviceShare> &shares);
+};
+
+template <typename Policy>
+struct PolicyTag {
+    using type = Policy;
+};
+
+template <typename... Policies>
+struct PolicyRegistry {
+    /// @brief call fn(PolicyTag<P>{}) for the policy P registered for strategy; false if none is
+    template <typename Fn>
+    static bool Visit(ScheduleStrategy strategy, Fn &&fn) {
+        return ((Policies::kStrategy == strategy ? (fn(PolicyTag<Policies>{}), true) : false) || ...);
+    }
+
+    /// @brief strategy for a ?stargety= value, nullopt when no policy accepts it
+    static std::optional<ScheduleStrategy> Parse(const std::string &param) {
+        std::optional<ScheduleStrategy> out;
+        ((Policies::Matches(param) && !out ? (out = Policies::kStrategy, true) : false), ...);
+        return out;
+    }
+
+    static const char *Name(ScheduleStrategy strategy) {
+        const char *name = "unknown";
+        ((Policies::kStrategy == strategy ? (name = Policies::kName, true) : false) || ...);
+        return name;
+    }
+};
+
+using SchedulePolicies = PolicyRegistry<LoadPolicy, RoundRobinPolicy, CompletionTimePolicy, PredictPolicy>;
+
+#endif // DOCKER_SCHEDULER_SCHEDULE_POLICY_H
@@ -0,0 +1,90 @@
+#include "ServiceTimeModel.h"
+#include <algorithm>
+#include <mutex>
+
+namespace {
+double Quantile(std::vector<double> &values, double q) {
+    const size_t k = std::min(values.size() - 1, static_cast<size_t>(q * static_cast<double>(values.size())));
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(k), values.end());
+    return values[k];
+}
+} // namespace
+
+void ServiceTimeModel::Record(TaskType ttype, const DeviceID &device_id, double latency_ms, size_t ahead) {
+    if (latency_ms < 0.0) {
+        return;
+    }
+    const double service_ms = latency_ms / static_cast<double>(ahead + 1);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    Series &series = series_[device_id][ttype];
+    ServiceTimeEstimate &est = series.estimate;
+    if (est.samples == 0) {
+        est.service_ewma_ms = service_ms;
+        est.latency_ewma_ms = latency_ms;
+    } else {
+        est.service_ewma_ms += kAlpha * (service_ms - est.service_ewma_ms);
+        est.latency_ewma_ms += kAlpha * (latency_ms - est.latency_ewma_ms);
+    }
+    est.samples++;
+    if (series.window.size() < kWindow) {
+        series.window.push_back(latency_ms);
+    } else {
+        series.window[series.next] = latency_ms;
+    }
+    series.next = (series.next + 1) % kWindow;
+}
+
+std::optional<double> ServiceTimeModel::ServiceMs(TaskType ttype, const DeviceID &device_id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto dev_it = series_.find(device_id);
+    if (dev_it == series_.end()) {
+        return std::nullopt;
+    }
+    auto it = dev_it->second.find(ttype);
+    if (it == dev_it->second.end() || it->second.estimate.samples < kMinSamples) {
+        return std::nullopt;
+    }
+    return it->second.estimate.service_ewma_ms;
+}
+
+ServiceTimeEstimate ServiceTimeModel::WithQuantiles(const Series &series) {
+    ServiceTimeEstimate est = series.estimate;
+    if (!series.window.empty()) {
+        std::vector<double> values = series.window;
+        est.latency_p50_ms = Quantile(values, 0.50);
+        est.latency_p95_ms = Quantile(values, 0.95);
+    }
+    return est;
+}
+
+std::optional<ServiceTimeEstimate> ServiceTimeModel::Get(TaskType ttype, const DeviceID &device_id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto dev_it = series_.find(device_id);
+    if (dev_it == series_.end()) {
+        return std::nullopt;
+    }
+    auto it = dev_it->second.find(ttype);
+    if (it == dev_it->second.end()) {
+        return std::nullopt;
+    }
+    return WithQuantiles(it->second);
+}
+
+nlohmann::json ServiceTimeModel::Stats(const DeviceID &device_id) const {
+    nlohmann::json out = nlohmann::json::object();
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto dev_it = series_.find(device_id);
+    if (dev_it == series_.end()) {
+        return out;
+    }
+    for (const auto &[ttype, series] : dev_it->second) {
+        const ServiceTimeEstimate est = WithQuantiles(series);
+        out[nlohmann::json(ttype).get<std::string>()] = {
+                {"samples", est.samples},
+                {"service_ewma_ms", est.service_ewma_ms},
+                {"latency_ewma_ms", est.latency_ewma_ms},
+                {"latency_p50_ms", est.latency_p50_ms},
+                {"latency_p95_ms", est.latency_p95_ms}};
+    }
+    return out;
+}
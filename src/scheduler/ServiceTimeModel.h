@@ -0,0 +1,52 @@
+#ifndef DOCKER_SCHEDULER_SERVICE_TIME_MODEL_H
+#define DOCKER_SCHEDULER_SERVICE_TIME_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/uuid/uuid_hash.hpp>
+#include <nlohmann/json.hpp>
+#include "device.h"
+
+// 从 /task_completed 回报在线学习的 (TaskType, 设备) 服务时间：下发到完成的时延，以及按下发时排在前面的任务数折算出的单任务服务时间。
+// 设备降频、模型预热等变化会在几个任务内反映到完成时间策略里，不需要手改 static_info.json。
+struct ServiceTimeEstimate {
+    uint64_t samples{0};
+    double service_ewma_ms{0.0}; // per-task service time: latency / (tasks ahead at dispatch + 1)
+    double latency_ewma_ms{0.0}; // dispatch -> completion
+    double latency_p50_ms{0.0};  // over the last kWindow completions
+    double latency_p95_ms{0.0};
+};
+
+class ServiceTimeModel {
+public:
+    static constexpr double kAlpha = 0.2;        // EWMA weight of the newest sample
+    static constexpr size_t kWindow = 128;       // completions kept per key for the quantiles
+    static constexpr uint64_t kMinSamples = 5;   // below this the profiled proc_time is used instead
+
+    /// @brief one completed task: latency_ms from upload to completion, ahead = tasks already running on the device
+    void Record(TaskType ttype, const DeviceID &device_id, double latency_ms, size_t ahead);
+    /// @brief learned per-task service time, nullopt until kMinSamples completions were seen
+    std::optional<double> ServiceMs(TaskType ttype, const DeviceID &device_id) const;
+    std::optional<ServiceTimeEstimate> Get(TaskType ttype, const DeviceID &device_id) const;
+    /// @brief {task type: estimate} of one device, for /nodes
+    nlohmann::json Stats(const DeviceID &device_id) const;
+
+private:
+    struct Series {
+        ServiceTimeEstimate estimate;
+        std::vector<double> window; // ring buffer of recent latencies
+        size_t next{0};
+    };
+    using DeviceSeries = std::unordered_map<TaskType, Series>;
+
+    static ServiceTimeEstimate WithQuantiles(const Series &series);
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<DeviceID, DeviceSeries> series_;
+};
+
+#endif // DOCKER_SCHEDULER_SERVICE_TIME_MODEL_H
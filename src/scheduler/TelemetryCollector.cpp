@@ -0,0 +1,243 @@
+#include "TelemetryCollector.h"
+#include <algorithm>
+#include <chrono>
+#include <spdlog/spdlog.h>
+
+namespace {
+constexpr const char *kDeviceInfoPath = "/usage/device_info";
+const httplib::Headers kAcceptHeaders = {{"Accept", std::string(kTelemetryBinaryContentType) + ", application/json"}};
+
+int64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+TelemetryCollector::TelemetryCollector(int deadline_ms) : deadline_ms_(std::max(1, deadline_ms)) {
+}
+
+TelemetryCollector::~TelemetryCollector() {
+    std::vector<std::shared_ptr<Poller>> all;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &[_, poller] : pollers_) {
+            poller->stop = true;
+            all.push_back(poller);
+        }
+        for (auto &poller : retired_) {
+            poller->stop = true;
+            all.push_back(poller);
+        }
+        pollers_.clear();
+        retired_.clear();
+    }
+    poll_cv_.notify_all();
+    // a poller stuck in a request returns within its timeouts
+    for (auto &poller : all) {
+        if (poller->thread.joinable()) {
+            poller->thread.join();
+        }
+    }
+}
+
+void TelemetryCollector::SetDeadlineMs(int deadline_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deadline_ms_ = std::max(1, deadline_ms);
+    // existing connections keep their timeouts until the device's poller is replaced
+}
+
+std::optional<TelemetrySample> TelemetryCollector::ParseDeviceInfo(const std::string &body) {
+    nlohmann::json j = nlohmann::json::parse(body);
+    if (j.value("status", "") != "success" || !j.contains("result") || !j["result"].is_object()) {
+        return std::nullopt;
+    }
+    TelemetrySample sample;
+    sample.status.from_json(j["result"]);
+    // agent 可选上报当前已启动的服务列表（用于 scheduler 优先选择已启动服务的节点）
+    const auto &result = j["result"];
+    if (result.contains("services") && result["services"].is_array()) {
+        std::vector<TaskType> running;
+        for (const auto &sv : result["services"]) {
+            if (!sv.is_string()) continue;
+            TaskType tt = StrToTaskType(sv.get<std::string>());
+            if (tt != TaskType::Unknown) {
+                running.push_back(tt);
+            }
+        }
+        sample.services = std::move(running);
+    }
+    return sample;
+}
+
+TelemetrySample TelemetryCollector::FromDatagram(TelemetryDatagram &&dgram) {
+    TelemetrySample sample;
+    sample.status = dgram.status;
+    std::vector<TaskType> running;
+    running.reserve(dgram.services.size());
+    for (const auto &name : dgram.services) {
+        TaskType tt = StrToTaskType(name);
+        if (tt != TaskType::Unknown) {
+            running.push_back(tt);
+        }
+    }
+    sample.services = std::move(running);
+    return sample;
+}
+
+std::shared_ptr<TelemetryCollector::Poller> TelemetryCollector::StartPoller(const Device &device) {
+    auto poller = std::make_shared<Poller>();
+    poller->host = device.ip_address;
+    poller->port = device.agent_port;
+    poller->client = std::make_unique<httplib::Client>(device.ip_address, device.agent_port);
+    // connect + read both bounded by the round deadline; the socket stays open between rounds
+    poller->client->set_keep_alive(true);
+    poller->client->set_connection_timeout(deadline_ms_ / 1000, (deadline_ms_ % 1000) * 1000);
+    poller->client->set_read_timeout(deadline_ms_ / 1000, (deadline_ms_ % 1000) * 1000);
+    poller->client->set_write_timeout(deadline_ms_ / 1000, (deadline_ms_ % 1000) * 1000);
+    poller->thread = std::thread(&TelemetryCollector::PollLoop, this, poller);
+    return poller;
+}
+
+void TelemetryCollector::Retire(std::shared_ptr<Poller> poller) {
+    poller->stop = true;
+    retired_.push_back(std::move(poller));
+    poll_cv_.notify_all();
+}
+
+void TelemetryCollector::PollLoop(std::shared_ptr<Poller> poller) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        poll_cv_.wait(lock, [&poller]() { return poller->stop || poller->requested > poller->served; });
+        if (poller->stop) {
+            break;
+        }
+        const uint64_t round = poller->requested;
+        poller->busy = true;
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        std::optional<TelemetrySample> sample;
+        bool binary = false;
+        try {
+            auto res = poller->client->Get(kDeviceInfoPath, kAcceptHeaders);
+            if (res && res->status == 200) {
+                if (res->get_header_value("Content-Type").rfind(kTelemetryBinaryContentType, 0) == 0) {
+                    std::optional<TelemetryDatagram> dgram = TelemetryDatagram::DecodeBinary(res->body.data(), res->body.size());
+                    if (dgram) {
+                        sample = FromDatagram(std::move(*dgram));
+                        binary = true;
+                    }
+                } else {
+                    sample = ParseDeviceInfo(res->body);
+                }
+                if (!sample) {
+                    spdlog::error("Failed to get device info, agent return filed, dev.ip_address:{}, dev.agent_port:{}",
+                                  poller->host, poller->port);
+                }
+            } else {
+                spdlog::error("Failed to get device info, dev.ip_address:{}, dev.agent_port:{}, error:{}",
+                              poller->host, poller->port, res ? std::to_string(res->status) : httplib::to_string(res.error()));
+            }
+        } catch (const std::exception &e) {
+            spdlog::error("collect info error ({}): {}", poller->host, e.what());
+        }
+        const int64_t rtt_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        poller->busy = false;
+        poller->served = round;
+        poller->last_rtt_ms = rtt_ms;
+        if (sample) {
+            sample->rtt_ms = rtt_ms;
+            poller->ok++;
+            poller->binary += binary ? 1 : 0;
+            poller->last_ok_ms = NowMs();
+        } else {
+            poller->failed++;
+        }
+        if (round <= closed_round_) {
+            // the round was already applied without this device
+            poller->late++;
+            poller->result.reset();
+        } else {
+            poller->result = std::move(sample);
+        }
+        done_cv_.notify_all();
+    }
+    poller->exited = true;
+}
+
+std::map<DeviceID, TelemetrySample> TelemetryCollector::PollAll(const std::map<DeviceID, Device> &devices) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // follow the device list: new devices get a poller, moved ones a fresh connection, gone ones stop
+    for (auto it = pollers_.begin(); it != pollers_.end();) {
+        auto dev_it = devices.find(it->first);
+        if (dev_it == devices.end() || dev_it->second.ip_address != it->second->host ||
+            dev_it->second.agent_port != it->second->port) {
+            Retire(it->second);
+            it = pollers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const auto &[id, device] : devices) {
+        if (pollers_.count(id) == 0) {
+            pollers_.emplace(id, StartPoller(device));
+        }
+    }
+    for (auto it = retired_.begin(); it != retired_.end();) {
+        if ((*it)->exited) {
+            (*it)->thread.join();
+            it = retired_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // fan out: every idle poller gets this round, a poller still stuck in an older request sits it out
+    const uint64_t round = ++round_;
+    std::vector<std::pair<DeviceID, std::shared_ptr<Poller>>> asked;
+    asked.reserve(pollers_.size());
+    for (auto &[id, poller] : pollers_) {
+        if (poller->busy) {
+            poller->skipped++;
+            continue;
+        }
+        poller->requested = round;
+        poller->result.reset();
+        asked.emplace_back(id, poller);
+    }
+    poll_cv_.notify_all();
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms_);
+    done_cv_.wait_until(lock, deadline, [&asked, round]() {
+        return std::all_of(asked.begin(), asked.end(), [round](const auto &entry) { return entry.second->served >= round; });
+    });
+    closed_round_ = round;
+
+    std::map<DeviceID, TelemetrySample> out;
+    for (auto &[id, poller] : asked) {
+        if (poller->served == round && poller->result.has_value()) {
+            out.emplace(id, std::move(*poller->result));
+            poller->result.reset();
+        }
+    }
+    return out;
+}
+
+nlohmann::json TelemetryCollector::Stats(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pollers_.find(device_id);
+    if (it == pollers_.end()) {
+        return nlohmann::json::object();
+    }
+    const Poller &poller = *it->second;
+    return {{"ok", poller.ok},
+            {"failed", poller.failed},
+            {"binary", poller.binary},
+            {"late", poller.late},
+            {"skipped", poller.skipped},
+            {"last_rtt_ms", poller.last_rtt_ms},
+            {"last_ok_age_ms", poller.last_ok_ms > 0 ? NowMs() - poller.last_ok_ms : -1}};
+}
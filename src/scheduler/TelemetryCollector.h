@@ -0,0 +1,85 @@
+#ifndef DOCKER_SCHEDULER_TELEMETRY_COLLECTOR_H
+#define DOCKER_SCHEDULER_TELEMETRY_COLLECTOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/uuid/uuid_hash.hpp>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include "device.h"
+#include "telemetry.h"
+
+// 并发采集各 agent 的 /usage/device_info：每台设备一个常驻轮询线程和一条 keep-alive 连接，
+// 一轮采集同时向所有设备发请求，最多等 deadline_ms，整轮耗时约为 max(RTT) 而不是 sum(RTT)。
+// 超过 deadline 的设备本轮没有样本，它的轮询线程卡住期间也不会再被派发新请求。
+// 请求带 Accept: application/x-device-status，支持的 agent 返回二进制编码，旧 agent 仍返回 JSON。
+struct TelemetrySample {
+    DeviceStatus status{};
+    std::optional<std::vector<TaskType>> services; // running services, when the agent reports them
+    int64_t rtt_ms{0};
+};
+
+class TelemetryCollector {
+public:
+    explicit TelemetryCollector(int deadline_ms = 1000);
+    ~TelemetryCollector();
+    TelemetryCollector(const TelemetryCollector &) = delete;
+    TelemetryCollector &operator=(const TelemetryCollector &) = delete;
+
+    void SetDeadlineMs(int deadline_ms);
+    /// @brief one round over devices; samples that arrived within the deadline, pollers of devices not listed stop
+    std::map<DeviceID, TelemetrySample> PollAll(const std::map<DeviceID, Device> &devices);
+    /// @brief per-device counters for /nodes
+    nlohmann::json Stats(const DeviceID &device_id);
+
+    /// @brief agent response body -> sample; nullopt when the agent did not report success
+    static std::optional<TelemetrySample> ParseDeviceInfo(const std::string &body);
+    /// @brief binary response / pushed datagram -> sample; unknown service names are skipped
+    static TelemetrySample FromDatagram(TelemetryDatagram &&dgram);
+
+private:
+    struct Poller {
+        std::thread thread;
+        std::string host;
+        int port{0};
+        std::unique_ptr<httplib::Client> client;
+        uint64_t requested{0};  // round the poller was asked to serve
+        uint64_t served{0};     // last round it finished
+        bool busy{false};
+        bool stop{false};
+        bool exited{false};
+        std::optional<TelemetrySample> result;
+        // counters
+        uint64_t ok{0};
+        uint64_t failed{0};
+        uint64_t binary{0};     // successful polls answered in the binary encoding
+        uint64_t late{0};       // rounds that closed before the poll returned
+        uint64_t skipped{0};    // rounds skipped because the previous poll was still running
+        int64_t last_rtt_ms{0};
+        int64_t last_ok_ms{0};
+    };
+
+    void PollLoop(std::shared_ptr<Poller> poller);
+    std::shared_ptr<Poller> StartPoller(const Device &device);
+    /// @brief ask a poller to exit; it is joined once it did (mutex_ held)
+    void Retire(std::shared_ptr<Poller> poller);
+
+    std::mutex mutex_;
+    std::condition_variable poll_cv_;  // wakes pollers for a new round
+    std::condition_variable done_cv_;  // wakes PollAll when a poller finished
+    int deadline_ms_;
+    uint64_t round_{0};
+    uint64_t closed_round_{0}; // results of this round and older arrive too late
+    std::unordered_map<DeviceID, std::shared_ptr<Poller>> pollers_;
+    std::vector<std::shared_ptr<Poller>> retired_;
+};
+
+#endif // DOCKER_SCHEDULER_TELEMETRY_COLLECTOR_H
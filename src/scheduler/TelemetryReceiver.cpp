@@ -0,0 +1,254 @@
+#include "TelemetryReceiver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/uuid/string_generator.hpp>
+#include <spdlog/spdlog.h>
+
+namespace {
+constexpr size_t kRecvBatch = 64;           // datagrams per recvmmsg call
+constexpr size_t kRecvBufBytes = 2048;      // > kMaxTelemetryDatagram, oversized datagrams come back truncated
+constexpr int kSocketRecvBuffer = 1 << 20;  // absorbs a burst of all agents between two batches
+
+bool SameStatus(const DeviceStatus &a, const DeviceStatus &b) {
+    return a.mem_used == b.mem_used && a.cpu_used == b.cpu_used && a.xpu_used == b.xpu_used &&
+           a.net_latency == b.net_latency && a.net_bandwidth == b.net_bandwidth &&
+           a.disconnectTime == b.disconnectTime && a.reconnectTime == b.reconnectTime && a.timeWindow == b.timeWindow;
+}
+
+int64_t FreshWindowMs(int interval_ms) {
+    return std::max<int64_t>(3 * static_cast<int64_t>(interval_ms), TelemetryReceiver::kMinFreshMs);
+}
+
+int64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+TelemetryReceiver::~TelemetryReceiver() {
+    Stop();
+}
+
+bool TelemetryReceiver::Start(int port, BatchHandler handler) {
+    if (thread_.joinable()) {
+        return false;
+    }
+    sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock_ < 0) {
+        spdlog::error("telemetry receiver: socket failed: {}", std::strerror(errno));
+        return false;
+    }
+    int one = 1;
+    setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(sock_, SOL_SOCKET, SO_RCVBUF, &kSocketRecvBuffer, sizeof(kSocketRecvBuffer));
+    // the receive call returns at least every kFlushMs so pending samples never wait longer than that
+    timeval tv{0, kFlushMs * 1000};
+    setsockopt(sock_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (bind(sock_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        spdlog::error("telemetry receiver: bind udp {} failed: {}", port, std::strerror(errno));
+        close(sock_);
+        sock_ = -1;
+        return false;
+    }
+    handler_ = std::move(handler);
+    stop_ = false;
+    thread_ = std::thread(&TelemetryReceiver::RecvLoop, this);
+    spdlog::info("telemetry receiver listening on udp {}", port);
+    return true;
+}
+
+void TelemetryReceiver::Stop() {
+    stop_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (sock_ >= 0) {
+        close(sock_);
+        sock_ = -1;
+    }
+}
+
+void TelemetryReceiver::RecvLoop() {
+    std::vector<char> bufs(kRecvBatch * kRecvBufBytes);
+    std::vector<iovec> iovs(kRecvBatch);
+    std::vector<mmsghdr> msgs(kRecvBatch);
+    std::vector<sockaddr_in> senders(kRecvBatch);
+    char src_ip[INET_ADDRSTRLEN];
+    for (size_t i = 0; i < kRecvBatch; ++i) {
+        iovs[i].iov_base = bufs.data() + i * kRecvBufBytes;
+        iovs[i].iov_len = kRecvBufBytes;
+    }
+    auto last_flush = std::chrono::steady_clock::now();
+    while (!stop_) {
+        for (size_t i = 0; i < kRecvBatch; ++i) {
+            std::memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &senders[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+        }
+        // MSG_WAITFORONE: block for the first datagram, then take whatever else is already queued
+        const int n = recvmmsg(sock_, msgs.data(), kRecvBatch, MSG_WAITFORONE, nullptr);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            spdlog::error("telemetry receiver: recvmmsg failed: {}", std::strerror(errno));
+            std::this_thread::sleep_for(std::chrono::milliseconds(kFlushMs));
+        }
+        if (n > 0) {
+            const int64_t now_ms = NowMs();
+            for (int i = 0; i < n; ++i) {
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    continue;
+                }
+                if (inet_ntop(AF_INET, &senders[i].sin_addr, src_ip, sizeof(src_ip)) == nullptr) {
+                    continue;
+                }
+                Accept(static_cast<const char *>(iovs[i].iov_base), msgs[i].msg_len, now_ms, src_ip);
+            }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_flush >= std::chrono::milliseconds(kFlushMs)) {
+            Flush();
+            last_flush = now;
+        }
+    }
+}
+
+bool TelemetryReceiver::Accept(const char *data, size_t len, int64_t now_ms, const std::string &src_ip) {
+    std::optional<TelemetryDatagram> dgram = TelemetryDatagram::Decode(data, len);
+    std::optional<DeviceID> id;
+    if (dgram.has_value()) {
+        try {
+            id = boost::uuids::string_generator()(dgram->global_id);
+        } catch (const std::exception &) {
+        }
+    }
+    const bool known = !id.has_value() || !filter_ || filter_(*id, src_ip);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!id.has_value()) {
+        if (malformed_++ % 100 == 0) {
+            spdlog::warn("telemetry receiver: malformed datagram ({} so far)", malformed_);
+        }
+        return false;
+    }
+    if (!known) {
+        // no source for it: any uuid could otherwise grow sources_ without bound, and a forged
+        // global_id from another host would overwrite the device's load
+        if (unknown_++ % 100 == 0) {
+            spdlog::warn("telemetry receiver: push for {} from {} rejected, unregistered device or not its address ({} so far)",
+                         dgram->global_id, src_ip, unknown_);
+        }
+        return false;
+    }
+    Source &src = sources_[*id];
+    src.received++;
+    // a device that went stale may have been polled meanwhile, so its first sample back is always applied
+    const bool was_fresh = src.last_recv_ms > 0 && now_ms - src.last_recv_ms <= FreshWindowMs(src.interval_ms);
+    if (dgram->epoch != src.epoch) {
+        // a newer run always wins; an older epoch only once the current run went quiet, since an agent
+        // restarted before its clock was synced reports a start time earlier than its previous run
+        if (dgram->epoch < src.epoch && was_fresh) {
+            src.stale_dropped++;
+            return false;
+        }
+        if (src.last_recv_ms > 0) {
+            src.restarts++;
+        }
+        src.last_seq = 0;
+    } else if (dgram->seq <= src.last_seq) {
+        src.stale_dropped++;
+        return false;
+    } else if (src.last_seq > 0) {
+        src.lost += dgram->seq - src.last_seq - 1;
+    }
+    src.epoch = dgram->epoch;
+    src.last_seq = dgram->seq;
+    src.last_recv_ms = now_ms;
+    src.interval_ms = dgram->interval_ms;
+    if (was_fresh && src.last_status.has_value() && SameStatus(*src.last_status, dgram->status) &&
+        src.last_services == dgram->services) {
+        src.unchanged++;
+        src.confirmed = true;
+        return true;
+    }
+    if (src.pending.has_value()) {
+        src.coalesced++;
+    }
+    src.last_status = dgram->status;
+    src.last_services = dgram->services;
+    src.pending = TelemetryCollector::FromDatagram(std::move(*dgram));
+    return true;
+}
+
+void TelemetryReceiver::Flush() {
+    Flush(NowMs());
+}
+
+void TelemetryReceiver::Flush(int64_t now_ms) {
+    std::map<DeviceID, TelemetrySample> batch;
+    std::vector<DeviceID> unchanged;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = sources_.begin(); it != sources_.end();) {
+            Source &src = it->second;
+            if (src.pending.has_value()) {
+                batch.emplace(it->first, std::move(*src.pending));
+                src.pending.reset();
+                src.applied++;
+            } else if (src.confirmed) {
+                unchanged.push_back(it->first);
+            } else if (now_ms - src.last_recv_ms > kSourceTtlMs) {
+                // removed or long-silent device; it gets a fresh source if it pushes again
+                it = sources_.erase(it);
+                continue;
+            }
+            src.confirmed = false;
+            ++it;
+        }
+    }
+    if ((!batch.empty() || !unchanged.empty()) && handler_) {
+        handler_(batch, unchanged);
+    }
+}
+
+size_t TelemetryReceiver::source_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sources_.size();
+}
+
+bool TelemetryReceiver::IsFresh(const DeviceID &device_id, int64_t now_ms) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sources_.find(device_id);
+    if (it == sources_.end() || it->second.last_recv_ms == 0) {
+        return false;
+    }
+    return now_ms - it->second.last_recv_ms <= FreshWindowMs(it->second.interval_ms);
+}
+
+nlohmann::json TelemetryReceiver::Stats(const DeviceID &device_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sources_.find(device_id);
+    if (it == sources_.end()) {
+        return nlohmann::json::object();
+    }
+    const Source &src = it->second;
+    return {{"received", src.received},
+            {"applied", src.applied},
+            {"coalesced", src.coalesced},
+            {"unchanged", src.unchanged},
+            {"stale_dropped", src.stale_dropped},
+            {"lost", src.lost},
+            {"restarts", src.restarts},
+            {"last_seq", src.last_seq},
+            {"interval_ms", src.interval_ms},
+            {"last_recv_age_ms", src.last_recv_ms > 0 ? NowMs() - src.last_recv_ms : -1}};
+}
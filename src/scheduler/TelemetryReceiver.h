@@ -0,0 +1,94 @@
+#ifndef DOCKER_SCHEDULER_TELEMETRY_RECEIVER_H
+#define DOCKER_SCHEDULER_TELEMETRY_RECEIVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/uuid/uuid_hash.hpp>
+#include <nlohmann/json.hpp>
+#include "TelemetryCollector.h"
+#include "telemetry.h"
+
+// 接收 agent 主动推送的遥测（UDP，见 telemetry.h）。一个线程用 recvmmsg 批量收包，
+// 按 (epoch, seq) 丢弃乱序/重复样本，每台设备只保留最新一条，每 kFlushMs 把这一批交给 handler，
+// 调度器一次加锁就能写回所有设备，不会每个数据报都发布一次 ClusterState。
+// 推送新鲜的设备不再需要 TelemetryCollector 轮询；推送中断后 IsFresh 变为 false，自动回落到轮询。
+// agent 按变化上报时，心跳原样重复上次的状态：与上次写回的样本相同的心跳只刷新新鲜度，
+// 作为 unchanged 交给 handler，不再写回状态、也不触发发布，空闲设备几乎不占 gateway 的 CPU。
+// epoch 是 agent 启动时的墙钟时间，没有 RTC 的板子在 NTP 同步前重启时可能变小：来源不再新鲜后任何新 epoch 都被接受。
+// 只为 device filter 认可的设备建立来源：global_id 已注册、且数据报的源地址就是该设备登记的 ip，
+// 能访问该 UDP 端口的其他主机无法冒充设备写入负载或让它停止被轮询。长时间没有推送的来源被回收。
+class TelemetryReceiver {
+public:
+    // changed samples, and devices whose heartbeat confirmed their last sample
+    using BatchHandler = std::function<void(std::map<DeviceID, TelemetrySample> &, const std::vector<DeviceID> &)>;
+    // true for the pushes that are accepted: a registered device, sent from its registered address
+    using DeviceFilter = std::function<bool(const DeviceID &, const std::string &src_ip)>;
+
+    TelemetryReceiver() = default;
+    ~TelemetryReceiver();
+    TelemetryReceiver(const TelemetryReceiver &) = delete;
+    TelemetryReceiver &operator=(const TelemetryReceiver &) = delete;
+
+    /// @brief bind udp port and start the receive thread; false when the socket cannot be bound
+    bool Start(int port, BatchHandler handler);
+    void Stop();
+    /// @brief set before Start; without a filter every well-formed datagram gets a source
+    void SetDeviceFilter(DeviceFilter filter) { filter_ = std::move(filter); }
+
+    /// @brief one datagram sent from src_ip; false when it is malformed, rejected by the filter, stale or a duplicate
+    bool Accept(const char *data, size_t len, int64_t now_ms, const std::string &src_ip = "");
+    /// @brief hand the latest accepted sample of every device to the handler, drop sources silent for kSourceTtlMs
+    void Flush();
+    void Flush(int64_t now_ms);
+    size_t source_count() const;
+    /// @brief the device pushed recently enough that polling it is unnecessary
+    bool IsFresh(const DeviceID &device_id, int64_t now_ms) const;
+    /// @brief per-device counters for /nodes
+    nlohmann::json Stats(const DeviceID &device_id) const;
+
+    static constexpr int kFlushMs = 20;
+    static constexpr int64_t kMinFreshMs = 1000; // a device is fresh for max(3 intervals, this)
+    static constexpr int64_t kSourceTtlMs = 600000; // a source without any accepted push for this long is forgotten
+
+private:
+    struct Source {
+        int64_t epoch{0};
+        uint64_t last_seq{0};
+        int64_t last_recv_ms{0};
+        int interval_ms{0};
+        std::optional<TelemetrySample> pending;
+        bool confirmed{false};                 // an unchanged heartbeat arrived since the last flush
+        std::optional<DeviceStatus> last_status; // last accepted sample, to recognise heartbeats
+        std::vector<std::string> last_services;
+        // counters
+        uint64_t received{0};
+        uint64_t applied{0};        // samples handed to the scheduler
+        uint64_t coalesced{0};      // replaced by a newer sample before a flush
+        uint64_t unchanged{0};      // heartbeats repeating the last sample
+        uint64_t stale_dropped{0};  // duplicate / reordered / from an older agent run
+        uint64_t lost{0};           // seq gaps
+        uint64_t restarts{0};       // epoch changes adopted (agent restarted)
+    };
+
+    void RecvLoop();
+
+    mutable std::mutex mutex_;
+    std::unordered_map<DeviceID, Source> sources_;
+    uint64_t malformed_{0};
+    uint64_t unknown_{0};       // well-formed datagrams the filter rejected (unregistered device or wrong source)
+    DeviceFilter filter_;
+    BatchHandler handler_;
+    int sock_{-1};
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+#endif // DOCKER_SCHEDULER_TELEMETRY_RECEIVER_H
@@ -1,4 +1,5 @@
 #include"scheduler.h"
+#include "SchedulePolicy.h"
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bundled/ostream.h>
 #include<fstream>
@@ -10,11 +11,18 @@
 #include <sstream>
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
 #include <cmath>
+#include <functional>
 #include <boost/uuid/nil_generator.hpp>
+#include <boost/uuid/string_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 std::map<TaskType, std::map<DeviceType, StaticInfoItem> > Docker_scheduler::static_info; // static task info
 TaskQueueManager Docker_scheduler::task_queue_manager_;
+ServiceTimeModel Docker_scheduler::service_times_;
+TelemetryCollector Docker_scheduler::telemetry_;
+TelemetryReceiver Docker_scheduler::telemetry_push_;
+int Docker_scheduler::telemetry_udp_port_ = 0;
 
 std::shared_mutex Docker_scheduler::devs_mutex; //
 std::map<DeviceID, Device> Docker_scheduler::device_static_info; // static device info
@@ -24,15 +32,61 @@ std::map<DeviceID, std::vector<TaskType>> Docker_scheduler::device_active_servic
 
 // std::shared_mutex Docker_scheduler::td_map_mutex_; // Thread-safe mutex for TDMap
 std::map<TaskType, std::map<DeviceID, DevSrvInfos> > Docker_scheduler::tdMap;
+ClusterStatePtr Docker_scheduler::cluster_state_ = std::make_shared<const ClusterState>();
+uint64_t Docker_scheduler::cluster_version_ = 0;
 std::once_flag Docker_scheduler::scheduler_loop_once_flag_;
 RequestTracker Docker_scheduler::request_tracker_;
-// onnx
-//Ort::Env Docker_scheduler::env(ORT_LOGGING_LEVEL_WARNING, "OnnxModel");
-//Ort::Session* Docker_scheduler::onnx_session = nullptr;
-bool Docker_scheduler::is_model_loaded = false;
-size_t Docker_scheduler::rr_index = 0;
+std::mutex Docker_scheduler::dispatch_workers_mutex_;
+std::unordered_set<DeviceID> Docker_scheduler::dispatch_workers_;
+int Docker_scheduler::dispatch_workers_per_device_ = 1;
+ConnectionPool Docker_scheduler::dispatch_pool_;
+bool Docker_scheduler::batch_upload_ = false;
+std::mutex Docker_scheduler::batch_unsupported_mutex_;
+std::unordered_set<DeviceID> Docker_scheduler::batch_unsupported_;
+int Docker_scheduler::max_sub_req_tasks_ = 128;
+int Docker_scheduler::sample_choices_ = 0;
+int Docker_scheduler::steal_idle_ms_ = 0;
+CreditLimits Docker_scheduler::credit_limits_;
+std::mutex Docker_scheduler::payload_stats_mutex_;
+std::unordered_map<DeviceID, PayloadStats> Docker_scheduler::payload_stats_;
+std::shared_ptr<const LatencyPredictor> Docker_scheduler::latency_model_;
+std::mutex Docker_scheduler::latency_model_path_mutex_;
+std::string Docker_scheduler::latency_model_path_;
+SpeculationTracker Docker_scheduler::speculation_;
 
 namespace {
+constexpr int kMaxTaskRetries = 3;
+constexpr int kSlaveRecvPort = 20810;
+constexpr size_t kMaxFailedHistory = 1000;
+constexpr int64_t kDrrQuantumTasks = 32; // tasks credited per DRR round and unit of weight
+constexpr double kDefaultProcTimeMs = 50.0;          // task type without any profile entry
+constexpr double kDefaultTaskMem = 0.03;             // per-task mem/cpu/xpu share without a profile entry
+constexpr double kDefaultTaskCpu = 0.05;
+constexpr double kDefaultTaskXpu = 0.05;
+constexpr double kDefaultTaskBytes = 256.0 * 1024.0; // per-task payload guess before the first upload
+constexpr double kLatencyRefMs = 50.0;               // net_latency at which the latency term reaches 0.5
+constexpr double kBandwidthRefMbps = 100.0;          // net_bandwidth at which the bandwidth term reaches 0.5
+constexpr int kSpeculationIntervalMs = 200;          // straggler scan period while speculation is on
+constexpr double kStragglerFactor = 1.5;             // running this many times past the expected latency
+constexpr int kTailPercent = 5;                      // only the last 5% of a request's tasks are speculated
+constexpr double kCreditExpiryFactor = 4.0;          // a running credit expires this many times past the expected latency
+constexpr double kMinCreditExpiryMs = 10000.0;       // ... and never sooner than this
+
+// same result as std::filesystem::path(id).stem() without building a path per lookup
+std::string NormalizedStem(const std::string &task_id) {
+    const size_t slash = task_id.find_last_of('/');
+    const size_t begin = slash == std::string::npos ? 0 : slash + 1;
+    std::string name = task_id.substr(begin);
+    if (name == "." || name == "..") {
+        return name;
+    }
+    const size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name.resize(dot);
+    }
+    return name;
+}
+
 int64_t NowMs() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now().time_since_epoch()).count();
@@ -48,21 +102,69 @@ const char *ProgressStatusToString(TaskProgressStatus status) {
             return "result_ready";
         case TaskProgressStatus::SENT:
             return "rst_sended";
+        case TaskProgressStatus::FAILED:
+            return "failed";
         default:
             return "unknown";
     }
 }
 
+nlohmann::json BuildSubReqMeta(const SubRequest &sub_req, const Device &target_device) {
+    nlohmann::json meta_payload;
+    meta_payload["req_id"] = sub_req.req_id;
+    meta_payload["sub_req_id"] = sub_req.sub_req_id;
+    meta_payload["sub_req_count"] = sub_req.sub_req_count;
+    meta_payload["tasktype"] = sub_req.task_type == TaskType::Unknown ? "Unknown" : nlohmann::json(sub_req.task_type);
+    meta_payload["dst_device_id"] = boost::uuids::to_string(sub_req.dst_device_id);
+    meta_payload["dst_device_ip"] = target_device.ip_address;
+    meta_payload["enqueue_time_ms"] = sub_req.enqueue_time_ms;
+    meta_payload["expected_end_time_ms"] = sub_req.expected_end_time_ms;
+    return meta_payload;
+}
+
+nlohmann::json BuildTaskMeta(const ImageTask &task, int sub_req_count) {
+    nlohmann::json meta_json;
+    meta_json["ip"] = task.client_ip;
+    meta_json["file_name"] = task.task_id;
+    meta_json["tasktype"] = task.task_type == TaskType::Unknown ? "Unknown" : nlohmann::json(task.task_type);
+    meta_json["req_id"] = task.req_id;
+    meta_json["sub_req_id"] = task.sub_req_id;
+    meta_json["sub_req_count"] = sub_req_count;
+    return meta_json;
+}
+
+// canonical 8-4-4-4-12 hex form; anything else (a host name, "unknown") is not a global_id, no parse attempted
+bool IsUuidText(const std::string &text) {
+    if (text.size() != 36) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        const bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash ? text[i] != '-' : !std::isxdigit(static_cast<unsigned char>(text[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 SubRequest MakeSingleSubRequest(const ImageTask &task) {
     SubRequest sub_req;
     sub_req.req_id = task.req_id.empty() ? "req_unknown" : task.req_id;
-    sub_req.sub_req_id = task.sub_req_id.empty() ? ("sub_" + task.task_id) : task.sub_req_id;
+    if (task.retry_count > 0) {
+        // a retry must not reuse the id of a sub-request the slave may already have registered
+        sub_req.sub_req_id = fmt::format("sub_{}_r{}", task.task_id, task.retry_count);
+    } else {
+        sub_req.sub_req_id = task.sub_req_id.empty() ? ("sub_" + task.task_id) : task.sub_req_id;
+    }
     sub_req.client_ip = task.client_ip;
     sub_req.task_type = task.task_type;
     sub_req.schedule_strategy = task.schedule_strategy;
     sub_req.sub_req_count = 1;
-    sub_req.enqueue_time_ms = NowMs();
+    // a retried / recovered task keeps its original arrival, so it keeps the aging it already earned
+    sub_req.enqueue_time_ms = task.enqueue_time_ms > 0 ? task.enqueue_time_ms : NowMs();
+    sub_req.expected_end_time_ms = task.deadline_ms;
     sub_req.tasks.push_back(task);
+    sub_req.tasks.front().sub_req_id = sub_req.sub_req_id;
     return sub_req;
 }
 } // namespace
@@ -71,12 +173,46 @@ RequestTracker &Docker_scheduler::GetRequestTracker() {
     return request_tracker_;
 }
 
+void RequestTracker::CountTask(const TaskProgress &tp, int delta) {
+    if (tp.sub_req_id.empty()) {
+        return;
+    }
+    auto sub_it = sub_reqs_.find(tp.sub_req_id);
+    if (sub_it == sub_reqs_.end()) {
+        return;
+    }
+    sub_it->second.counters.At(tp.status) += delta;
+    auto req_it = reqs_.find(sub_it->second.req_id);
+    if (req_it != reqs_.end()) {
+        req_it->second.counters.At(tp.status) += delta;
+    }
+}
+
+void RequestTracker::SetTaskStatus(TaskProgress &tp, TaskProgressStatus status) {
+    if (tp.status == status) {
+        return;
+    }
+    CountTask(tp, -1);
+    tp.status = status;
+    CountTask(tp, 1);
+}
+
+void RequestTracker::SetRetention(const RetentionOptions &options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    retention_ = options;
+    archive_.clear();
+    archive_index_.clear();
+    archive_next_ = 0;
+}
+
 void RequestTracker::OnClientRequest(const ClientRequest &req) {
     std::lock_guard<std::mutex> lock(mutex_);
+    EvictFinished(NowMs());
     ReqProgress &entry = reqs_[req.req_id];
     entry.req_id = req.req_id;
     entry.client_ip = req.client_ip;
     entry.total = req.total_num;
+    entry.deadline_ms = req.deadline_ms;
     entry.tasktype = req.task_type == TaskType::Unknown ? "Unknown" : to_string(nlohmann::json(req.task_type));
     for (const auto &task : req.tasks) {
         TaskProgress &tp = tasks_[task.task_id];
@@ -87,32 +223,51 @@ void RequestTracker::OnClientRequest(const ClientRequest &req) {
 
 void RequestTracker::OnSubRequestAllocated(const SubRequest &sub_req) {
     std::lock_guard<std::mutex> lock(mutex_);
+    ReqProgress &req = reqs_[sub_req.req_id];
+    if (req.req_id.empty()) {
+        req.req_id = sub_req.req_id;
+        req.client_ip = sub_req.client_ip;
+        req.total = sub_req.sub_req_count;
+        req.tasktype = sub_req.task_type == TaskType::Unknown ? "Unknown" : to_string(nlohmann::json(sub_req.task_type));
+    }
+    if (std::find(req.sub_req_ids.begin(), req.sub_req_ids.end(), sub_req.sub_req_id) ==
+        req.sub_req_ids.end()) {
+        req.sub_req_ids.push_back(sub_req.sub_req_id);
+    }
+
     SubReqProgress &sr = sub_reqs_[sub_req.sub_req_id];
     sr.sub_req_id = sub_req.sub_req_id;
     sr.req_id = sub_req.req_id;
     sr.client_ip = sub_req.client_ip;
     sr.device_id = boost::uuids::to_string(sub_req.dst_device_id);
     sr.device_ip = sub_req.dst_device_ip;
+    // re-allocation of a known sub_req: its previous tasks stop counting here
+    for (const auto &task_id : sr.task_ids) {
+        auto task_it = tasks_.find(task_id);
+        if (task_it != tasks_.end() && task_it->second.sub_req_id == sub_req.sub_req_id) {
+            CountTask(task_it->second, -1);
+            task_it->second.sub_req_id.clear();
+        }
+    }
     sr.task_ids.clear();
     for (const auto &task : sub_req.tasks) {
         sr.task_ids.push_back(task.task_id);
         TaskProgress &tp = tasks_[task.task_id];
+        if (!tp.sub_req_id.empty()) {
+            // the task moved here from another sub-request
+            CountTask(tp, -1);
+            auto old_it = sub_reqs_.find(tp.sub_req_id);
+            if (old_it != sub_reqs_.end()) {
+                auto &old_ids = old_it->second.task_ids;
+                old_ids.erase(std::remove(old_ids.begin(), old_ids.end(), task.task_id), old_ids.end());
+            }
+        }
         tp.task_id = task.task_id;
         tp.req_id = sub_req.req_id;
         tp.sub_req_id = sub_req.sub_req_id;
         tp.device_id = sr.device_id;
         tp.device_ip = sr.device_ip;
-    }
-    ReqProgress &req = reqs_[sub_req.req_id];
-    if (req.req_id.empty()) {
-        req.req_id = sub_req.req_id;
-        req.client_ip = sub_req.client_ip;
-        req.total = sub_req.sub_req_count;
-        req.tasktype = sub_req.task_type == TaskType::Unknown ? "Unknown" : to_string(nlohmann::json(sub_req.task_type));
-    }
-    if (std::find(req.sub_req_ids.begin(), req.sub_req_ids.end(), sub_req.sub_req_id) ==
-        req.sub_req_ids.end()) {
-        req.sub_req_ids.push_back(sub_req.sub_req_id);
+        CountTask(tp, 1);
     }
 }
 
@@ -122,7 +277,7 @@ void RequestTracker::OnTaskRunning(const std::string &task_id) {
     if (it == tasks_.end()) {
         return;
     }
-    it->second.status = TaskProgressStatus::RUNNING;
+    SetTaskStatus(it->second, TaskProgressStatus::RUNNING);
 }
 
 void RequestTracker::OnTaskResultReady(const std::string &task_id) {
@@ -132,7 +287,7 @@ void RequestTracker::OnTaskResultReady(const std::string &task_id) {
         return;
     }
     if (it->second.status != TaskProgressStatus::SENT) {
-        it->second.status = TaskProgressStatus::RESULT_READY;
+        SetTaskStatus(it->second, TaskProgressStatus::RESULT_READY);
     }
 }
 
@@ -142,8 +297,196 @@ void RequestTracker::OnTaskSent(const std::string &task_id) {
     if (it == tasks_.end()) {
         return;
     }
-    it->second.status = TaskProgressStatus::SENT;
+    const int64_t now_ms = NowMs();
+    if (it->second.status != TaskProgressStatus::SENT) {
+        auto req_it = reqs_.find(it->second.req_id);
+        if (req_it != reqs_.end() && req_it->second.deadline_ms > 0 && now_ms > req_it->second.deadline_ms) {
+            req_it->second.deadline_missed++;
+        }
+    }
+    SetTaskStatus(it->second, TaskProgressStatus::SENT);
+    MaybeFinish(it->second.req_id, now_ms);
+    EvictFinished(now_ms);
+}
+
+void RequestTracker::OnTaskFailed(const std::string &task_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tasks_.find(task_id);
+    if (it == tasks_.end()) {
+        return;
+    }
+    if (it->second.status == TaskProgressStatus::FAILED) {
+        return;
+    }
+    // leaves its waiting/running bucket, so it is not counted as live and failed at once
+    SetTaskStatus(it->second, TaskProgressStatus::FAILED);
+    auto req_it = reqs_.find(it->second.req_id);
+    if (req_it == reqs_.end()) {
+        return;
+    }
+    const int64_t now_ms = NowMs();
+    MaybeFinish(req_it->first, now_ms);
+    EvictFinished(now_ms);
+}
+
+void RequestTracker::MaybeFinish(const std::string &req_id, int64_t now_ms) {
+    auto it = reqs_.find(req_id);
+    if (it == reqs_.end()) {
+        return;
+    }
+    ReqProgress &req = it->second;
+    if (req.finished_time_ms != 0 || req.total <= 0 || req.counters.sent + req.counters.failed < req.total) {
+        return;
+    }
+    req.finished_time_ms = now_ms;
+    finished_order_.push_back(req_id);
+}
+
+void RequestTracker::EvictFinished(int64_t now_ms) {
+    while (!finished_order_.empty()) {
+        auto req_it = reqs_.find(finished_order_.front());
+        if (req_it == reqs_.end()) {
+            finished_order_.pop_front();
+            continue;
+        }
+        const ReqProgress &req = req_it->second;
+        const bool over_count = finished_order_.size() > retention_.max_finished;
+        const bool expired = now_ms - req.finished_time_ms >= retention_.finished_ttl_ms;
+        if (!over_count && !expired) {
+            break;
+        }
+        Archive(req);
+        for (const auto &sub_id : req.sub_req_ids) {
+            auto sub_it = sub_reqs_.find(sub_id);
+            if (sub_it == sub_reqs_.end()) {
+                continue;
+            }
+            for (const auto &task_id : sub_it->second.task_ids) {
+                auto task_it = tasks_.find(task_id);
+                // file names can repeat across requests, only drop entries owned by this one
+                if (task_it != tasks_.end() && task_it->second.req_id == req.req_id) {
+                    tasks_.erase(task_it);
+                }
+            }
+            sub_reqs_.erase(sub_it);
+        }
+        reqs_.erase(req_it);
+        finished_order_.pop_front();
+    }
+}
+
+void RequestTracker::Archive(const ReqProgress &req) {
+    if (retention_.archive_capacity == 0) {
+        return;
+    }
+    ArchivedReq packed;
+    packed.req_id = req.req_id;
+    packed.client_ip = req.client_ip;
+    packed.tasktype = req.tasktype;
+    packed.total = req.total;
+    packed.sub_req_count = static_cast<int32_t>(req.sub_req_ids.size());
+    packed.deadline_missed = req.deadline_missed;
+    packed.deadline_ms = req.deadline_ms;
+    packed.counters = req.counters;
+    packed.finished_time_ms = req.finished_time_ms;
+
+    const size_t slot = archive_next_;
+    if (archive_.size() < retention_.archive_capacity) {
+        archive_.push_back(std::move(packed));
+    } else {
+        auto old_it = archive_index_.find(archive_[slot].req_id);
+        if (old_it != archive_index_.end() && old_it->second == slot) {
+            archive_index_.erase(old_it);
+        }
+        archive_[slot] = std::move(packed);
+    }
+    archive_index_[archive_[slot].req_id] = slot;
+    archive_next_ = (slot + 1) % retention_.archive_capacity;
+}
+
+namespace {
+std::string SubReqStatus(const SubReqProgress &sub) {
+    const ProgressCounters &c = sub.counters;
+    if (!sub.task_ids.empty() && c.sent == static_cast<int>(sub.task_ids.size())) {
+        return "completed";
+    }
+    if (c.failed > 0 && c.sent + c.failed == static_cast<int>(sub.task_ids.size())) {
+        return "failed";
+    }
+    if (c.running > 0 || c.result_ready > 0 || c.sent > 0) {
+        return "processing";
+    }
+    return "waiting";
+}
+
+std::string ReqStatus(const ReqProgress &req) {
+    const ProgressCounters &c = req.counters;
+    if (req.total > 0 && c.sent == req.total) {
+        return "completed";
+    }
+    if (req.finished_time_ms != 0) {
+        return "failed";
+    }
+    if (c.running > 0 || c.result_ready > 0 || c.sent > 0) {
+        return "processing";
+    }
+    return "waiting";
+}
+
+json SubReqSummary(const SubReqProgress &sub) {
+    json sub_json;
+    sub_json["sub_req_id"] = sub.sub_req_id;
+    sub_json["device_id"] = sub.device_id;
+    sub_json["device_ip"] = sub.device_ip;
+    sub_json["total_task_num"] = static_cast<int>(sub.task_ids.size());
+    sub_json["waiting_task_num"] = sub.counters.waiting;
+    sub_json["processing_task_num"] = sub.counters.running;
+    sub_json["result_ready_task_num"] = sub.counters.result_ready;
+    sub_json["rst_sended_task_num"] = sub.counters.sent;
+    sub_json["failed_task_num"] = sub.counters.failed;
+    sub_json["status"] = SubReqStatus(sub);
+    return sub_json;
+}
+
+json ReqSummary(const ReqProgress &req) {
+    json req_json;
+    req_json["req_id"] = req.req_id;
+    req_json["client_ip"] = req.client_ip;
+    req_json["tasktype"] = req.tasktype;
+    req_json["total"] = req.total;
+    req_json["waiting"] = req.counters.waiting;
+    req_json["processing"] = req.counters.running;
+    req_json["result_ready"] = req.counters.result_ready;
+    req_json["rst_sended"] = req.counters.sent;
+    req_json["failed"] = req.counters.failed;
+    req_json["deadline_ms"] = req.deadline_ms;
+    req_json["deadline_missed"] = req.deadline_missed;
+    req_json["status"] = ReqStatus(req);
+    return req_json;
+}
+
+json ArchivedReqSummary(const ArchivedReq &packed) {
+    json req_json;
+    req_json["req_id"] = packed.req_id;
+    req_json["client_ip"] = packed.client_ip;
+    req_json["tasktype"] = packed.tasktype;
+    req_json["total"] = packed.total;
+    req_json["waiting"] = packed.counters.waiting;
+    req_json["processing"] = packed.counters.running;
+    req_json["result_ready"] = packed.counters.result_ready;
+    req_json["rst_sended"] = packed.counters.sent;
+    req_json["failed"] = packed.counters.failed;
+    req_json["deadline_ms"] = packed.deadline_ms;
+    req_json["deadline_missed"] = packed.deadline_missed;
+    req_json["status"] = packed.counters.sent == packed.total ? "completed" : "failed";
+    req_json["sub_req_count"] = packed.sub_req_count;
+    req_json["finished_time_ms"] = packed.finished_time_ms;
+    // per sub-request detail is dropped on archiving
+    req_json["archived"] = true;
+    req_json["sub_reqs"] = json::array();
+    return req_json;
 }
+} // namespace
 
 json RequestTracker::BuildSnapshot(const std::string &client_ip) const {
     std::lock_guard<std::mutex> lock(mutex_);
@@ -154,79 +497,15 @@ json RequestTracker::BuildSnapshot(const std::string &client_ip) const {
         if (!client_ip.empty() && req.client_ip != client_ip) {
             continue;
         }
-        json req_json;
-        req_json["req_id"] = req.req_id;
-        req_json["client_ip"] = req.client_ip;
-        req_json["tasktype"] = req.tasktype;
-        req_json["total"] = req.total;
-        int sent_count = 0;
-        int running_count = 0;
-        int ready_count = 0;
-        int waiting_count = 0;
+        json req_json = ReqSummary(req);
         json sub_arr = json::array();
         for (const auto &sub_id : req.sub_req_ids) {
             auto sub_it = sub_reqs_.find(sub_id);
             if (sub_it == sub_reqs_.end()) {
                 continue;
             }
-            const SubReqProgress &sub = sub_it->second;
-            int sub_sent = 0;
-            int sub_running = 0;
-            int sub_ready = 0;
-            int sub_waiting = 0;
-            for (const auto &task_id : sub.task_ids) {
-                auto task_it = tasks_.find(task_id);
-                if (task_it == tasks_.end()) {
-                    continue;
-                }
-                const TaskProgress &tp = task_it->second;
-                if (tp.status == TaskProgressStatus::SENT) {
-                    sub_sent++;
-                } else if (tp.status == TaskProgressStatus::RESULT_READY) {
-                    sub_ready++;
-                } else if (tp.status == TaskProgressStatus::RUNNING) {
-                    sub_running++;
-                } else {
-                    sub_waiting++;
-                }
-            }
-            sent_count += sub_sent;
-            running_count += sub_running;
-            ready_count += sub_ready;
-            waiting_count += sub_waiting;
-            std::string sub_status;
-            if (!sub.task_ids.empty() && sub_sent == static_cast<int>(sub.task_ids.size())) {
-                sub_status = "completed";
-            } else if (sub_running > 0 || sub_ready > 0 || sub_sent > 0) {
-                sub_status = "processing";
-            } else {
-                sub_status = "waiting";
-            }
-            json sub_json;
-            sub_json["sub_req_id"] = sub.sub_req_id;
-            sub_json["device_id"] = sub.device_id;
-            sub_json["device_ip"] = sub.device_ip;
-            sub_json["total_task_num"] = static_cast<int>(sub.task_ids.size());
-            sub_json["waiting_task_num"] = sub_waiting;
-            sub_json["processing_task_num"] = sub_running;
-            sub_json["result_ready_task_num"] = sub_ready;
-            sub_json["rst_sended_task_num"] = sub_sent;
-            sub_json["status"] = sub_status;
-            sub_arr.push_back(sub_json);
-        }
-        std::string req_status;
-        if (req.total > 0 && sent_count == req.total) {
-            req_status = "completed";
-        } else if (running_count > 0 || ready_count > 0 || sent_count > 0) {
-            req_status = "processing";
-        } else {
-            req_status = "waiting";
+            sub_arr.push_back(SubReqSummary(sub_it->second));
         }
-        req_json["waiting"] = waiting_count;
-        req_json["processing"] = running_count;
-        req_json["result_ready"] = ready_count;
-        req_json["rst_sended"] = sent_count;
-        req_json["status"] = req_status;
         req_json["sub_reqs"] = sub_arr;
         auto &group = grouped[req.client_ip];
         if (group.is_null()) {
@@ -253,54 +532,8 @@ json RequestTracker::BuildReqList(const std::string &client_ip) const {
         if (!client_ip.empty() && req.client_ip != client_ip) {
             continue;
         }
-        json req_json;
-        req_json["req_id"] = req.req_id;
-        req_json["client_ip"] = req.client_ip;
-        req_json["tasktype"] = req.tasktype;
-        req_json["total"] = req.total;
-        int sent_count = 0;
-        int running_count = 0;
-        int ready_count = 0;
-        int waiting_count = 0;
-        json sub_id_arr = json::array();
-        for (const auto &sub_id : req.sub_req_ids) {
-            sub_id_arr.push_back(sub_id);
-            auto sub_it = sub_reqs_.find(sub_id);
-            if (sub_it == sub_reqs_.end()) {
-                continue;
-            }
-            const SubReqProgress &sub = sub_it->second;
-            for (const auto &task_id : sub.task_ids) {
-                auto task_it = tasks_.find(task_id);
-                if (task_it == tasks_.end()) {
-                    continue;
-                }
-                const TaskProgress &tp = task_it->second;
-                if (tp.status == TaskProgressStatus::SENT) {
-                    sent_count++;
-                } else if (tp.status == TaskProgressStatus::RESULT_READY) {
-                    ready_count++;
-                } else if (tp.status == TaskProgressStatus::RUNNING) {
-                    running_count++;
-                } else {
-                    waiting_count++;
-                }
-            }
-        }
-        std::string req_status;
-        if (req.total > 0 && sent_count == req.total) {
-            req_status = "completed";
-        } else if (running_count > 0 || ready_count > 0 || sent_count > 0) {
-            req_status = "processing";
-        } else {
-            req_status = "waiting";
-        }
-        req_json["waiting"] = waiting_count;
-        req_json["processing"] = running_count;
-        req_json["result_ready"] = ready_count;
-        req_json["rst_sended"] = sent_count;
-        req_json["status"] = req_status;
-        req_json["sub_req_ids"] = sub_id_arr;
+        json req_json = ReqSummary(req);
+        req_json["sub_req_ids"] = req.sub_req_ids;
         auto &group = grouped[req.client_ip];
         if (group.is_null()) {
             group = json::object();
@@ -331,86 +564,45 @@ std::optional<json> RequestTracker::BuildReqDetail(const std::string &req_id) co
     std::lock_guard<std::mutex> lock(mutex_);
     auto req_it = reqs_.find(req_id);
     if (req_it == reqs_.end()) {
-        return std::nullopt;
+        auto archived_it = archive_index_.find(req_id);
+        if (archived_it == archive_index_.end()) {
+            return std::nullopt;
+        }
+        return ArchivedReqSummary(archive_[archived_it->second]);
     }
     const ReqProgress &req = req_it->second;
-    json req_json;
-    req_json["req_id"] = req.req_id;
-    req_json["client_ip"] = req.client_ip;
-    req_json["tasktype"] = req.tasktype;
-    req_json["total"] = req.total;
-    int sent_count = 0;
-    int running_count = 0;
-    int ready_count = 0;
-    int waiting_count = 0;
+    json req_json = ReqSummary(req);
     json sub_arr = json::array();
     for (const auto &sub_id : req.sub_req_ids) {
         auto sub_it = sub_reqs_.find(sub_id);
         if (sub_it == sub_reqs_.end()) {
             continue;
         }
-        const SubReqProgress &sub = sub_it->second;
-        int sub_sent = 0;
-        int sub_running = 0;
-        int sub_ready = 0;
-        int sub_waiting = 0;
-        for (const auto &task_id : sub.task_ids) {
-            auto task_it = tasks_.find(task_id);
-            if (task_it == tasks_.end()) {
-                continue;
-            }
-            const TaskProgress &tp = task_it->second;
-            if (tp.status == TaskProgressStatus::SENT) {
-                sub_sent++;
-            } else if (tp.status == TaskProgressStatus::RESULT_READY) {
-                sub_ready++;
-            } else if (tp.status == TaskProgressStatus::RUNNING) {
-                sub_running++;
-            } else {
-                sub_waiting++;
-            }
-        }
-        sent_count += sub_sent;
-        running_count += sub_running;
-        ready_count += sub_ready;
-        waiting_count += sub_waiting;
-        std::string sub_status;
-        if (!sub.task_ids.empty() && sub_sent == static_cast<int>(sub.task_ids.size())) {
-            sub_status = "completed";
-        } else if (sub_running > 0 || sub_ready > 0 || sub_sent > 0) {
-            sub_status = "processing";
-        } else {
-            sub_status = "waiting";
-        }
-        json sub_json;
-        sub_json["sub_req_id"] = sub.sub_req_id;
-        sub_json["device_id"] = sub.device_id;
-        sub_json["device_ip"] = sub.device_ip;
-        sub_json["total_task_num"] = static_cast<int>(sub.task_ids.size());
-        sub_json["waiting_task_num"] = sub_waiting;
-        sub_json["processing_task_num"] = sub_running;
-        sub_json["result_ready_task_num"] = sub_ready;
-        sub_json["rst_sended_task_num"] = sub_sent;
-        sub_json["status"] = sub_status;
-        sub_arr.push_back(sub_json);
-    }
-    std::string req_status;
-    if (req.total > 0 && sent_count == req.total) {
-        req_status = "completed";
-    } else if (running_count > 0 || ready_count > 0 || sent_count > 0) {
-        req_status = "processing";
-    } else {
-        req_status = "waiting";
+        sub_arr.push_back(SubReqSummary(sub_it->second));
     }
-    req_json["waiting"] = waiting_count;
-    req_json["processing"] = running_count;
-    req_json["result_ready"] = ready_count;
-    req_json["rst_sended"] = sent_count;
-    req_json["status"] = req_status;
     req_json["sub_reqs"] = sub_arr;
     return req_json;
 }
 
+std::optional<std::pair<int, int>> RequestTracker::RemainingTasks(const std::string &req_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = reqs_.find(req_id);
+    if (it == reqs_.end() || it->second.total <= 0) {
+        return std::nullopt;
+    }
+    const ReqProgress &req = it->second;
+    return std::make_pair(std::max(0, req.total - req.counters.sent - req.counters.failed), req.total);
+}
+
+std::optional<TaskProgressStatus> RequestTracker::GetTaskStatus(const std::string &task_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tasks_.find(task_id);
+    if (it == tasks_.end()) {
+        return std::nullopt;
+    }
+    return it->second.status;
+}
+
 std::optional<json> RequestTracker::BuildSubReqDetail(const std::string &sub_req_id) const {
     std::lock_guard<std::mutex> lock(mutex_);
     auto sub_it = sub_reqs_.find(sub_req_id);
@@ -446,59 +638,27 @@ std::unordered_map<std::string, json> RequestTracker::BuildDeviceSubReqs(
     std::unordered_map<std::string, json> out;
     for (const auto &pair : sub_reqs_) {
         const SubReqProgress &sub = pair.second;
+        const ProgressCounters &c = sub.counters;
         const bool pending_master = pending_ids.find(sub.sub_req_id) != pending_ids.end();
-        int sub_sent = 0;
-        int sub_running = 0;
-        int sub_ready = 0;
-        int sub_waiting = 0;
-        for (const auto &task_id : sub.task_ids) {
-            auto task_it = tasks_.find(task_id);
-            if (task_it == tasks_.end()) {
-                continue;
-            }
-            const TaskProgress &tp = task_it->second;
-            if (tp.status == TaskProgressStatus::SENT) {
-                sub_sent++;
-            } else if (tp.status == TaskProgressStatus::RESULT_READY) {
-                sub_ready++;
-            } else if (tp.status == TaskProgressStatus::RUNNING) {
-                sub_running++;
-            } else {
-                sub_waiting++;
-            }
-        }
-        std::string sub_status;
-        if (!sub.task_ids.empty() && sub_sent == static_cast<int>(sub.task_ids.size())) {
-            sub_status = "completed";
-        } else if (sub_running > 0 || sub_ready > 0 || sub_sent > 0) {
-            sub_status = "processing";
-        } else {
-            sub_status = "waiting";
-        }
         std::string lifecycle_state;
         if (pending_master) {
             lifecycle_state = "pending_master";
-        } else if (!sub.task_ids.empty() && sub_sent == static_cast<int>(sub.task_ids.size())) {
+        } else if (!sub.task_ids.empty() && c.sent == static_cast<int>(sub.task_ids.size())) {
             lifecycle_state = "completed";
-        } else if (sub_running > 0) {
+        } else if (c.running > 0) {
             lifecycle_state = "running";
-        } else if (sub_ready > 0) {
+        } else if (c.result_ready > 0) {
             lifecycle_state = "result_ready";
-        } else if (sub_sent > 0) {
+        } else if (c.sent > 0) {
             lifecycle_state = "rst_sended";
         } else {
             lifecycle_state = "assigned";
         }
-        json sub_json;
-        sub_json["sub_req_id"] = sub.sub_req_id;
+        json sub_json = SubReqSummary(sub);
+        sub_json.erase("device_id");
+        sub_json.erase("device_ip");
         sub_json["req_id"] = sub.req_id;
         sub_json["client_ip"] = sub.client_ip;
-        sub_json["total_task_num"] = static_cast<int>(sub.task_ids.size());
-        sub_json["waiting_task_num"] = sub_waiting;
-        sub_json["processing_task_num"] = sub_running;
-        sub_json["result_ready_task_num"] = sub_ready;
-        sub_json["rst_sended_task_num"] = sub_sent;
-        sub_json["status"] = sub_status;
         sub_json["lifecycle_state"] = lifecycle_state;
         auto &arr = out[sub.device_id];
         if (arr.is_null()) {
@@ -509,123 +669,1111 @@ std::unordered_map<std::string, json> RequestTracker::BuildDeviceSubReqs(
     return out;
 }
 
-std::optional<SubRequest> TaskQueueManager::PopPending() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    pending_cv_.wait(lock, [this]() { return !pending_queue_.empty(); });
-    SubRequest sub_req = pending_queue_.front();
-    pending_queue_.pop_front();
+void DeadlineQueue::Push(SubRequest sub_req, int64_t key, bool high_priority) {
+    const int64_t seq = high_priority ? --front_seq_ : ++back_seq_;
+    items_.emplace(std::make_pair(key, seq), std::move(sub_req));
+}
+
+SubRequest DeadlineQueue::Pop() {
+    auto it = items_.begin();
+    SubRequest sub_req = std::move(it->second);
+    items_.erase(it);
     return sub_req;
 }
 
-void TaskQueueManager::PushPending(const SubRequest &sub_req, bool high_priority) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (high_priority) {
-            pending_queue_.push_front(sub_req);
-        } else {
-            pending_queue_.push_back(sub_req);
-        }
+SubRequest DeadlineQueue::PopBack() {
+    auto it = std::prev(items_.end());
+    SubRequest sub_req = std::move(it->second);
+    items_.erase(it);
+    return sub_req;
+}
+
+std::vector<SubRequest> DeadlineQueue::Drain() {
+    std::vector<SubRequest> out;
+    out.reserve(items_.size());
+    for (auto &pair : items_) {
+        out.push_back(std::move(pair.second));
     }
-    pending_cv_.notify_one();
+    items_.clear();
+    return out;
 }
 
-bool TaskQueueManager::AddRunningTask(const DeviceID &device_id, const ImageTask &task) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ImageTask running_task = task;
-    running_task.status = TaskStatus::RUNNING;
-    running_index_[device_id].push_back(running_task);
-    Docker_scheduler::GetRequestTracker().OnTaskRunning(task.task_id);
-    return true;
+std::string FairQueue::FlowKey(const std::string &client_ip, TaskType task_type) {
+    return client_ip + "|" + fmt::format("{}", task_type);
 }
 
-std::optional<ImageTask> TaskQueueManager::CompleteTaskAndGet(const std::string &reported_task_id) {
-    std::lock_guard<std::mutex> lock(mutex_);
+void FairQueue::Push(SubRequest sub_req, int64_t key, int weight, bool high_priority) {
+    // client_ip is open-ended, so flows of clients that went away are swept here instead of piling up
+    const int64_t now_ms = NowMs();
+    if (now_ms - last_prune_ms_ >= kFlowIdleMs) {
+        PruneIdleFlows(now_ms, kFlowIdleMs);
+        last_prune_ms_ = now_ms;
+    }
+    const std::string flow_key = FlowKey(sub_req.client_ip, sub_req.task_type);
+    Flow &flow = flows_[flow_key];
+    flow.last_active_ms = now_ms;
+    flow.client_ip = sub_req.client_ip;
+    flow.task_type = sub_req.task_type;
+    flow.weight = std::max(1, weight);
+    flow.queued_tasks += sub_req.tasks.size();
+    queued_tasks_ += sub_req.tasks.size();
+    flow.stats.enqueued_tasks += sub_req.tasks.size();
+    flow.queue.Push(std::move(sub_req), key, high_priority);
+    if (!flow.active) {
+        flow.active = true;
+        active_.push_back(flow_key);
+    }
+    size_++;
+}
 
-    const std::filesystem::path reported_path(reported_task_id);
-    const std::string reported_stem = reported_path.stem().string();
-
-    for (auto map_it = running_index_.begin(); map_it != running_index_.end(); ++map_it) {
-        auto &task_list = map_it->second;
-        for (auto it = task_list.begin(); it != task_list.end(); ++it) {
-            const std::filesystem::path running_path(it->task_id);
-            const bool id_match = (it->task_id == reported_task_id);
-            const bool stem_match = (!reported_stem.empty() && running_path.stem().string() == reported_stem);
-            if (id_match || stem_match) {
-                ImageTask completed = *it;
-                task_list.erase(it);
-                Docker_scheduler::GetRequestTracker().OnTaskSent(reported_task_id);
-                return completed;
-            }
+SubRequest FairQueue::Pop() {
+    return Pop(nullptr);
+}
+
+bool FairQueue::HasEligible(const std::function<bool(TaskType)> &eligible) const {
+    for (const auto &flow_key : active_) {
+        if (!eligible || eligible(flows_.at(flow_key).task_type)) {
+            return true;
         }
     }
+    return false;
+}
 
-    return std::nullopt;
+SubRequest FairQueue::Pop(const std::function<bool(TaskType)> &eligible) {
+    while (true) {
+        Flow &flow = flows_[active_.front()];
+        if (eligible && !eligible(flow.task_type)) {
+            // blocked flow keeps its deficit and waits for its next turn
+            active_.push_back(active_.front());
+            active_.pop_front();
+            continue;
+        }
+        const int64_t cost = std::max<int64_t>(1, static_cast<int64_t>(flow.queue.Front().tasks.size()));
+        if (flow.deficit < cost) {
+            // not enough credit for the head sub-request: top up and give the next flow its turn
+            flow.deficit += kDrrQuantumTasks * flow.weight;
+            active_.push_back(active_.front());
+            active_.pop_front();
+            continue;
+        }
+        SubRequest sub_req = flow.queue.Pop();
+        flow.deficit -= cost;
+        flow.last_active_ms = NowMs();
+        flow.queued_tasks -= sub_req.tasks.size();
+        queued_tasks_ -= sub_req.tasks.size();
+        size_--;
+        const int64_t wait_ms = sub_req.enqueue_time_ms > 0 ? std::max<int64_t>(0, flow.last_active_ms - sub_req.enqueue_time_ms) : 0;
+        flow.stats.dequeued_sub_reqs++;
+        flow.stats.dequeued_tasks += sub_req.tasks.size();
+        flow.stats.total_wait_ms += wait_ms;
+        flow.stats.max_wait_ms = std::max(flow.stats.max_wait_ms, wait_ms);
+        if (flow.queue.empty()) {
+            // an idle flow does not bank credit
+            flow.deficit = 0;
+            flow.active = false;
+            active_.pop_front();
+        }
+        return sub_req;
+    }
 }
 
-bool TaskQueueManager::CompleteTask(const std::string &task_id) {
-    return CompleteTaskAndGet(task_id).has_value();
+void FairQueue::Unpop(SubRequest sub_req, int64_t key, int weight) {
+    const size_t tasks = sub_req.tasks.size();
+    const std::string flow_key = FlowKey(sub_req.client_ip, sub_req.task_type);
+    Push(std::move(sub_req), key, weight, true);
+    Flow &flow = flows_[flow_key];
+    // refund what Pop charged for the tasks that were not sent
+    flow.deficit += static_cast<int64_t>(tasks);
+    flow.stats.enqueued_tasks -= std::min<uint64_t>(flow.stats.enqueued_tasks, tasks);
+    flow.stats.dequeued_tasks -= std::min<uint64_t>(flow.stats.dequeued_tasks, tasks);
 }
 
-std::vector<std::string> TaskQueueManager::GetPendingSubReqIds() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::vector<std::string> out;
-    out.reserve(pending_queue_.size());
-    for (const auto &sub_req : pending_queue_) {
-        out.push_back(sub_req.sub_req_id);
+std::vector<SubRequest> FairQueue::Drain() {
+    std::vector<SubRequest> out;
+    out.reserve(size_);
+    for (auto &pair : flows_) {
+        for (auto &sub_req : pair.second.queue.Drain()) {
+            out.push_back(std::move(sub_req));
+        }
+        pair.second.deficit = 0;
+        pair.second.queued_tasks = 0;
+        pair.second.active = false;
     }
+    active_.clear();
+    size_ = 0;
+    queued_tasks_ = 0;
     return out;
 }
 
-void TaskQueueManager::RecoverTasks(const DeviceID &device_id) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = running_index_.find(device_id);
-    if (it == running_index_.end()) {
-        return;
-    }
-    auto &tasks = it->second;
-    for (auto &task : tasks) {
-        task.retry_count += 1;
-        task.status = TaskStatus::PENDING;
-        if (task.retry_count <= 3) {
-            pending_queue_.push_front(MakeSingleSubRequest(task));
+size_t FairQueue::PruneIdleFlows(int64_t now_ms, int64_t idle_ms) {
+    size_t pruned = 0;
+    for (auto it = flows_.begin(); it != flows_.end();) {
+        if (!it->second.active && it->second.queue.empty() && now_ms - it->second.last_active_ms >= idle_ms) {
+            it = flows_.erase(it);
+            pruned++;
         } else {
-            failed_history_.push_back(task);
+            ++it;
         }
     }
-    running_index_.erase(it);
-    pending_cv_.notify_one();
+    return pruned;
 }
 
-void TaskQueueManager::MoveToFailed(const ImageTask &task) {
+size_t CreditLimits::Limit(DeviceType dtype, TaskType ttype) const {
+    auto pair_it = by_pair.find({dtype, ttype});
+    if (pair_it != by_pair.end()) {
+        return pair_it->second;
+    }
+    auto dev_it = by_device.find(dtype);
+    if (dev_it != by_device.end()) {
+        return dev_it->second;
+    }
+    auto type_it = by_tasktype.find(ttype);
+    if (type_it != by_tasktype.end()) {
+        return type_it->second;
+    }
+    return default_limit;
+}
+
+void SpeculationTracker::SetBudget(int budget_pct) {
     std::lock_guard<std::mutex> lock(mutex_);
-    failed_history_.push_back(task);
+    budget_pct_ = std::clamp(budget_pct, 0, 100);
 }
 
-void Docker_scheduler::StartSchedulerLoop() {
-    std::call_once(scheduler_loop_once_flag_, []() {
-        std::thread(&Docker_scheduler::SchedulerLoop).detach();
-    });
+bool SpeculationTracker::Enabled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_pct_ > 0;
 }
 
-void Docker_scheduler::SubmitTask(const ImageTask &task, bool high_priority) {
-    task_queue_manager_.PushPending(MakeSingleSubRequest(task), high_priority);
-    StartSchedulerLoop();
+void SpeculationTracker::OnTaskDispatched() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dispatched_++;
 }
 
-void Docker_scheduler::SubmitSubRequest(const SubRequest &sub_req, bool high_priority) {
-    task_queue_manager_.PushPending(sub_req, high_priority);
-    StartSchedulerLoop();
+bool SpeculationTracker::IsSpeculated(const std::string &task_id) const {
+    const std::string stem = NormalizedStem(task_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return copies_.count(stem) > 0;
 }
 
-void Docker_scheduler::SubmitClientRequest(const ClientRequest &req) {
-    auto sub_reqs = AllocateSubRequests(req);
-    for (const auto &sub_req : sub_reqs) {
-        task_queue_manager_.PushPending(sub_req, false);
+bool SpeculationTracker::TryLaunch(const ImageTask &task, const DeviceID &primary, const DeviceID &backup) {
+    const std::string stem = NormalizedStem(task.task_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_pct_ <= 0 || stem.empty() || copies_.count(stem) > 0) {
+        return false;
     }
-    StartSchedulerLoop();
+    // copies stay within budget_pct_ percent of the tasks dispatched so far
+    if ((launched_ + 1) * 100 > static_cast<uint64_t>(budget_pct_) * dispatched_) {
+        return false;
+    }
+    Copy copy;
+    copy.primary = primary;
+    copy.backup = backup;
+    copy.dispatch_time_ms = task.dispatch_time_ms;
+    copy.launch_ms = NowMs();
+    copy.generation = ++launched_;
+    copies_.emplace(stem, copy);
+    return true;
 }
 
-bool Docker_scheduler::CompleteTask(const std::string &task_id) {
+void SpeculationTracker::Abandon(const std::string &task_id) {
+    const std::string stem = NormalizedStem(task_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = copies_.find(stem);
+    if (it != copies_.end() && !it->second.completed && !it->second.winner.has_value()) {
+        copies_.erase(it);
+        abandoned_++;
+    }
+}
+
+void SpeculationTracker::Drop(const std::string &task_id) {
+    const std::string stem = NormalizedStem(task_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (copies_.erase(stem) > 0) {
+        dropped_++;
+    }
+}
+
+void SpeculationTracker::ExpireCopies(int64_t now_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = copies_.begin(); it != copies_.end();) {
+        if (now_ms - it->second.launch_ms >= kCopyTtlMs) {
+            it = copies_.erase(it);
+            expired_++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool SpeculationTracker::ClaimResult(const std::string &reported_task_id, const std::optional<DeviceID> &reporter) {
+    const std::string stem = NormalizedStem(reported_task_id);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = copies_.find(stem);
+    if (it == copies_.end() || !reporter.has_value()) {
+        // not speculated, or a reporter we cannot tell apart: deliver rather than lose the result
+        return true;
+    }
+    Copy &copy = it->second;
+    if (!copy.winner.has_value()) {
+        copy.winner = *reporter;
+        if (*reporter == copy.backup) {
+            backup_won_++;
+        } else {
+            primary_won_++;
+        }
+        return true;
+    }
+    if (*copy.winner == *reporter) {
+        return true;
+    }
+
+    suppressed_++;
+    if (*reporter == copy.primary) {
+        // the primary's own finish time is what the request would have seen without the copy
+        copy.primary_result_ms = NowMs();
+        if (copy.sample_seq != 0 && samples_seq_ - (copy.sample_seq - 1) <= kWindow) {
+            Sample &sample = samples_[copy.sample];
+            sample.without_spec_ms = std::max(sample.actual_ms, static_cast<double>(copy.primary_result_ms - copy.dispatch_time_ms));
+        }
+    }
+    if (copy.completed) {
+        copies_.erase(it);
+    }
+    return false;
+}
+
+std::optional<DeviceID> SpeculationTracker::OnTaskCompleted(const std::string &reported_task_id, int64_t dispatch_time_ms) {
+    const std::string stem = NormalizedStem(reported_task_id);
+    const double latency_ms = dispatch_time_ms > 0 ? static_cast<double>(std::max<int64_t>(0, NowMs() - dispatch_time_ms)) : -1.0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = copies_.find(stem);
+    if (it == copies_.end()) {
+        if (latency_ms >= 0.0) {
+            AddSample(nullptr, latency_ms);
+        }
+        return std::nullopt;
+    }
+    Copy &copy = it->second;
+    if (!copy.completed) {
+        copy.completed = true;
+        if (latency_ms >= 0.0) {
+            AddSample(&copy, latency_ms);
+        }
+        // kept a while so the losing copy's late result is still recognised and dropped; an entry whose copy
+        // is already gone (claimed, dropped, expired) must not take a later copy of the same stem with it
+        resolved_.emplace_back(stem, copy.generation);
+        while (resolved_.size() > kMaxResolved) {
+            auto old = copies_.find(resolved_.front().first);
+            if (old != copies_.end() && old->second.generation == resolved_.front().second) {
+                copies_.erase(old);
+            }
+            resolved_.pop_front();
+        }
+    }
+    return copy.winner;
+}
+
+void SpeculationTracker::AddSample(Copy *copy, double latency_ms) {
+    Sample sample{latency_ms, latency_ms};
+    if (copy != nullptr && copy->primary_result_ms > 0) {
+        sample.without_spec_ms = std::max(latency_ms, static_cast<double>(copy->primary_result_ms - copy->dispatch_time_ms));
+    }
+    const size_t slot = static_cast<size_t>(samples_seq_ % kWindow);
+    if (samples_.size() < kWindow) {
+        samples_.push_back(sample);
+    } else {
+        samples_[slot] = sample;
+    }
+    if (copy != nullptr) {
+        copy->sample = slot;
+        copy->sample_seq = samples_seq_ + 1;
+    }
+    samples_seq_++;
+}
+
+json SpeculationTracker::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t outstanding = 0;
+    for (const auto &[_, copy] : copies_) {
+        outstanding += copy.completed ? 0 : 1;
+    }
+    json out = {{"budget_pct", budget_pct_},
+                {"dispatched_tasks", dispatched_},
+                {"launched", launched_},
+                {"abandoned", abandoned_},
+                {"backup_won", backup_won_},
+                {"primary_won", primary_won_},
+                {"suppressed_results", suppressed_},
+                {"dropped", dropped_},
+                {"expired", expired_},
+                {"outstanding", outstanding},
+                {"window", samples_.size()}};
+    if (!samples_.empty()) {
+        std::vector<double> actual;
+        std::vector<double> without;
+        actual.reserve(samples_.size());
+        without.reserve(samples_.size());
+        for (const auto &sample : samples_) {
+            actual.push_back(sample.actual_ms);
+            without.push_back(sample.without_spec_ms);
+        }
+        const size_t k = std::min(samples_.size() - 1, samples_.size() * 99 / 100);
+        std::nth_element(actual.begin(), actual.begin() + static_cast<std::ptrdiff_t>(k), actual.end());
+        std::nth_element(without.begin(), without.begin() + static_cast<std::ptrdiff_t>(k), without.end());
+        out["p99_ms"] = actual[k];
+        out["p99_without_speculation_ms"] = without[k];
+        out["p99_saved_ms"] = without[k] - actual[k];
+    }
+    return out;
+}
+
+void TaskQueueManager::SetFlowWeights(const std::unordered_map<std::string, int> &client_weights,
+                                      const std::unordered_map<TaskType, int> &tasktype_weights) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    client_weights_ = client_weights;
+    tasktype_weights_ = tasktype_weights;
+}
+
+int TaskQueueManager::FlowWeight(const SubRequest &sub_req) const {
+    int weight = 1;
+    auto client_it = client_weights_.find(sub_req.client_ip);
+    if (client_it != client_weights_.end()) {
+        weight *= client_it->second;
+    }
+    auto type_it = tasktype_weights_.find(sub_req.task_type);
+    if (type_it != tasktype_weights_.end()) {
+        weight *= type_it->second;
+    }
+    return std::max(1, weight);
+}
+
+json TaskQueueManager::BuildQueueStats() {
+    struct FlowRow {
+        std::string client_ip;
+        TaskType task_type{TaskType::Unknown};
+        int weight{1};
+        size_t pending_sub_reqs{0};
+        size_t device_sub_reqs{0};
+        size_t queued_tasks{0};
+        int64_t oldest_enqueue_ms{0};
+        FlowStats dispatched; // dequeued by device workers: submit -> dispatch start
+    };
+    std::map<std::string, FlowRow> rows;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto visit = [&rows](const std::string &key, const FairQueue::Flow &flow, bool device_stage) {
+        FlowRow &row = rows[key];
+        row.client_ip = flow.client_ip;
+        row.task_type = flow.task_type;
+        row.weight = flow.weight;
+        row.queued_tasks += flow.queued_tasks;
+        (device_stage ? row.device_sub_reqs : row.pending_sub_reqs) += flow.queue.size();
+        flow.queue.ForEach([&row](const SubRequest &sub_req) {
+            if (sub_req.enqueue_time_ms > 0 &&
+                (row.oldest_enqueue_ms == 0 || sub_req.enqueue_time_ms < row.oldest_enqueue_ms)) {
+                row.oldest_enqueue_ms = sub_req.enqueue_time_ms;
+            }
+        });
+        if (device_stage) {
+            row.dispatched.enqueued_tasks += flow.stats.enqueued_tasks;
+            row.dispatched.dequeued_sub_reqs += flow.stats.dequeued_sub_reqs;
+            row.dispatched.dequeued_tasks += flow.stats.dequeued_tasks;
+            row.dispatched.total_wait_ms += flow.stats.total_wait_ms;
+            row.dispatched.max_wait_ms = std::max(row.dispatched.max_wait_ms, flow.stats.max_wait_ms);
+        }
+    };
+    pending_queue_.ForEachFlow([&visit](const std::string &key, const FairQueue::Flow &flow) { visit(key, flow, false); });
+    for (const auto &pair : device_queues_) {
+        pair.second.queue.ForEachFlow([&visit](const std::string &key, const FairQueue::Flow &flow) { visit(key, flow, true); });
+    }
+
+    const int64_t now_ms = NowMs();
+    json flows = json::array();
+    for (const auto &pair : rows) {
+        const FlowRow &row = pair.second;
+        json flow;
+        flow["client_ip"] = row.client_ip;
+        flow["tasktype"] = fmt::format("{}", row.task_type);
+        flow["weight"] = row.weight;
+        flow["pending_sub_reqs"] = row.pending_sub_reqs;
+        flow["device_sub_reqs"] = row.device_sub_reqs;
+        flow["queued_tasks"] = row.queued_tasks;
+        flow["oldest_wait_ms"] = row.oldest_enqueue_ms > 0 ? now_ms - row.oldest_enqueue_ms : 0;
+        flow["enqueued_tasks"] = row.dispatched.enqueued_tasks;
+        flow["dispatched_sub_reqs"] = row.dispatched.dequeued_sub_reqs;
+        flow["dispatched_tasks"] = row.dispatched.dequeued_tasks;
+        flow["avg_wait_ms"] = row.dispatched.dequeued_sub_reqs > 0
+                                  ? row.dispatched.total_wait_ms / static_cast<int64_t>(row.dispatched.dequeued_sub_reqs)
+                                  : 0;
+        flow["max_wait_ms"] = row.dispatched.max_wait_ms;
+        flows.push_back(flow);
+    }
+    json out;
+    out["flows"] = flows;
+    return out;
+}
+
+void TaskQueueManager::SetMaxQueueWait(int64_t max_wait_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_queue_wait_ms_ = std::max<int64_t>(0, max_wait_ms);
+}
+
+int64_t TaskQueueManager::QueueKey(const SubRequest &sub_req) const {
+    const int64_t enqueue_ms = sub_req.enqueue_time_ms > 0 ? sub_req.enqueue_time_ms : NowMs();
+    const int64_t aged = enqueue_ms + max_queue_wait_ms_;
+    if (sub_req.expected_end_time_ms > 0) {
+        return std::min(sub_req.expected_end_time_ms, aged);
+    }
+    return aged;
+}
+
+std::optional<SubRequest> TaskQueueManager::PopPending() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_cv_.wait(lock, [this]() { return !pending_queue_.empty(); });
+    return pending_queue_.Pop();
+}
+
+void TaskQueueManager::PushPending(const SubRequest &sub_req, bool high_priority) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_queue_.Push(sub_req, QueueKey(sub_req), FlowWeight(sub_req), high_priority);
+    }
+    pending_cv_.notify_one();
+}
+
+void TaskQueueManager::PushDevice(const DeviceID &device_id, const SubRequest &sub_req, bool high_priority) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DeviceQueue &dq = device_queues_[device_id];
+    dq.queue.Push(sub_req, QueueKey(sub_req), FlowWeight(sub_req), high_priority);
+    dq.cv.notify_one();
+}
+
+std::optional<SubRequest> TaskQueueManager::PopDevice(const DeviceID &device_id, const CreditLimitFn &credit_limit) {
+    SubRequest sub_req;
+    bool cut = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        DeviceQueue &dq = device_queues_[device_id];
+        auto has_credit = [this, &device_id, &credit_limit](TaskType ttype) {
+            return HasCredit(device_id, credit_limit, ttype);
+        };
+        dq.cv.wait(lock, [&dq, &has_credit]() { return !dq.queue.empty() && dq.queue.HasEligible(has_credit); });
+        sub_req = PopWithCredits(dq, device_id, credit_limit, cut);
+    }
+    if (cut) {
+        Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(sub_req);
+    }
+    return sub_req;
+}
+
+std::optional<SubRequest> TaskQueueManager::PopDevice(const DeviceID &device_id, std::chrono::milliseconds wait,
+                                                      const CreditLimitFn &credit_limit) {
+    SubRequest sub_req;
+    bool cut = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        DeviceQueue &dq = device_queues_[device_id];
+        auto has_credit = [this, &device_id, &credit_limit](TaskType ttype) {
+            return HasCredit(device_id, credit_limit, ttype);
+        };
+        if (!dq.cv.wait_for(lock, wait, [&dq, &has_credit]() {
+                return !dq.queue.empty() && dq.queue.HasEligible(has_credit);
+            })) {
+            return std::nullopt;
+        }
+        sub_req = PopWithCredits(dq, device_id, credit_limit, cut);
+    }
+    if (cut) {
+        Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(sub_req);
+    }
+    return sub_req;
+}
+
+bool TaskQueueManager::HasCredit(const DeviceID &device_id, const CreditLimitFn &credit_limit, TaskType ttype) const {
+    const size_t limit = credit_limit ? credit_limit(ttype) : 0;
+    if (limit == 0) {
+        return true;
+    }
+    auto dev_it = credits_.find(device_id);
+    if (dev_it == credits_.end()) {
+        return true;
+    }
+    auto it = dev_it->second.usage.find(ttype);
+    return it == dev_it->second.usage.end() || it->second.used() < limit;
+}
+
+SubRequest TaskQueueManager::PopWithCredits(DeviceQueue &dq, const DeviceID &device_id,
+                                            const CreditLimitFn &credit_limit, bool &cut) {
+    auto has_credit = [this, &device_id, &credit_limit](TaskType ttype) {
+        return HasCredit(device_id, credit_limit, ttype);
+    };
+    SubRequest sub_req = dq.queue.Pop(has_credit);
+    DeviceCredits &credits = credits_[device_id];
+    CreditUsage &usage = credits.usage[sub_req.task_type];
+    const size_t limit = credit_limit ? credit_limit(sub_req.task_type) : 0;
+    cut = false;
+    if (limit > 0 && sub_req.tasks.size() > limit - usage.used()) {
+        // only as many tasks as the device has credit for leave the master; the tail keeps its
+        // sub_req_id and place in the queue, where stealing and rerouting can still reach it
+        const size_t grant = limit - usage.used();
+        SubRequest tail = sub_req;
+        tail.tasks.erase(tail.tasks.begin(), tail.tasks.begin() + static_cast<std::ptrdiff_t>(grant));
+        tail.sub_req_count = static_cast<int>(tail.tasks.size());
+        sub_req.tasks.resize(grant);
+        sub_req.sub_req_id = fmt::format("{}_c{}", tail.sub_req_id, ++credit_seq_);
+        sub_req.sub_req_count = static_cast<int>(grant);
+        for (auto &task : sub_req.tasks) {
+            task.sub_req_id = sub_req.sub_req_id;
+        }
+        credits.deferred_tasks += tail.tasks.size();
+        const int64_t key = QueueKey(tail);
+        const int weight = FlowWeight(tail);
+        dq.queue.Unpop(std::move(tail), key, weight);
+        cut = true;
+    }
+    usage.uploading += sub_req.tasks.size();
+    return sub_req;
+}
+
+void TaskQueueManager::ReleaseCredits(const DeviceID &device_id, TaskType ttype, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CreditUsage &usage = credits_[device_id].usage[ttype];
+    usage.uploading -= std::min(usage.uploading, count);
+    auto dq_it = device_queues_.find(device_id);
+    if (dq_it != device_queues_.end()) {
+        dq_it->second.cv.notify_all();
+    }
+}
+
+void TaskQueueManager::ReleaseRunningCredit(const DeviceID &device_id, TaskType ttype) {
+    auto dev_it = credits_.find(device_id);
+    if (dev_it == credits_.end()) {
+        return;
+    }
+    CreditUsage &usage = dev_it->second.usage[ttype];
+    if (usage.running > 0) {
+        usage.running--;
+    }
+    auto dq_it = device_queues_.find(device_id);
+    if (dq_it != device_queues_.end()) {
+        dq_it->second.cv.notify_all();
+    }
+}
+
+DeviceCredits TaskQueueManager::GetDeviceCredits(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = credits_.find(device_id);
+    return it == credits_.end() ? DeviceCredits{} : it->second;
+}
+
+std::optional<SubRequest> TaskQueueManager::StealFor(const DeviceID &thief, const std::string &thief_ip,
+                                                     const std::function<bool(TaskType)> &can_run,
+                                                     const CreditLimitFn &credit_limit) {
+    std::optional<SubRequest> stolen;
+    SubRequest kept;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // an empty dispatch queue alone does not make a device idle: its uploading and running tasks count too,
+        // and only a victim at least kStealMinGap tasks heavier is worth moving work away from
+        const size_t thief_backlog = BacklogLocked(thief);
+        // most backlogged victim first: that is the device whose tail would finish last
+        std::vector<std::pair<size_t, DeviceID>> victims;
+        for (auto &[device_id, dq] : device_queues_) {
+            if (device_id == thief || dq.queue.empty()) {
+                continue;
+            }
+            const size_t backlog = BacklogLocked(device_id);
+            if (backlog >= thief_backlog + kStealMinGap) {
+                victims.emplace_back(backlog, device_id);
+            }
+        }
+        std::sort(victims.begin(), victims.end(),
+                  [](const auto &a, const auto &b) { return a.first > b.first; });
+        DeviceID victim_id{};
+        size_t victim_backlog = 0;
+        auto can_take = [this, &thief, &can_run, &credit_limit](TaskType ttype) {
+            return can_run(ttype) && HasCredit(thief, credit_limit, ttype);
+        };
+        for (const auto &[backlog, device_id] : victims) {
+            stolen = device_queues_[device_id].queue.StealBack(can_take);
+            if (stolen.has_value()) {
+                victim_id = device_id;
+                victim_backlog = backlog;
+                break;
+            }
+        }
+        if (!stolen.has_value()) {
+            return std::nullopt;
+        }
+
+        DeviceQueue &victim = device_queues_[victim_id];
+        const size_t total = stolen->tasks.size();
+        CreditUsage &usage = credits_[thief].usage[stolen->task_type];
+        const size_t limit = credit_limit ? credit_limit(stolen->task_type) : 0;
+        size_t keep = total / 2;
+        // at most half the gap moves, so the thief never ends up heavier than the victim and the two
+        // cannot steal the same work back and forth
+        const size_t max_move = std::max<size_t>(1, (victim_backlog - thief_backlog) / 2);
+        keep = std::max(keep, total - std::min(total, max_move));
+        if (limit > 0) {
+            // never more than the thief has credit for
+            keep = std::max(keep, total - std::min(total, limit - usage.used()));
+        }
+        if (keep > 0) {
+            // the victim keeps the front half under its own sub_req_id, the thief gets the rest as a new one
+            kept = *stolen;
+            kept.tasks.resize(keep);
+            kept.sub_req_count = static_cast<int>(keep);
+            stolen->tasks.erase(stolen->tasks.begin(), stolen->tasks.begin() + static_cast<std::ptrdiff_t>(keep));
+            stolen->sub_req_id = fmt::format("{}_s{}", kept.sub_req_id, ++steal_seq_);
+            stolen->sub_req_count = static_cast<int>(stolen->tasks.size());
+            victim.queue.Push(kept, QueueKey(kept), FlowWeight(kept), false);
+            victim.cv.notify_one();
+        }
+        stolen->dst_device_id = thief;
+        stolen->dst_device_ip = thief_ip;
+        for (auto &task : stolen->tasks) {
+            task.sub_req_id = stolen->sub_req_id;
+        }
+        usage.uploading += stolen->tasks.size();
+        steal_stats_[victim_id].given_tasks += stolen->tasks.size();
+        StealStats &stats = steal_stats_[thief];
+        stats.stolen_sub_reqs++;
+        stats.stolen_tasks += stolen->tasks.size();
+        spdlog::info("Device {} stole {}/{} tasks of sub_req {} from device {}", thief_ip, stolen->tasks.size(), total,
+                     kept.tasks.empty() ? stolen->sub_req_id : kept.sub_req_id, boost::uuids::to_string(victim_id));
+    }
+    if (!kept.tasks.empty()) {
+        Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(kept);
+    }
+    Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(*stolen);
+    return stolen;
+}
+
+size_t TaskQueueManager::BacklogLocked(const DeviceID &device_id) const {
+    size_t backlog = 0;
+    auto queue_it = device_queues_.find(device_id);
+    if (queue_it != device_queues_.end()) {
+        backlog += queue_it->second.queue.queued_tasks();
+    }
+    auto running_it = running_index_.find(device_id);
+    if (running_it != running_index_.end()) {
+        backlog += running_it->second.size();
+    }
+    auto credit_it = credits_.find(device_id);
+    if (credit_it != credits_.end()) {
+        for (const auto &[_, usage] : credit_it->second.usage) {
+            backlog += usage.uploading;
+        }
+    }
+    return backlog;
+}
+
+StealStats TaskQueueManager::GetStealStats(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = steal_stats_.find(device_id);
+    return it == steal_stats_.end() ? StealStats{} : it->second;
+}
+
+size_t TaskQueueManager::GetDeviceQueueDepth(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = device_queues_.find(device_id);
+    return it == device_queues_.end() ? 0 : it->second.queue.size();
+}
+
+size_t TaskQueueManager::GetDeviceBacklog(const DeviceID &device_id) {
+    return GetDeviceInflight(device_id).outstanding();
+}
+
+DeviceInflight TaskQueueManager::GetDeviceInflight(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return InflightLocked(device_id);
+}
+
+void TaskQueueManager::GetDevicesInflight(const std::vector<DeviceID> &ids, std::vector<DeviceInflight> &out) {
+    out.resize(ids.size());
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        out[i] = InflightLocked(ids[i]);
+    }
+}
+
+DeviceInflight TaskQueueManager::InflightLocked(const DeviceID &device_id) const {
+    DeviceInflight out;
+    auto inflight_it = inflight_.find(device_id);
+    if (inflight_it != inflight_.end()) {
+        out = inflight_it->second;
+    }
+    auto queue_it = device_queues_.find(device_id);
+    if (queue_it != device_queues_.end()) {
+        out.queued_tasks = queue_it->second.queue.queued_tasks();
+    }
+    // a popped sub-request left the queue but reaches running_index_ only once its upload returns
+    auto credit_it = credits_.find(device_id);
+    if (credit_it != credits_.end()) {
+        for (const auto &entry : credit_it->second.usage) {
+            out.uploading_tasks += entry.second.uploading;
+        }
+    }
+    auto running_it = running_index_.find(device_id);
+    if (running_it != running_index_.end()) {
+        out.running_tasks = running_it->second.size();
+    }
+    return out;
+}
+
+void TaskQueueManager::OnTelemetrySample(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = inflight_.find(device_id);
+    if (it != inflight_.end()) {
+        it->second.since_sample = 0;
+    }
+}
+
+void TaskQueueManager::ReleaseInflight(const DeviceID &device_id, const ImageTask &task) {
+    DeviceInflight &inflight = inflight_[device_id];
+    inflight.running_bytes -= std::min(inflight.running_bytes, task.payload_bytes);
+    if (inflight.since_sample > 0) {
+        inflight.since_sample--;
+    }
+}
+
+void TaskQueueManager::IndexRunningTask(const DeviceID &device_id, std::list<ImageTask>::iterator it) {
+    running_by_id_[it->task_id] = RunningEntry{device_id, it};
+    credits_[device_id].usage[it->task_type].running++;
+    const std::string stem = NormalizedStem(it->task_id);
+    if (!stem.empty()) {
+        running_by_stem_.emplace(stem, it->task_id);
+    }
+}
+
+void TaskQueueManager::UnindexRunningTask(const ImageTask &task) {
+    auto id_it = running_by_id_.find(task.task_id);
+    if (id_it != running_by_id_.end()) {
+        if (id_it->second.holds_credit) {
+            ReleaseRunningCredit(id_it->second.device_id, task.task_type);
+        }
+        running_by_id_.erase(id_it);
+    }
+    auto range = running_by_stem_.equal_range(NormalizedStem(task.task_id));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == task.task_id) {
+            running_by_stem_.erase(it);
+            break;
+        }
+    }
+}
+
+void TaskQueueManager::DropBackupLocked(const std::string &task_id) {
+    auto it = backups_by_stem_.find(NormalizedStem(task_id));
+    if (it == backups_by_stem_.end()) {
+        return;
+    }
+    const RunningEntry entry = it->second;
+    backups_by_stem_.erase(it);
+    if (entry.holds_credit) {
+        ReleaseRunningCredit(entry.device_id, entry.it->task_type);
+    }
+    ReleaseInflight(entry.device_id, *entry.it);
+    running_index_[entry.device_id].erase(entry.it);
+}
+
+bool TaskQueueManager::AddRunningTask(const DeviceID &device_id, const ImageTask &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (task.speculative) {
+        // a backup copy shares the primary's task id: the primary's entry keeps tracking the task, the copy
+        // only occupies its own device (backlog, credit, unsampled load) and is not counted as dispatched
+        DropBackupLocked(task.task_id);
+        auto &task_list = running_index_[device_id];
+        const size_t ahead = task_list.size();
+        auto it = task_list.insert(task_list.end(), task);
+        it->status = TaskStatus::RUNNING;
+        it->dispatch_time_ms = NowMs();
+        it->dispatch_ahead = ahead;
+        backups_by_stem_[NormalizedStem(task.task_id)] = RunningEntry{device_id, it};
+        credits_[device_id].usage[task.task_type].running++;
+        DeviceInflight &inflight = inflight_[device_id];
+        inflight.running_bytes += task.payload_bytes;
+        inflight.since_sample++;
+        return true;
+    }
+    // a task id is running on at most one device; a re-dispatch replaces the stale entry
+    auto existing = running_by_id_.find(task.task_id);
+    if (existing != running_by_id_.end()) {
+        RunningEntry entry = existing->second;
+        UnindexRunningTask(*entry.it);
+        ReleaseInflight(entry.device_id, *entry.it);
+        running_index_[entry.device_id].erase(entry.it);
+    }
+    auto &task_list = running_index_[device_id];
+    const size_t ahead = task_list.size();
+    auto it = task_list.insert(task_list.end(), task);
+    it->status = TaskStatus::RUNNING;
+    it->dispatch_time_ms = NowMs();
+    it->dispatch_ahead = ahead;
+    IndexRunningTask(device_id, it);
+    DeviceInflight &inflight = inflight_[device_id];
+    inflight.running_bytes += task.payload_bytes;
+    inflight.since_sample++;
+    Docker_scheduler::GetRequestTracker().OnTaskRunning(task.task_id);
+    Docker_scheduler::GetSpeculation().OnTaskDispatched();
+    return true;
+}
+
+std::optional<ImageTask> TaskQueueManager::CompleteTaskAndGet(const std::string &reported_task_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // only the copy whose result won reports completion, so either way the backup is done
+    DropBackupLocked(reported_task_id);
+
+    // exact task_id first, then the stem (slaves may report "a.json" for task "a.jpg")
+    auto id_it = running_by_id_.find(reported_task_id);
+    if (id_it == running_by_id_.end()) {
+        const std::string reported_stem = NormalizedStem(reported_task_id);
+        if (reported_stem.empty()) {
+            return std::nullopt;
+        }
+        auto stem_it = running_by_stem_.find(reported_stem);
+        if (stem_it == running_by_stem_.end()) {
+            return std::nullopt;
+        }
+        id_it = running_by_id_.find(stem_it->second);
+        if (id_it == running_by_id_.end()) {
+            return std::nullopt;
+        }
+    }
+
+    RunningEntry entry = id_it->second;
+    ImageTask completed = std::move(*entry.it);
+    UnindexRunningTask(completed);
+    ReleaseInflight(entry.device_id, completed);
+    running_index_[entry.device_id].erase(entry.it);
+    Docker_scheduler::GetRequestTracker().OnTaskSent(reported_task_id);
+    const auto winner = Docker_scheduler::GetSpeculation().OnTaskCompleted(reported_task_id, completed.dispatch_time_ms);
+    // a backup's win says nothing about the primary device's service time
+    if (completed.dispatch_time_ms > 0 && (!winner.has_value() || *winner == entry.device_id)) {
+        Docker_scheduler::GetServiceTimes().Record(completed.task_type, entry.device_id,
+                                                   static_cast<double>(NowMs() - completed.dispatch_time_ms),
+                                                   completed.dispatch_ahead);
+    }
+    return completed;
+}
+
+bool TaskQueueManager::CompleteTask(const std::string &task_id) {
+    return CompleteTaskAndGet(task_id).has_value();
+}
+
+std::vector<std::string> TaskQueueManager::GetPendingSubReqIds() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> out;
+    out.reserve(pending_queue_.size());
+    auto collect = [&out](const SubRequest &sub_req) { out.push_back(sub_req.sub_req_id); };
+    pending_queue_.ForEach(collect);
+    for (const auto &pair : device_queues_) {
+        pair.second.queue.ForEach(collect);
+    }
+    return out;
+}
+
+void TaskQueueManager::RecoverTasks(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // sub-requests still waiting for this device's workers go back to the router untouched
+    auto dq_it = device_queues_.find(device_id);
+    if (dq_it != device_queues_.end()) {
+        for (auto &sub_req : dq_it->second.queue.Drain()) {
+            if (sub_req.speculative) {
+                for (const auto &task : sub_req.tasks) {
+                    Docker_scheduler::GetSpeculation().Abandon(task.task_id);
+                }
+                continue;
+            }
+            sub_req.dst_device_id = boost::uuids::nil_uuid();
+            sub_req.dst_device_ip.clear();
+            const int64_t key = QueueKey(sub_req);
+            const int weight = FlowWeight(sub_req);
+            pending_queue_.Push(std::move(sub_req), key, weight, true);
+        }
+    }
+    auto it = running_index_.find(device_id);
+    if (it != running_index_.end()) {
+        auto &tasks = it->second;
+        for (auto &task : tasks) {
+            if (task.speculative) {
+                // the backup copy is lost with its device, the primary keeps running elsewhere
+                auto backup_it = backups_by_stem_.find(NormalizedStem(task.task_id));
+                if (backup_it != backups_by_stem_.end() && backup_it->second.device_id == device_id) {
+                    backups_by_stem_.erase(backup_it);
+                }
+                Docker_scheduler::GetSpeculation().Abandon(task.task_id);
+                continue;
+            }
+            UnindexRunningTask(task);
+            task.retry_count += 1;
+            task.status = TaskStatus::PENDING;
+            if (task.retry_count <= kMaxTaskRetries) {
+                SubRequest retry = MakeSingleSubRequest(task);
+                Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(retry);
+                pending_queue_.Push(retry, QueueKey(retry), FlowWeight(retry), true);
+            } else {
+                RecordFailed(task);
+            }
+        }
+        running_index_.erase(it);
+    }
+    // nothing is in flight on the lost device any more; uploads still finishing release into zero
+    auto credit_it = credits_.find(device_id);
+    if (credit_it != credits_.end()) {
+        credit_it->second.usage.clear();
+    }
+    inflight_.erase(device_id);
+    pending_cv_.notify_all();
+}
+
+void TaskQueueManager::MoveToFailed(const ImageTask &task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RecordFailed(task);
+}
+
+void TaskQueueManager::RecordFailed(const ImageTask &task) {
+    spdlog::error("Task {} failed, retry_count={}", task.task_id, task.retry_count);
+    DropBackupLocked(task.task_id);
+    Docker_scheduler::GetSpeculation().Drop(task.task_id);
+    failed_history_.push_back(task);
+    while (failed_history_.size() > kMaxFailedHistory) {
+        failed_history_.pop_front();
+    }
+    Docker_scheduler::GetRequestTracker().OnTaskFailed(task.task_id);
+}
+
+void Docker_scheduler::StartSchedulerLoop() {
+    std::call_once(scheduler_loop_once_flag_, []() {
+        std::thread(&Docker_scheduler::SchedulerLoop).detach();
+        std::thread(&Docker_scheduler::RunningTasksLoop).detach();
+    });
+}
+
+void Docker_scheduler::SubmitTask(const ImageTask &task, bool high_priority) {
+    task_queue_manager_.PushPending(MakeSingleSubRequest(task), high_priority);
+    StartSchedulerLoop();
+}
+
+void Docker_scheduler::SubmitSubRequest(const SubRequest &sub_req, bool high_priority) {
+    if (sub_req.dst_device_id != boost::uuids::nil_uuid()) {
+        task_queue_manager_.PushDevice(sub_req.dst_device_id, sub_req, high_priority);
+        EnsureDispatchWorkers(sub_req.dst_device_id);
+    } else {
+        task_queue_manager_.PushPending(sub_req, high_priority);
+    }
+    StartSchedulerLoop();
+}
+
+void Docker_scheduler::SubmitClientRequest(const ClientRequest &req) {
+    auto sub_reqs = AllocateSubRequests(req);
+    for (const auto &sub_req : sub_reqs) {
+        task_queue_manager_.PushDevice(sub_req.dst_device_id, sub_req, false);
+        EnsureDispatchWorkers(sub_req.dst_device_id);
+    }
+    StartSchedulerLoop();
+}
+
+void Docker_scheduler::SetDispatchWorkersPerDevice(int workers) {
+    std::lock_guard<std::mutex> lock(dispatch_workers_mutex_);
+    dispatch_workers_per_device_ = std::max(1, workers);
+}
+
+void Docker_scheduler::SetBatchUpload(bool enabled) {
+    batch_upload_ = enabled;
+}
+
+void Docker_scheduler::SetMaxQueueWait(int64_t max_wait_ms) {
+    task_queue_manager_.SetMaxQueueWait(max_wait_ms);
+}
+
+void Docker_scheduler::SetMaxSubRequestTasks(int max_tasks) {
+    max_sub_req_tasks_ = max_tasks;
+}
+
+void Docker_scheduler::SetSampleChoices(int choices) {
+    sample_choices_ = std::max(0, choices);
+}
+
+void Docker_scheduler::SetSpeculationBudget(int budget_pct) {
+    speculation_.SetBudget(budget_pct);
+}
+
+void Docker_scheduler::SetStealIdleMs(int idle_ms) {
+    steal_idle_ms_ = std::max(0, idle_ms);
+}
+
+void Docker_scheduler::SetCreditLimits(const CreditLimits &limits) {
+    credit_limits_ = limits;
+}
+
+void Docker_scheduler::SetTelemetryDeadlineMs(int deadline_ms) {
+    telemetry_.SetDeadlineMs(deadline_ms);
+}
+
+void Docker_scheduler::SetTelemetryUdpPort(int port) {
+    telemetry_udp_port_ = std::max(0, port);
+}
+
+void Docker_scheduler::SetFlowWeights(const std::unordered_map<std::string, int> &client_weights,
+                                      const std::unordered_map<TaskType, int> &tasktype_weights) {
+    task_queue_manager_.SetFlowWeights(client_weights, tasktype_weights);
+}
+
+json Docker_scheduler::BuildQueueSnapshot() {
+    return task_queue_manager_.BuildQueueStats();
+}
+
+void Docker_scheduler::EnsureDispatchWorkers(const DeviceID &device_id) {
+    std::lock_guard<std::mutex> lock(dispatch_workers_mutex_);
+    if (!dispatch_workers_.insert(device_id).second) {
+        return;
+    }
+    // workers live as long as the process; a device that reconnects keeps its global_id and its pool
+    for (int i = 0; i < dispatch_workers_per_device_; ++i) {
+        std::thread(&Docker_scheduler::DispatchWorkerLoop, device_id).detach();
+    }
+    spdlog::info("Dispatch workers started for device {} (workers={})",
+                 boost::uuids::to_string(device_id), dispatch_workers_per_device_);
+}
+
+void Docker_scheduler::RequeueTask(ImageTask &task) {
+    if (task.speculative) {
+        // the primary copy is still running, a failed backup is simply not retried
+        speculation_.Abandon(task.task_id);
+        return;
+    }
+    task.retry_count++;
+    if (task.retry_count <= kMaxTaskRetries) {
+        SubRequest retry = MakeSingleSubRequest(task);
+        request_tracker_.OnSubRequestAllocated(retry);
+        task_queue_manager_.PushPending(retry, true);
+    } else {
+        task_queue_manager_.MoveToFailed(task);
+    }
+}
+
+std::shared_ptr<MappedFile> Docker_scheduler::OpenTaskFile(const ImageTask &task) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(task.file_path)) {
+        spdlog::error("Failed to open task file: {}", task.file_path);
+        return nullptr;
+    }
+    return file;
+}
+
+void Docker_scheduler::RecordPayload(const DeviceID &device_id, const MappedFile &file) {
+    std::lock_guard<std::mutex> lock(payload_stats_mutex_);
+    PayloadStats &stats = payload_stats_[device_id];
+    stats.tasks++;
+    stats.bytes_sent += file.size();
+    stats.bytes_copied += file.bytes_copied();
+    if (!file.mapped() && file.size() > 0) {
+        stats.mmap_fallbacks++;
+    }
+}
+
+bool Docker_scheduler::CompleteTask(const std::string &task_id) {
     return task_queue_manager_.CompleteTask(task_id);
 }
 
@@ -638,8 +1786,10 @@ json Docker_scheduler::BuildNodesSnapshot() {
     }
     auto sub_reqs_by_device = request_tracker_.BuildDeviceSubReqs(pending_ids);
 
-    std::shared_lock<std::shared_mutex> lock(devs_mutex);
-    for (const auto &pair : device_static_info) {
+    const ClusterStatePtr state = GetClusterState();
+    out["cluster_version"] = state->version;
+    out["speculation"] = speculation_.Stats();
+    for (const auto &pair : state->devices) {
         const DeviceID &dev_id = pair.first;
         const Device &dev = pair.second;
         json node;
@@ -648,8 +1798,8 @@ json Docker_scheduler::BuildNodesSnapshot() {
         node["device_type"] = to_string(nlohmann::json(dev.type));
 
         json services = json::array();
-        auto svc_it = device_active_services.find(dev_id);
-        if (svc_it != device_active_services.end()) {
+        auto svc_it = state->active_services.find(dev_id);
+        if (svc_it != state->active_services.end()) {
             for (const auto &svc : svc_it->second) {
                 services.push_back(to_string(nlohmann::json(svc)));
             }
@@ -657,8 +1807,8 @@ json Docker_scheduler::BuildNodesSnapshot() {
         node["services"] = services;
 
         json metrics;
-        auto status_it = device_status.find(dev_id);
-        if (status_it != device_status.end()) {
+        auto status_it = state->status.find(dev_id);
+        if (status_it != state->status.end()) {
             const auto &status = status_it->second;
             metrics["cpu_used"] = status.cpu_used;
             metrics["mem_used"] = status.mem_used;
@@ -675,6 +1825,40 @@ json Docker_scheduler::BuildNodesSnapshot() {
             node["status"] = "offline";
         }
         node["metrics"] = metrics;
+        node["dispatch_queue_depth"] = static_cast<int>(task_queue_manager_.GetDeviceQueueDepth(dev_id));
+        const DeviceInflight inflight = task_queue_manager_.GetDeviceInflight(dev_id);
+        node["backlog_tasks"] = static_cast<int>(inflight.outstanding());
+        node["inflight"] = {{"queued_tasks", inflight.queued_tasks},
+                            {"uploading_tasks", inflight.uploading_tasks},
+                            {"running_tasks", inflight.running_tasks},
+                            {"running_bytes", inflight.running_bytes},
+                            {"since_sample", inflight.since_sample}};
+        node["service_times"] = service_times_.Stats(dev_id);
+        node["telemetry"] = telemetry_.Stats(dev_id);
+        node["telemetry_push"] = telemetry_push_.Stats(dev_id);
+        const StealStats steals = task_queue_manager_.GetStealStats(dev_id);
+        node["work_stealing"] = {{"stolen_sub_reqs", steals.stolen_sub_reqs},
+                                 {"stolen_tasks", steals.stolen_tasks},
+                                 {"given_tasks", steals.given_tasks}};
+        const DeviceCredits credits = task_queue_manager_.GetDeviceCredits(dev_id);
+        json credit_types = json::object();
+        for (const auto &[ttype, usage] : credits.usage) {
+            credit_types[json(ttype).get<std::string>()] = {{"limit", credit_limits_.Limit(dev.type, ttype)},
+                                                            {"uploading", usage.uploading},
+                                                            {"running", usage.running}};
+        }
+        node["credits"] = {{"deferred_tasks", credits.deferred_tasks},
+                           {"expired_credits", credits.expired_credits},
+                           {"tasktypes", credit_types}};
+        node["connection_pool"] = dispatch_pool_.Stats(dev.ip_address, kSlaveRecvPort);
+        {
+            std::lock_guard<std::mutex> stats_lock(payload_stats_mutex_);
+            const PayloadStats &stats = payload_stats_[dev_id];
+            node["payload"] = {{"tasks", stats.tasks},
+                               {"bytes_sent", stats.bytes_sent},
+                               {"bytes_copied", stats.bytes_copied},
+                               {"mmap_fallbacks", stats.mmap_fallbacks}};
+        }
 
         const std::string dev_id_str = boost::uuids::to_string(dev_id);
         auto sub_it = sub_reqs_by_device.find(dev_id_str);
@@ -692,291 +1876,553 @@ json Docker_scheduler::BuildNodesSnapshot() {
 }
 
 std::vector<DeviceID> Docker_scheduler::GetCandidateDeviceIds(TaskType ttype) {
-    std::vector<DeviceID> device_ids;
-    std::shared_lock<std::shared_mutex> lock(devs_mutex);
-    if (ttype != TaskType::Unknown) {
-        for (const auto &pair : device_active_services) {
-            const auto &device_id = pair.first;
-            const auto &services = pair.second;
-            if (device_status.find(device_id) == device_status.end()) {
+    return GetClusterState()->Candidates(ttype);
+}
+
+std::vector<SubRequest> Docker_scheduler::AllocateSubRequests(const ClientRequest &req) {
+    if (req.total_num <= 0 || req.tasks.empty()) {
+        throw std::runtime_error("client request has no tasks to allocate");
+    }
+    if (static_cast<int>(req.tasks.size()) != req.total_num) {
+        throw std::runtime_error("client request total_num does not match tasks size");
+    }
+
+    // one snapshot for the whole split: candidates and loads come from the same cluster version
+    const ClusterStatePtr state = GetClusterState();
+    const auto &candidate_ids = state->Candidates(req.task_type);
+    if (candidate_ids.empty()) {
+        throw std::runtime_error("no candidate devices available for batch scheduling");
+    }
+
+    std::vector<DeviceShare> shares;
+    shares.reserve(candidate_ids.size());
+    for (const auto &device_id : candidate_ids) {
+        auto status_it = state->status.find(device_id);
+        auto dev_it = state->devices.find(device_id);
+        if (status_it == state->status.end() || dev_it == state->devices.end()) {
+            continue;
+        }
+        shares.push_back({device_id, &dev_it->second, &status_it->second, 0});
+    }
+    if (shares.empty()) {
+        throw std::runtime_error("no device status available for batch scheduling");
+    }
+
+    const bool known = SchedulePolicies::Visit(req.schedule_strategy, [&](auto tag) {
+        decltype(tag)::type::Split(*state, req.task_type, req.total_num, shares);
+    });
+    if (!known) {
+        throw std::runtime_error("no scheduling policy for the requested strategy");
+    }
+
+    std::vector<SubRequest> sub_reqs;
+    sub_reqs.reserve(shares.size());
+    size_t task_idx = 0;
+    int sub_idx = 0;
+    for (const auto &share : shares) {
+        // a device's share goes out as sub-requests of at most max_sub_req_tasks_ tasks, so one bulk
+        // request cannot hold a device queue for its whole length while other flows wait
+        const int chunk = max_sub_req_tasks_ > 0 ? max_sub_req_tasks_ : share.count;
+        for (int offset = 0; offset < share.count; offset += chunk) {
+            const int count = std::min(chunk, share.count - offset);
+            SubRequest sub_req;
+            sub_req.req_id = req.req_id;
+            sub_req.client_ip = req.client_ip;
+            sub_req.task_type = req.task_type;
+            sub_req.schedule_strategy = req.schedule_strategy;
+            sub_req.enqueue_time_ms = req.enqueue_time_ms;
+            sub_req.expected_end_time_ms = req.deadline_ms;
+            sub_req.dst_device_id = share.id;
+            sub_req.dst_device_ip = share.device->ip_address;
+            sub_req.sub_req_id = req.req_id + "_" + std::to_string(sub_idx++);
+
+            for (int i = 0; i < count; ++i) {
+                if (task_idx >= req.tasks.size()) {
+                    break;
+                }
+                ImageTask task = req.tasks[task_idx++];
+                if (task.enqueue_time_ms == 0) {
+                    task.enqueue_time_ms = req.enqueue_time_ms;
+                }
+                task.req_id = sub_req.req_id;
+                task.sub_req_id = sub_req.sub_req_id;
+                sub_req.tasks.push_back(task);
+            }
+            sub_req.sub_req_count = static_cast<int>(sub_req.tasks.size());
+            sub_reqs.push_back(sub_req);
+            Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(sub_req);
+        }
+    }
+
+    return sub_reqs;
+}
+
+void Docker_scheduler::SchedulerLoop() {
+    while (true) {
+        auto sub_req_opt = task_queue_manager_.PopPending();
+        if (!sub_req_opt.has_value()) {
+            continue;
+        }
+        SubRequest sub_req = *sub_req_opt;
+
+        Device target_device;
+        bool use_assigned = (sub_req.dst_device_id != boost::uuids::nil_uuid());
+        try {
+            if (use_assigned) {
+                const ClusterStatePtr state = GetClusterState();
+                auto it = state->devices.find(sub_req.dst_device_id);
+                if (it == state->devices.end()) {
+                    throw std::runtime_error("assigned device not found");
+                }
+                target_device = it->second;
+            } else {
+                target_device = ScheduleWith(sub_req.schedule_strategy, sub_req.task_type);
+                sub_req.dst_device_id = target_device.global_id;
+                sub_req.dst_device_ip = target_device.ip_address;
+            }
+
+            {
+                const ClusterStatePtr state = GetClusterState();
+                auto status_it = state->status.find(target_device.global_id);
+                if (status_it != state->status.end()) {
+                    const auto& status = status_it->second;
+                    spdlog::info("SubReq {} selected device {} [CPU: {:.2f}%, MEM: {:.2f}%, XPU: {:.2f}%, Bandwidth: {:.2f}Mbps, Latency: {}ms]",
+                                 sub_req.sub_req_id, target_device.ip_address,
+                                 status.cpu_used * 100, status.mem_used * 100, status.xpu_used * 100,
+                                 status.net_bandwidth, static_cast<int>(status.net_latency * 1000));
+                }
+            }
+        } catch (const std::exception &e) {
+            spdlog::error("Schedule failed for sub_req {}: {}", sub_req.sub_req_id, e.what());
+            for (auto &task : sub_req.tasks) {
+                RequeueTask(task);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        // retries and recovered tasks jump ahead of fresh work on the target device
+        task_queue_manager_.PushDevice(target_device.global_id, sub_req, true);
+        EnsureDispatchWorkers(target_device.global_id);
+    }
+}
+
+void Docker_scheduler::DispatchWorkerLoop(DeviceID device_id) {
+    // in-flight limit of this device per task type; the device type is looked up per call since
+    // the worker outlives reconnects
+    auto credit_limit = [&device_id](TaskType ttype) -> size_t {
+        if (credit_limits_.empty()) {
+            return 0;
+        }
+        const ClusterStatePtr state = GetClusterState();
+        auto it = state->devices.find(device_id);
+        return it == state->devices.end() ? 0 : credit_limits_.Limit(it->second.type, ttype);
+    };
+    while (true) {
+        std::optional<SubRequest> sub_req_opt;
+        if (steal_idle_ms_ > 0) {
+            sub_req_opt = task_queue_manager_.PopDevice(device_id, std::chrono::milliseconds(steal_idle_ms_), credit_limit);
+            if (!sub_req_opt.has_value() && task_queue_manager_.GetDeviceQueueDepth(device_id) == 0) {
+                // own queue stayed empty: take the tail of a slower device's queue instead of idling
+                sub_req_opt = StealWork(device_id, credit_limit);
+            }
+        } else {
+            sub_req_opt = task_queue_manager_.PopDevice(device_id, credit_limit);
+        }
+        if (!sub_req_opt.has_value()) {
+            continue;
+        }
+        SubRequest sub_req = std::move(*sub_req_opt);
+        const size_t credited = sub_req.tasks.size();
+
+        Device target_device;
+        bool online = false;
+        {
+            const ClusterStatePtr state = GetClusterState();
+            auto it = state->devices.find(device_id);
+            if (it != state->devices.end() && state->IsOnline(device_id)) {
+                target_device = it->second;
+                online = true;
+            }
+        }
+        if (!online) {
+            task_queue_manager_.ReleaseCredits(device_id, sub_req.task_type, credited);
+        }
+        if (!online && sub_req.speculative) {
+            for (const auto &task : sub_req.tasks) {
+                speculation_.Abandon(task.task_id);
+            }
+            continue;
+        }
+        if (!online) {
+            // device went away while the sub-request was queued: hand it back to the router
+            spdlog::warn("Device {} offline, reroute sub_req {}", boost::uuids::to_string(device_id), sub_req.sub_req_id);
+            sub_req.dst_device_id = boost::uuids::nil_uuid();
+            sub_req.dst_device_ip.clear();
+            task_queue_manager_.PushPending(sub_req, true);
+            continue;
+        }
+
+        const bool dispatched = DispatchSubRequest(target_device, sub_req);
+        // tasks that were uploaded hold their credit as running from here on
+        task_queue_manager_.ReleaseCredits(device_id, sub_req.task_type, credited);
+        if (!dispatched) {
+            if (sub_req.speculative) {
+                for (const auto &task : sub_req.tasks) {
+                    speculation_.Abandon(task.task_id);
+                }
                 continue;
             }
-            if (std::find(services.begin(), services.end(), ttype) != services.end()) {
-                device_ids.push_back(device_id);
+            // meta handshake failed: each task counts a retry and goes back to the router, so a device
+            // that stays online but keeps rejecting uploads cannot hold a request forever
+            for (auto &task : sub_req.tasks) {
+                RequeueTask(task);
             }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
-        if (device_ids.empty()) {
-            auto it = tdMap.find(ttype);
-            if (it != tdMap.end()) {
-                device_ids.reserve(it->second.size());
-                for (const auto &entry : it->second) {
-                    if (device_status.find(entry.first) != device_status.end()) {
-                        device_ids.push_back(entry.first);
-                    }
-                }
+    }
+}
+
+std::optional<SubRequest> Docker_scheduler::StealWork(const DeviceID &device_id,
+                                                      const TaskQueueManager::CreditLimitFn &credit_limit) {
+    const ClusterStatePtr state = GetClusterState();
+    auto dev_it = state->devices.find(device_id);
+    if (dev_it == state->devices.end() || !state->IsOnline(device_id)) {
+        return std::nullopt;
+    }
+    // only task types this device could have been picked for
+    auto can_run = [&state, &device_id](TaskType ttype) {
+        const auto &candidates = state->Candidates(ttype);
+        return std::find(candidates.begin(), candidates.end(), device_id) != candidates.end();
+    };
+    return task_queue_manager_.StealFor(device_id, dev_it->second.ip_address, can_run, credit_limit);
+}
+
+void Docker_scheduler::RunningTasksLoop() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(kSpeculationIntervalMs));
+        try {
+            // copies outlive a budget set back to 0, so they are aged out regardless
+            speculation_.ExpireCopies(NowMs());
+            if (speculation_.Enabled()) {
+                SpeculateStragglers();
             }
+            if (!credit_limits_.empty()) {
+                ExpireOverdueCredits();
+            }
+        } catch (const std::exception &e) {
+            spdlog::error("Running task scan failed: {}", e.what());
         }
     }
-    if (device_ids.empty()) {
-        device_ids.reserve(device_status.size());
-        for (const auto &entry : device_status) {
-            device_ids.push_back(entry.first);
-        }
+}
+
+std::optional<double> Docker_scheduler::ExpectedRunningMs(const ClusterState &state, const DeviceID &device_id,
+                                                          const ImageTask &task) {
+    auto dev_it = state.devices.find(device_id);
+    auto status_it = state.status.find(device_id);
+    if (dev_it == state.devices.end() || status_it == state.status.end()) {
+        return std::nullopt;
     }
-    return device_ids;
+    return status_it->second.net_latency +
+           static_cast<double>(task.dispatch_ahead + 1) * ServiceTimeMs(task.task_type, dev_it->second);
 }
 
-std::vector<SubRequest> Docker_scheduler::AllocateSubRequests(const ClientRequest &req) {
-    if (req.total_num <= 0 || req.tasks.empty()) {
-        throw std::runtime_error("client request has no tasks to allocate");
+void Docker_scheduler::ExpireOverdueCredits() {
+    const ClusterStatePtr state = GetClusterState();
+    const int64_t now_ms = NowMs();
+    // an offline device is handled by RecoverTasks, only results lost by an online device are expired here
+    std::vector<std::string> given_up;
+    const size_t expired = task_queue_manager_.ExpireRunningCredits([&](const DeviceID &device_id, const ImageTask &task) {
+        if (task.dispatch_time_ms <= 0) {
+            return false;
+        }
+        const auto expected = ExpectedRunningMs(*state, device_id, task);
+        return expected.has_value() &&
+               static_cast<double>(now_ms - task.dispatch_time_ms) > std::max(kCreditExpiryFactor * *expected, kMinCreditExpiryMs);
+    }, &given_up);
+    // a task whose primary result is given up may never reach OnTaskCompleted
+    for (const auto &task_id : given_up) {
+        speculation_.Drop(task_id);
     }
-    if (static_cast<int>(req.tasks.size()) != req.total_num) {
-        throw std::runtime_error("client request total_num does not match tasks size");
+    if (expired > 0) {
+        spdlog::warn("{} running credit(s) expired without a /task_completed report", expired);
     }
+}
 
-    auto candidate_ids = GetCandidateDeviceIds(req.task_type);
-    if (candidate_ids.empty()) {
-        throw std::runtime_error("no candidate devices available for batch scheduling");
+void Docker_scheduler::SpeculateStragglers() {
+    const ClusterStatePtr state = GetClusterState();
+    const int64_t now_ms = NowMs();
+    auto expected_ms = [&state](const DeviceID &device_id, const ImageTask &task) {
+        return ExpectedRunningMs(*state, device_id, task);
+    };
+    auto stragglers = task_queue_manager_.FindRunning([&](const DeviceID &device_id, const ImageTask &task) {
+        if (task.speculative || task.dispatch_time_ms <= 0) {
+            return false;
+        }
+        const auto expected = expected_ms(device_id, task);
+        return expected.has_value() && static_cast<double>(now_ms - task.dispatch_time_ms) > kStragglerFactor * *expected;
+    });
+    if (stragglers.empty()) {
+        return;
     }
 
-    struct DeviceScore {
-        DeviceID id;
-        Device device;
-        double load;
-        double weight;
-        double fractional;
-        int count;
-    };
+    const double task_bytes = EstimateTaskBytes();
+    std::vector<DeviceInflight> inflight;
+    for (auto &[primary, task] : stragglers) {
+        if (speculation_.IsSpeculated(task.task_id)) {
+            continue;
+        }
+        // a straggler only delays the request when it is one of the last tasks still outstanding
+        const auto remaining = request_tracker_.RemainingTasks(task.req_id);
+        if (!remaining.has_value()) {
+            continue;
+        }
+        const int tail = std::max(1, (remaining->second * kTailPercent + 99) / 100);
+        if (remaining->first > tail) {
+            continue;
+        }
+        const auto status = request_tracker_.GetTaskStatus(task.task_id);
+        if (!status.has_value() || *status != TaskProgressStatus::RUNNING) {
+            continue;
+        }
 
-    std::vector<DeviceScore> scores;
-    {
-        std::shared_lock<std::shared_mutex> lock(devs_mutex);
-        scores.reserve(candidate_ids.size());
-        for (const auto &device_id : candidate_ids) {
-            auto status_it = device_status.find(device_id);
-            auto dev_it = device_static_info.find(device_id);
-            if (status_it == device_status.end() || dev_it == device_static_info.end()) {
+        // backup goes to the other device that would finish a fresh copy first, and only if that
+        // beats what the primary was expected to need in the first place
+        const auto expected = expected_ms(primary, task);
+        const Device *backup = nullptr;
+        double best_finish = std::numeric_limits<double>::max();
+        const auto &candidates = state->Candidates(task.task_type);
+        task_queue_manager_.GetDevicesInflight(candidates, inflight);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const DeviceID &device_id = candidates[i];
+            if (device_id == primary) {
                 continue;
             }
-            const auto &status = status_it->second;
-            const double w_cpu = 0.3;
-            const double w_mem = 0.1;
-            const double w_xpu = 0.4;
-            const double w_bandwidth = 1;
-            const double w_net_latency = 1;
-            double load = w_cpu * status.cpu_used +
-                          w_mem * status.mem_used +
-                          w_xpu * status.xpu_used +
-                          w_bandwidth * status.net_bandwidth +
-                          w_net_latency * status.net_latency;
-            scores.push_back({device_id, dev_it->second, load, 0.0, 0.0, 0});
-        }
-    }
-    if (scores.empty()) {
-        throw std::runtime_error("no device status available for batch scheduling");
-    }
-
-    if (req.schedule_strategy == ScheduleStrategy::ROUND_ROBIN) {
-        const int n = static_cast<int>(scores.size());
-        const int base = req.total_num / n;
-        int remainder = req.total_num % n;
-        for (auto &s : scores) {
-            s.count = base;
+            auto dev_it = state->devices.find(device_id);
+            auto status_it = state->status.find(device_id);
+            if (dev_it == state->devices.end() || status_it == state->status.end()) {
+                continue;
+            }
+            const double finish = EstimateFinishMs(dev_it->second, status_it->second, task.task_type,
+                                                   inflight[i].outstanding(), 1, task_bytes);
+            if (finish < best_finish) {
+                best_finish = finish;
+                backup = &dev_it->second;
+            }
         }
-        for (int i = 0; i < remainder; ++i) {
-            const int idx = static_cast<int>((rr_index + i) % scores.size());
-            scores[idx].count += 1;
+        if (backup == nullptr || !expected.has_value() || best_finish > *expected) {
+            continue;
         }
-        rr_index = (rr_index + remainder) % scores.size();
-    } else {
-        const double min_load = 1e-6;
-        double weight_sum = 0.0;
-        for (auto &s : scores) {
-            s.weight = 1.0 / std::max(s.load, min_load);
-            weight_sum += s.weight;
-        }
-        int assigned = 0;
-        for (auto &s : scores) {
-            double exact = (s.weight / weight_sum) * req.total_num;
-            s.count = static_cast<int>(std::floor(exact));
-            s.fractional = exact - s.count;
-            assigned += s.count;
-        }
-        int remainder = req.total_num - assigned;
-        std::sort(scores.begin(), scores.end(), [](const DeviceScore &a, const DeviceScore &b) {
-            return a.fractional > b.fractional;
-        });
-        for (int i = 0; i < remainder; ++i) {
-            scores[i % scores.size()].count += 1;
+        if (!speculation_.TryLaunch(task, primary, backup->global_id)) {
+            continue;
         }
+
+        ImageTask copy_task = task;
+        copy_task.speculative = true;
+        copy_task.retry_count = 0;
+        SubRequest copy = MakeSingleSubRequest(copy_task);
+        copy.sub_req_id += "_x";
+        copy.tasks.front().sub_req_id = copy.sub_req_id;
+        copy.speculative = true;
+        copy.dst_device_id = backup->global_id;
+        copy.dst_device_ip = backup->ip_address;
+        spdlog::info("Task {} straggling on {} for {}ms (expected {:.0f}ms), backup copy on {} (estimated {:.0f}ms)",
+                     task.task_id, boost::uuids::to_string(primary), now_ms - task.dispatch_time_ms, *expected,
+                     backup->ip_address, best_finish);
+        task_queue_manager_.PushDevice(backup->global_id, copy, true);
+        EnsureDispatchWorkers(backup->global_id);
     }
+}
 
-    std::vector<SubRequest> sub_reqs;
-    sub_reqs.reserve(scores.size());
-    size_t task_idx = 0;
-    int sub_idx = 0;
-    for (const auto &score : scores) {
-        if (score.count <= 0) {
-            continue;
+bool Docker_scheduler::ClaimTaskResult(const std::string &task_id, const std::string &device_id, const std::string &remote_ip) {
+    // the reporter is named by its global_id when the slave sends one (rst_send --device-id {DEVICE_ID}),
+    // by its address otherwise; results are de-duplicated on (task, reporter)
+    const ClusterStatePtr state = GetClusterState();
+    std::optional<DeviceID> reporter;
+    if (IsUuidText(device_id)) {
+        const DeviceID id = boost::uuids::string_generator()(device_id);
+        if (state->devices.count(id) > 0) {
+            reporter = id;
         }
-        SubRequest sub_req;
-        sub_req.req_id = req.req_id;
-        sub_req.client_ip = req.client_ip;
-        sub_req.task_type = req.task_type;
-        sub_req.schedule_strategy = req.schedule_strategy;
-        sub_req.sub_req_count = score.count;
-        sub_req.enqueue_time_ms = req.enqueue_time_ms;
-        sub_req.dst_device_id = score.id;
-        sub_req.dst_device_ip = score.device.ip_address;
-        sub_req.sub_req_id = req.req_id + "_" + std::to_string(sub_idx++);
-
-        for (int i = 0; i < score.count; ++i) {
-            if (task_idx >= req.tasks.size()) {
+    }
+    if (!reporter.has_value() && !remote_ip.empty()) {
+        // an address shared by several registered devices (NAT, several agents on one host) names none of them
+        for (const auto &[id, device] : state->devices) {
+            if (device.ip_address != remote_ip) {
+                continue;
+            }
+            if (reporter.has_value()) {
+                spdlog::debug("task_result_ready for {}: {} is shared by several devices", task_id, remote_ip);
+                reporter.reset();
                 break;
             }
-            ImageTask task = req.tasks[task_idx++];
-            task.req_id = sub_req.req_id;
-            task.sub_req_id = sub_req.sub_req_id;
-            sub_req.tasks.push_back(task);
+            reporter = id;
         }
-        sub_req.sub_req_count = static_cast<int>(sub_req.tasks.size());
-        sub_reqs.push_back(sub_req);
-        Docker_scheduler::GetRequestTracker().OnSubRequestAllocated(sub_req);
     }
-
-    return sub_reqs;
+    const bool send = speculation_.ClaimResult(task_id, reporter);
+    if (!send) {
+        spdlog::info("Task {}: duplicate result from {} dropped", task_id, remote_ip);
+    }
+    return send;
 }
 
-void Docker_scheduler::SchedulerLoop() {
-    const int max_retries = 3;
-    while (true) {
-        auto sub_req_opt = task_queue_manager_.PopPending();
-        if (!sub_req_opt.has_value()) {
-            continue;
+bool Docker_scheduler::DispatchSubRequest(const Device &target_device, SubRequest &sub_req) {
+    bool try_batch = batch_upload_;
+    if (try_batch) {
+        std::lock_guard<std::mutex> lock(batch_unsupported_mutex_);
+        try_batch = batch_unsupported_.count(target_device.global_id) == 0;
+    }
+    if (try_batch) {
+        auto batched = DispatchSubRequestBatch(target_device, sub_req);
+        if (batched.has_value()) {
+            return *batched;
         }
-        SubRequest sub_req = *sub_req_opt;
+        // slave without /recv_sub_req_batch: fall back to meta + one upload per task, and skip the batch
+        // attempt for this device from now on, since the rejected body was already streamed in full
+        std::lock_guard<std::mutex> lock(batch_unsupported_mutex_);
+        batch_unsupported_.insert(target_device.global_id);
+    }
 
-        Device target_device;
-        bool use_assigned = (sub_req.dst_device_id != boost::uuids::nil_uuid());
-        try {
-            if (use_assigned) {
-                auto it = device_static_info.find(sub_req.dst_device_id);
-                if (it == device_static_info.end()) {
-                    throw std::runtime_error("assigned device not found");
-                }
-                target_device = it->second;
-            } else {
-                target_device = sub_req.schedule_strategy == ScheduleStrategy::ROUND_ROBIN
-                                    ? RoundRobin_Schedule(sub_req.task_type)
-                                    : Schedule(sub_req.task_type);
-                sub_req.dst_device_id = target_device.global_id;
-                sub_req.dst_device_ip = target_device.ip_address;
-            }
+    try {
+        auto meta_cli = dispatch_pool_.Acquire(target_device.ip_address, kSlaveRecvPort);
+        auto res = meta_cli->Post("/recv_sub_req_meta", BuildSubReqMeta(sub_req, target_device).dump(), "application/json");
+        if (!res) {
+            meta_cli.MarkBroken();
+        }
+        if (!res || res->status != 200) {
+            spdlog::warn("Send sub_req_meta {} failed, status={}", sub_req.sub_req_id, res ? res->status : -1);
+            return false;
+        }
+    } catch (const std::exception &e) {
+        spdlog::error("Exception sending sub_req_meta {}: {}", sub_req.sub_req_id, e.what());
+        return false;
+    }
 
-            {
-                std::shared_lock<std::shared_mutex> lock(devs_mutex);
-                auto status_it = device_status.find(target_device.global_id);
-                if (status_it != device_status.end()) {
-                    const auto& status = status_it->second;
-                    spdlog::info("SubReq {} selected device {} [CPU: {:.2f}%, MEM: {:.2f}%, XPU: {:.2f}%, Bandwidth: {:.2f}Mbps, Latency: {}ms]",
-                                 sub_req.sub_req_id, target_device.ip_address,
-                                 status.cpu_used * 100, status.mem_used * 100, status.xpu_used * 100,
-                                 status.net_bandwidth, static_cast<int>(status.net_latency * 1000));
-                }
-            }
-        } catch (const std::exception &e) {
-            spdlog::error("Schedule failed for sub_req {}: {}", sub_req.sub_req_id, e.what());
-            if (!sub_req.tasks.empty()) {
-                for (auto &task : sub_req.tasks) {
-                    task.retry_count++;
-                    if (task.retry_count <= max_retries) {
-                        task_queue_manager_.PushPending(MakeSingleSubRequest(task), true);
-                    } else {
-                        task_queue_manager_.MoveToFailed(task);
-                    }
-                }
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (auto &task : sub_req.tasks) {
+        // image bytes go from the page cache straight to the socket, no intermediate string
+        auto file = OpenTaskFile(task);
+        if (!file) {
+            RequeueTask(task);
             continue;
         }
+        MultipartStream body;
+        body.AddFile("pic_file", task.task_id, file, "application/octet-stream");
+        body.AddText("pic_info", BuildTaskMeta(task, sub_req.sub_req_count).dump(), "application/json");
 
         try {
-            httplib::Client meta_cli(target_device.ip_address, 20810);
-            nlohmann::json meta_payload;
-            meta_payload["req_id"] = sub_req.req_id;
-            meta_payload["sub_req_id"] = sub_req.sub_req_id;
-            meta_payload["sub_req_count"] = sub_req.sub_req_count;
-            meta_payload["tasktype"] = sub_req.task_type == TaskType::Unknown ? "Unknown" : nlohmann::json(sub_req.task_type);
-            meta_payload["dst_device_id"] = boost::uuids::to_string(sub_req.dst_device_id);
-            meta_payload["dst_device_ip"] = target_device.ip_address;
-            meta_payload["enqueue_time_ms"] = sub_req.enqueue_time_ms;
-            auto res = meta_cli.Post("/recv_sub_req_meta", meta_payload.dump(), "application/json");
-            if (!res || res->status != 200) {
-                spdlog::warn("Send sub_req_meta {} failed, status={}", sub_req.sub_req_id, res ? res->status : -1);
-                task_queue_manager_.PushPending(sub_req, true);
-                continue;
+            auto cli = dispatch_pool_.Acquire(target_device.ip_address, kSlaveRecvPort);
+            auto res = cli->Post("/recv_task", body.size(), body.Provider(), body.content_type());
+            if (!res) {
+                cli.MarkBroken();
+            }
+            if (res && res->status == 200) {
+                task.payload_bytes = file->size();
+                task_queue_manager_.AddRunningTask(target_device.global_id, task);
+                RecordPayload(target_device.global_id, *file);
+                spdlog::info("Task {} dispatched to device {} ({} bytes, {} copied)",
+                             task.task_id, target_device.ip_address, file->size(), file->bytes_copied());
+            } else {
+                spdlog::warn("Send task {} failed, status={}", task.task_id, res ? res->status : -1);
+                RequeueTask(task);
             }
         } catch (const std::exception &e) {
-            spdlog::error("Exception sending sub_req_meta {}: {}", sub_req.sub_req_id, e.what());
-            task_queue_manager_.PushPending(sub_req, true);
+            spdlog::error("Exception sending task {}: {}", task.task_id, e.what());
+            RequeueTask(task);
+        }
+    }
+    return true;
+}
+
+std::optional<bool> Docker_scheduler::DispatchSubRequestBatch(const Device &target_device, SubRequest &sub_req) {
+    // one multipart request: sub_req_meta + one mapped pic_file part per task, in task order
+    std::vector<ImageTask> sendable;
+    std::vector<std::shared_ptr<MappedFile>> files;
+    sendable.reserve(sub_req.tasks.size());
+    files.reserve(sub_req.tasks.size());
+    for (auto &task : sub_req.tasks) {
+        auto file = OpenTaskFile(task);
+        if (!file) {
+            RequeueTask(task);
             continue;
         }
+        sendable.push_back(std::move(task));
+        files.push_back(std::move(file));
+    }
+    // requeued tasks leave the sub-request here, so a retry of the batch or the per-task fallback
+    // cannot hand them back a second time
+    if (sendable.size() != sub_req.tasks.size()) {
+        sub_req.tasks = std::move(sendable);
+        sub_req.sub_req_count = static_cast<int>(sub_req.tasks.size());
+    }
+    if (sub_req.tasks.empty()) {
+        return true;
+    }
 
-        for (auto &task : sub_req.tasks) {
-            std::ifstream ifs(task.file_path, std::ios::binary);
-            if (!ifs) {
-                spdlog::error("Failed to open task file: {}", task.file_path);
-                task.retry_count++;
-                if (task.retry_count <= max_retries) {
-                    task_queue_manager_.PushPending(MakeSingleSubRequest(task), true);
-                } else {
-                    task_queue_manager_.MoveToFailed(task);
-                }
-                continue;
-            }
-            std::ostringstream buffer;
-            buffer << ifs.rdbuf();
-            std::string image_data = buffer.str();
-
-            nlohmann::json meta_json;
-            meta_json["ip"] = task.client_ip;
-            meta_json["file_name"] = task.task_id;
-            meta_json["tasktype"] = task.task_type == TaskType::Unknown ? "Unknown" : nlohmann::json(task.task_type);
-            meta_json["req_id"] = task.req_id;
-            meta_json["sub_req_id"] = task.sub_req_id;
-            meta_json["sub_req_count"] = sub_req.sub_req_count;
-            std::string meta_str = meta_json.dump();
-
-            try {
-                httplib::Client cli(target_device.ip_address, 20810);
-                httplib::MultipartFormDataItems form_items = {
-                    {"pic_file", image_data, task.task_id, "application/octet-stream"},
-                    {"pic_info", meta_str, "", "application/json"}
-                };
-                auto res = cli.Post("/recv_task", form_items);
-                if (res && res->status == 200) {
-                    task_queue_manager_.AddRunningTask(target_device.global_id, task);
-                    spdlog::info("Task {} dispatched to device {}", task.task_id, target_device.ip_address);
-                } else {
-                    spdlog::warn("Send task {} failed, status={}", task.task_id, res ? res->status : -1);
-                    task.retry_count++;
-                    if (task.retry_count <= max_retries) {
-                        task_queue_manager_.PushPending(MakeSingleSubRequest(task), true);
-                    } else {
-                        task_queue_manager_.MoveToFailed(task);
-                    }
-                }
-            } catch (const std::exception &e) {
-                spdlog::error("Exception sending task {}: {}", task.task_id, e.what());
-                task.retry_count++;
-                if (task.retry_count <= max_retries) {
-                    task_queue_manager_.PushPending(MakeSingleSubRequest(task), true);
-                } else {
-                    task_queue_manager_.MoveToFailed(task);
+    MultipartStream body;
+    nlohmann::json items = nlohmann::json::array();
+    for (size_t i = 0; i < sub_req.tasks.size(); ++i) {
+        body.AddFile("pic_file", sub_req.tasks[i].task_id, files[i], "application/octet-stream");
+        items.push_back(BuildTaskMeta(sub_req.tasks[i], sub_req.sub_req_count));
+    }
+    nlohmann::json meta_payload = BuildSubReqMeta(sub_req, target_device);
+    meta_payload["items"] = items;
+    body.AddText("sub_req_meta", meta_payload.dump(), "application/json");
+
+    httplib::Result res;
+    try {
+        auto cli = dispatch_pool_.Acquire(target_device.ip_address, kSlaveRecvPort);
+        res = cli->Post("/recv_sub_req_batch", body.size(), body.Provider(), body.content_type());
+        if (!res) {
+            cli.MarkBroken();
+        }
+    } catch (const std::exception &e) {
+        spdlog::error("Exception sending sub_req batch {}: {}", sub_req.sub_req_id, e.what());
+        return false;
+    }
+    if (res && res->status == 404) {
+        spdlog::warn("Device {} has no /recv_sub_req_batch, fall back to per-task upload", target_device.ip_address);
+        return std::nullopt;
+    }
+    if (!res || (res->status != 200 && res->status != 207)) {
+        // nothing is known to have landed on the slave: the tasks are retried under new sub_req_ids
+        spdlog::warn("Send sub_req batch {} failed, status={}", sub_req.sub_req_id, res ? res->status : -1);
+        return false;
+    }
+
+    // per-item status list; only items the slave reported as stored become running, a missing or
+    // unparseable list and items missing from it are retried
+    std::unordered_set<std::string> stored_ids;
+    try {
+        auto body = nlohmann::json::parse(res->body);
+        if (body.contains("result") && body["result"].contains("items") && body["result"]["items"].is_array()) {
+            for (const auto &item : body["result"]["items"]) {
+                if (item.is_object() && item.value("status", "") == "success") {
+                    stored_ids.insert(item.value("file_name", ""));
                 }
             }
+        } else {
+            spdlog::warn("Batch response for sub_req {} has no item list", sub_req.sub_req_id);
+        }
+    } catch (const std::exception &e) {
+        spdlog::warn("Unparseable batch response for sub_req {}: {}", sub_req.sub_req_id, e.what());
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < sub_req.tasks.size(); ++i) {
+        ImageTask &task = sub_req.tasks[i];
+        RecordPayload(target_device.global_id, *files[i]);
+        if (stored_ids.count(task.task_id) == 0) {
+            spdlog::warn("Task {} not stored by device {} in batch {}", task.task_id, target_device.ip_address, sub_req.sub_req_id);
+            RequeueTask(task);
+            failed++;
+        } else {
+            task.payload_bytes = files[i]->size();
+            task_queue_manager_.AddRunningTask(target_device.global_id, task);
         }
     }
+    spdlog::info("SubReq {} batch-dispatched to device {}: {} tasks, {} failed",
+                 sub_req.sub_req_id, target_device.ip_address, sub_req.tasks.size(), failed);
+    return true;
 }
 
 Docker_scheduler::Docker_scheduler() {
@@ -1049,11 +2495,17 @@ vector<TaskType> Docker_scheduler::getTaskTypesByDeviceType(DeviceType devType)
 
 
 int Docker_scheduler::RegisNode(const Device &device) {
+    std::unique_lock<std::shared_mutex> lock(devs_mutex);
     // update devs
     device_static_info[device.global_id] = device;
     // update dev_status
     device_status[device.global_id] = DeviceStatus();
     device_active_services[device.global_id] = device.services;
+    {
+        // the slave may have been upgraded while it was away: probe batch upload again
+        std::lock_guard<std::mutex> batch_lock(batch_unsupported_mutex_);
+        batch_unsupported_.erase(device.global_id);
+    }
 
     // update Tdmap all tasktype add new device
     // according to task_static_info, match supported tasktype and device
@@ -1066,6 +2518,7 @@ int Docker_scheduler::RegisNode(const Device &device) {
         // DevSrvInfos temp;
         tdMap[k].try_emplace(device.global_id); // value constructor se default
     }
+    PublishClusterStateLocked();
     return 0;
 }
 
@@ -1125,19 +2578,74 @@ void Docker_scheduler::loadStaticInfo(string filepath) {
 }
 
 void Docker_scheduler::RemoveDevice(DeviceID global_id) {
-    for (auto [ttype, v]: tdMap) {
-        auto it = tdMap[ttype].find(global_id);
-        tdMap[ttype].erase(it);
+    std::unique_lock<std::shared_mutex> lock(devs_mutex);
+    for (auto &[ttype, devs]: tdMap) {
+        devs.erase(global_id);
     }
     device_active_services.erase(global_id);
+    PublishClusterStateLocked();
+}
+
+ClusterStatePtr Docker_scheduler::GetClusterState() {
+    return std::atomic_load(&cluster_state_);
+}
+
+void Docker_scheduler::PublishClusterStateLocked() {
+    auto next = std::make_shared<ClusterState>();
+    next->version = ++cluster_version_;
+    next->devices = device_static_info;
+    next->status = device_status;
+    next->active_services = device_active_services;
+    for (const auto &[ttype, devs] : tdMap) {
+        auto &ids = next->task_devices[ttype];
+        ids.reserve(devs.size());
+        for (const auto &entry : devs) {
+            ids.push_back(entry.first);
+        }
+    }
+
+    // candidate index, rebuilt on every publish (register / telemetry / disconnect)
+    next->online_ids.reserve(next->status.size());
+    for (const auto &entry : next->status) {
+        next->online_ids.push_back(entry.first);
+    }
+    // devices that already run the service come first; tdMap support only counts when nobody runs it
+    for (const auto &[dev_id, services] : next->active_services) {
+        if (!next->IsOnline(dev_id)) {
+            continue;
+        }
+        for (TaskType ttype : services) {
+            auto &ids = next->candidates[ttype];
+            if (ids.empty() || ids.back() != dev_id) {
+                ids.push_back(dev_id);
+            }
+        }
+    }
+    for (const auto &[ttype, ids] : next->task_devices) {
+        auto &cand = next->candidates[ttype];
+        if (!cand.empty()) {
+            continue;
+        }
+        for (const auto &dev_id : ids) {
+            if (next->IsOnline(dev_id)) {
+                cand.push_back(dev_id);
+            }
+        }
+    }
+    std::atomic_store(&cluster_state_, ClusterStatePtr(std::move(next)));
 }
 
 bool Docker_scheduler::HotStartAllNodeByTType(TaskType ttype) {
     int support_ttype_dev_nums = 0;
     int start_container_nums = 0;
+    const ClusterStatePtr state = GetClusterState();
     for(auto [deviceId, devSrvInfos] : tdMap[ttype]) {
         support_ttype_dev_nums++;
-        Device dev = device_static_info[deviceId];
+        auto dev_it = state->devices.find(deviceId);
+        if (dev_it == state->devices.end()) {
+            continue;
+        }
+        Device dev = dev_it->second;
         std::optional<SrvInfo> srvInfo = createContainerByTType(ttype, dev);
         if(srvInfo == nullopt) {
             spdlog::error("HotStartAllNodeByTType createContainer failed, ip:{}", dev.ip_address);
@@ -1150,70 +2658,67 @@ bool Docker_scheduler::HotStartAllNodeByTType(TaskType ttype) {
     return true;
 }
 
+void Docker_scheduler::ApplyTelemetrySamples(std::map<DeviceID, TelemetrySample> &samples) {
+    if (samples.empty()) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(devs_mutex);
+    for (auto &[k, item] : samples) {
+        auto it = device_status.find(k);
+        if (it != device_status.end()) {
+            it->second = item.status;  // 更新已有设备的状态，期间断开的设备不会被写回
+        }
+        if (item.services.has_value() && device_static_info.count(k) > 0) {
+            device_active_services[k] = std::move(*item.services);
+        }
+    }
+    PublishClusterStateLocked();
+    lock.unlock();
+    for (const auto &entry : samples) {
+        task_queue_manager_.OnTelemetrySample(entry.first);
+    }
+}
+
 void Docker_scheduler::startDeviceInfoCollection() {
+    // agent 推送的样本每 kFlushMs 合并写回一次；心跳期内没有推送视为状态未变，推送中断的设备由下面的轮询接管
+    if (telemetry_udp_port_ > 0) {
+        // 只接收已注册设备从其登记地址发来的推送，其他主机伪造 global_id 会被丢弃
+        telemetry_push_.SetDeviceFilter([](const DeviceID &id, const std::string &src_ip) {
+            const ClusterStatePtr state = GetClusterState();
+            auto it = state->devices.find(id);
+            return it != state->devices.end() && it->second.ip_address == src_ip;
+        });
+        telemetry_push_.Start(telemetry_udp_port_, [](std::map<DeviceID, TelemetrySample> &batch,
+                                                      const std::vector<DeviceID> &unchanged) {
+            ApplyTelemetrySamples(batch);
+            // 心跳确认状态未变：已发布的状态仍然有效，只需告诉队列它已包含此前下发的任务
+            for (const auto &id : unchanged) {
+                task_queue_manager_.OnTelemetrySample(id);
+            }
+        });
+    }
     std::thread([]() {
         int count = 0; // 用于每10次打印一次所有设备的负载
         while (true) {
-            {
-                std::unique_lock<std::shared_mutex> lock(devs_mutex);
-                for (auto [k, dev]: device_static_info) {
-                    // start new Thread to collect
-                    httplib::Client cli(dev.ip_address, dev.agent_port);
-                    httplib::Result res;
-                    try {
-                        res = cli.Get("/usage/device_info");
-                        // update device staus
-                        if (res != nullptr && res.error() == httplib::Error::Success) {
-                            string restr = res->body.data();
-                            json j = json::parse(restr);
-                            string resp_status = j["status"];
-                            if (resp_status != "success") {
-                                spdlog::error("Failed to get device info, agent return filed,dev.ip_address:{}, dev.agent_port:{}",
-                                        dev.ip_address, dev.agent_port);
-                                continue;
-                            }
-                            DeviceStatus status;
-                            status.from_json(j["result"]);
-
-                            auto it = device_status.find(k);
-                            if (it != device_status.end()) {
-                                it->second = status;  // 更新已有设备的状态
-                            }
-
-                            // agent 可选上报当前已启动的服务列表（用于 scheduler 优先选择已启动服务的节点）
-                            try {
-                                if (j.contains("result") && j["result"].is_object() &&
-                                    j["result"].contains("services") && j["result"]["services"].is_array()) {
-                                    std::vector<TaskType> running;
-                                    for (const auto &sv : j["result"]["services"]) {
-                                        if (!sv.is_string()) continue;
-                                        TaskType tt = StrToTaskType(sv.get<std::string>());
-                                        if (tt != TaskType::Unknown) {
-                                            running.push_back(tt);
-                                        }
-                                    }
-                                    device_active_services[k] = running;
-                                }
-                            } catch (...) {
-                            }
-                        } else {
-                            spdlog::error("Failed to get device info, dev.ip_address:{}, dev.agent_port:{}",
-                                          dev.ip_address, dev.agent_port);
-                            continue;
-                        }
-                    } catch (const std::exception &e) {
-                        spdlog::error("collect info error: {}", e.what());
-                        continue;
-                    }
+            // 轮询 agent 期间不持锁：所有设备并发采集，结果最后在一个短临界区里写回并发布新版本
+            const ClusterStatePtr snapshot = GetClusterState();
+            const int64_t now_ms = NowMs();
+            std::map<DeviceID, Device> to_poll;
+            for (const auto &[id, dev] : snapshot->devices) {
+                if (!telemetry_push_.IsFresh(id, now_ms)) {
+                    to_poll.emplace(id, dev);
                 }
             }
+            std::map<DeviceID, TelemetrySample> polled = telemetry_.PollAll(to_poll);
+            ApplyTelemetrySamples(polled);
 
             // 每10次打印一次所有设备的负载信息
             if (++count % 10 == 0) {
-                spdlog::info("=== Device Load Summary ===");
-                for (const auto& [device_id, dev]: device_static_info) {
-                    auto status_it = device_status.find(device_id);
-                    if (status_it != device_status.end()) {
+                const ClusterStatePtr state = GetClusterState();
+                spdlog::info("=== Device Load Summary (v{}) ===", state->version);
+                for (const auto& [device_id, dev]: state->devices) {
+                    auto status_it = state->status.find(device_id);
+                    if (status_it != state->status.end()) {
                         const auto& status = status_it->second;
                         spdlog::info("Device {} ({}): CPU: {:.2f}%. MEM: {:.2f}%, XPU: {:.2f}%, Bandwidth: {:.2f}Mbps, Latency: {}ms",
                                      dev.ip_address, dev.type,
@@ -1379,12 +2884,13 @@ Device Docker_scheduler::getTgtDevByTtypeAndDevIds(TaskType ttype) {
 
 Device Docker_scheduler::getTgtDevByTtypeAndDevIds(TaskType ttype, vector<DeviceID> devIds) {
     try {
-        return selectDeviceByLoad(devIds);
+        return selectDeviceByLoad(devIds, ttype);
     } catch (const std::exception& e) {
         spdlog::warn("Load-based scheduling failed for task {}: {}. Falling back to round robin.", static_cast<int>(ttype), e.what());
         if (!devIds.empty()) {
-            auto fallback = device_static_info.find(devIds.front());
-            if (fallback != device_static_info.end()) {
+            const ClusterStatePtr state = GetClusterState();
+            auto fallback = state->devices.find(devIds.front());
+            if (fallback != state->devices.end()) {
                 return fallback->second;
             }
         }
@@ -1392,134 +2898,141 @@ Device Docker_scheduler::getTgtDevByTtypeAndDevIds(TaskType ttype, vector<Device
     }
 }
 
-Device Docker_scheduler::selectDeviceByLoad(const std::vector<DeviceID>& devIds) {
-    if (devIds.empty()) {
-        throw std::runtime_error("No candidate devices available for scheduling.");
-    }
-    std::shared_lock<std::shared_mutex> lock(devs_mutex);
+Device Docker_scheduler::selectDeviceByLoad(const std::vector<DeviceID>& devIds, TaskType ttype) {
+    return LoadPolicy::Select(*GetClusterState(), devIds, ttype);
+}
 
+double Docker_scheduler::ProjectedLoad(const Device &device, const DeviceStatus &status, TaskType ttype, size_t unsampled) {
     const double w_cpu = 0.3;
     const double w_mem = 0.1;
     const double w_xpu = 0.4;
-    const double w_bandwidth = 1;
-    const double w_net_latency = 1;
-
-    DeviceID best_device{};
-    double min_load = std::numeric_limits<double>::max();
-    bool found = false;
-    std::ostringstream device_logs_stream;
-    bool first_log_item = true;
-
-    for (const auto& device_id : devIds) {
-        auto it = device_status.find(device_id);
-        auto dev_it = device_static_info.find(device_id);
-        if (it == device_status.end() || dev_it == device_static_info.end()) {
-            continue;
-        }
-        const auto& status = it->second;
-        double cpu_val = status.cpu_used;
-        double mem_val = status.mem_used;
-        double xpu_val = status.xpu_used;
-        double bandwidth_val = status.net_bandwidth;
-        double net_latency_val = status.net_latency;
-        double load = w_cpu * cpu_val +
-                      w_mem * mem_val +
-                      w_xpu * xpu_val +
-                      w_bandwidth * bandwidth_val +
-                      w_net_latency * net_latency_val;
-
-        if (!first_log_item) {
-            device_logs_stream << " | ";
-        }
-        device_logs_stream << fmt::format("device {}: cpu_used={}, mem_used={}, xpu_used={}, bandwidth={}, latency={}, weighted_score={}",
-                                          dev_it->second.ip_address, cpu_val, mem_val, xpu_val, bandwidth_val, net_latency_val, load);
-        first_log_item = false;
-
-        if (load < min_load) {
-            min_load = load;
-            best_device = device_id;
-            found = true;
-        }
-    }
-
-    if (!found) {
-        throw std::runtime_error("No device statuses available for scheduling.");
-    }
-
-    const auto selected = device_static_info.at(best_device);
-    spdlog::info("Schedule metrics summary: [{}]; Selected device: {} with weighted_score={}",
-                 device_logs_stream.str(), selected.ip_address, min_load);
-    return selected;
+    const double w_bandwidth = 0.1;
+    const double w_net_latency = 0.1;
+
+    // tasks queued or uploaded since the sample are charged at their profiled overhead, so a burst
+    // of decisions between two polls sees each earlier pick instead of the same stale minimum
+    const TaskOverhead overhead = ProfiledOverhead(ttype, device.type);
+    const double n = static_cast<double>(unsampled);
+    // network terms are mapped to [0,1) like the utilisations, raw ms / Mbps would swamp the per-task charge;
+    // low bandwidth costs more, not high
+    const double latency = std::max(0.0, status.net_latency);
+    const double bandwidth = std::max(0.0, status.net_bandwidth);
+    return w_cpu * (status.cpu_used + n * overhead.cpu_usage) +
+           w_mem * (status.mem_used + n * overhead.mem_usage) +
+           w_xpu * (status.xpu_used + n * overhead.xpu_usage) +
+           w_bandwidth * (kBandwidthRefMbps / (bandwidth + kBandwidthRefMbps)) +
+           w_net_latency * (latency / (latency + kLatencyRefMs));
 }
 
-
 std::map<TaskType, std::map<DeviceType, StaticInfoItem> > Docker_scheduler::getStaticInfo() {
     return static_info;
 }
 
 Device Docker_scheduler::Schedule(TaskType Ttype) {
-    std::vector<DeviceID> device_ids;
-    {
-        std::shared_lock<std::shared_mutex> lock(devs_mutex);
-        if (Ttype != TaskType::Unknown) {
-            for (const auto& [device_id, services] : device_active_services) {
-                if (device_status.find(device_id) == device_status.end()) {
-                    continue;
-                }
-                if (std::find(services.begin(), services.end(), Ttype) != services.end()) {
-                    device_ids.push_back(device_id);
-                }
-            }
-            if (device_ids.empty()) {
-                auto it = tdMap.find(Ttype);
-                if (it != tdMap.end()) {
-                    device_ids.reserve(it->second.size());
-                    for (const auto& [device_id, _] : it->second) {
-                        if (device_status.find(device_id) != device_status.end()) {
-                            device_ids.push_back(device_id);
-                        }
-                    }
-                }
-            }
+    return ScheduleWith(ScheduleStrategy::LOAD_BASED, Ttype);
+}
+
+Device Docker_scheduler::ScheduleWith(ScheduleStrategy strategy, TaskType Ttype) {
+    const ClusterStatePtr state = GetClusterState();
+    const auto &candidates = state->Candidates(Ttype);
+    try {
+        Device selected;
+        const bool known = SchedulePolicies::Visit(strategy, [&](auto tag) {
+            selected = decltype(tag)::type::Select(*state, candidates, Ttype);
+        });
+        if (!known) {
+            throw std::runtime_error("no scheduling policy for the requested strategy");
         }
-        if (device_ids.empty()) {
-            device_ids.reserve(device_status.size());
-            for (const auto& [device_id, _] : device_status) {
-                device_ids.push_back(device_id);
-            }
+        return selected;
+    } catch (const std::exception& e) {
+        if (strategy == ScheduleStrategy::ROUND_ROBIN) {
+            throw;
         }
+        spdlog::warn("Schedule ({}) fallback to round robin: {}", SchedulePolicies::Name(strategy), e.what());
+        return RoundRobinPolicy::Select(*state, candidates, Ttype);
     }
+}
 
-    try {
-        return selectDeviceByLoad(device_ids);
-    } catch (const std::exception& e) {
-        spdlog::warn("Schedule fallback to round robin: {}", e.what());
-        return RoundRobin_Schedule(Ttype);
+TaskOverhead Docker_scheduler::ProfiledOverhead(TaskType ttype, DeviceType dtype) {
+    auto task_it = static_info.find(ttype);
+    if (task_it == static_info.end() || task_it->second.empty()) {
+        return TaskOverhead{kDefaultProcTimeMs, kDefaultTaskMem, kDefaultTaskCpu, kDefaultTaskXpu};
+    }
+    auto dev_it = task_it->second.find(dtype);
+    if (dev_it != task_it->second.end()) {
+        return dev_it->second.taskOverhead;
+    }
+    TaskOverhead mean{0.0, 0.0, 0.0, 0.0};
+    for (const auto &[_, item] : task_it->second) {
+        mean.proc_time += item.taskOverhead.proc_time;
+        mean.mem_usage += item.taskOverhead.mem_usage;
+        mean.cpu_usage += item.taskOverhead.cpu_usage;
+        mean.xpu_usage += item.taskOverhead.xpu_usage;
+    }
+    const double n = static_cast<double>(task_it->second.size());
+    mean.proc_time /= n;
+    mean.mem_usage /= n;
+    mean.cpu_usage /= n;
+    mean.xpu_usage /= n;
+    return mean;
+}
+
+double Docker_scheduler::ProcTimeMs(TaskType ttype, DeviceType dtype) {
+    return ProfiledOverhead(ttype, dtype).proc_time;
+}
+
+double Docker_scheduler::ServiceTimeMs(TaskType ttype, const Device &device) {
+    // learned from completions once there are enough of them, the profile until then
+    const auto learned = service_times_.ServiceMs(ttype, device.global_id);
+    return learned ? *learned : ProcTimeMs(ttype, device.type);
+}
+
+double Docker_scheduler::EstimateTaskBytes() {
+    std::lock_guard<std::mutex> lock(payload_stats_mutex_);
+    uint64_t tasks = 0;
+    uint64_t bytes = 0;
+    for (const auto &[_, stats] : payload_stats_) {
+        tasks += stats.tasks;
+        bytes += stats.bytes_sent;
     }
+    return tasks > 0 ? static_cast<double>(bytes) / static_cast<double>(tasks) : kDefaultTaskBytes;
 }
 
-struct Predict_data {
-    double cpu_used;
-    double xpu_used;
-    double cpu_square;
-    double xpu_square;
-    double cpu_xpu;
-    int platform;
-    int tasktype;
-};
+double Docker_scheduler::EstimateFinishMs(const Device &device, const DeviceStatus &status, TaskType ttype,
+                                          size_t backlog, size_t extra_tasks, double task_bytes) {
+    // the device works through its backlog and the new tasks one by one; uploads of the new tasks
+    // share the link, so their transfer time adds up (net_latency is reported in ms, bandwidth in Mbps)
+    const double proc_ms = ServiceTimeMs(ttype, device);
+    double finish_ms = status.net_latency + static_cast<double>(backlog + extra_tasks) * proc_ms;
+    if (status.net_bandwidth > 0.0) {
+        const double bytes_per_ms = status.net_bandwidth * 1e6 / 8.0 / 1000.0;
+        finish_ms += static_cast<double>(extra_tasks) * task_bytes / bytes_per_ms;
+    }
+    return finish_ms;
+}
 
+Device Docker_scheduler::CompletionTime_Schedule(TaskType Ttype) {
+    return ScheduleWith(ScheduleStrategy::COMPLETION_TIME, Ttype);
+}
 
 // load model funtion
-//void Docker_scheduler::loadModel(const std::string& model_path) {
-//    if (!is_model_loaded) {
-//        Ort::SessionOptions session_options;
-//        onnx_session = new Ort::Session(env, model_path.c_str(), session_options);
-//        is_model_loaded = true;
-//        std::cout << "Model loaded successfully!" << std::endl;
-//    } else {
-//        std::cout << "Model already loaded, skipping reload." << std::endl;
-//    }
-//}
+bool Docker_scheduler::loadModel(const std::string& model_path) {
+    {
+        std::lock_guard<std::mutex> lock(latency_model_path_mutex_);
+        latency_model_path_ = model_path;
+    }
+    auto model = std::make_shared<LatencyPredictor>();
+    if (!model->Load(model_path)) {
+        return false;
+    }
+    std::atomic_store(&latency_model_, std::shared_ptr<const LatencyPredictor>(std::move(model)));
+    return true;
+}
+
+std::shared_ptr<const LatencyPredictor> Docker_scheduler::GetLatencyModel() {
+    return std::atomic_load(&latency_model_);
+}
+
 int Docker_scheduler::encodeTaskType(TaskType Ttype) {
     switch (Ttype) {
         case TaskType::Bert: return 0;
@@ -1539,191 +3052,35 @@ int Docker_scheduler::encodePlatform(DeviceType dtype) {
         default: throw std::invalid_argument("Unknown DeviceType");
     }
 }
-//Device Docker_scheduler::Model_predict(TaskType Ttype) {
-//    // Initialize ONNX Runtime environment
-//    std::string input_name = "double_input";
-//    std::string output_name = "variable";
-//    std::string model_path = "../../src/scheduler/predict.onnx";
-//    // 在第一次调用推理时加载模型
-//    if (!is_model_loaded) {
-//        loadModel(model_path);  // 加载模型
-//    }
-//
-//    // 使用 map 或 unordered_map，避免需要提前知道设备数量
-//    std::unordered_map<DeviceID, Predict_data> predict_input;
-//    // 为每个设备创建负载变量
-//    for (const auto& [device_id, status] : device_status) {
-//        predict_input[device_id].cpu_used=status.cpu_used;
-//        predict_input[device_id].xpu_used=status.xpu_used;
-//        //cout<<"device_id:"<<boost::uuids::to_string(device_id)<<" cpu_used:"<<status.cpu_used<<" xpu_used:"<<status.xpu_used<<endl;
-//    }
-//    for (const auto &[device_id, device] : device_static_info) {
-//        predict_input[device_id].platform = encodePlatform(device.type);
-//        predict_input[device_id].tasktype = encodeTaskType(Ttype);
-//        //cout<<" platform:"<<device.type<<" tasktype:"<<Ttype<<endl;
-//    }
-//
-//    // Prepare input data (match your model input format)
-//    // 定义平台和对应的资源利用率（假设有3个平台）
-//    std::vector<Predict_data> input_data;
-//
-//    for (const auto &[device_id, device] : device_static_info) {
-//        double cpu=predict_input[device_id].cpu_used;
-//        double npu=predict_input[device_id].xpu_used;
-//        double cpu_square=cpu*cpu;
-//        double npu_square=npu*npu;
-//        double cpu_npu=cpu*npu;
-//        input_data.push_back({predict_input[device_id].cpu_used,
-//                              predict_input[device_id].xpu_used,
-//                              cpu_square,
-//                              npu_square,
-//                              cpu_npu,
-//                              predict_input[device_id].platform,
-//                              predict_input[device_id].tasktype
-//        });
-//        //cout<<"input："<<predict_input[device_id].cpu_used<<" "<<predict_input[device_id].xpu_used<<" "<<predict_input[device_id].platform<<" "<<predict_input[device_id].tasktype<<endl;
-//    }
-//
-//    // Create memory info object for input
-//    Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-//    std::vector<std::tuple<int, float, float>> platform_times;
-//
-//    // 对每个平台进行推理
-//    for (size_t i = 0; i < input_data.size(); ++i) {
-//        // 获取输入数据
-//        const auto& platform_input = input_data[i];
-//        std::vector<double> input_vector = {platform_input.cpu_used, platform_input.xpu_used,platform_input.cpu_square,platform_input.xpu_square,platform_input.cpu_xpu, static_cast<double>(platform_input.platform),static_cast<double>(platform_input.tasktype)};
-//
-//        // 创建输入张量
-//        std::vector<int64_t> input_shape = {1, 7};  // 输入形状
-//        Ort::Value input_tensor = Ort::Value::CreateTensor<double>(
-//                memory_info, input_vector.data(), input_vector.size(), input_shape.data(), input_shape.size()
-//        );
-//
-//        // 执行推理
-//        std::vector<const char*> input_names = {input_name.c_str()};
-//        std::vector<const char*> output_names = {output_name.c_str()};
-//        std::vector<Ort::Value> output_tensors = onnx_session->Run(
-//                Ort::RunOptions{nullptr}, input_names.data(), &input_tensor, 1, output_names.data(), 1
-//        );
-//
-//        // 获取输出数据
-//        const auto* output_data = output_tensors.front().GetTensorData<float>();
-//
-//        // 获取预测的端到端时间和执行时间
-//        float ete_time = output_data[0];  // 预测的 ete_time
-//        float exe_time = output_data[1];  // 预测的 exe_time
-//        //std::cout << "predict all ete_time: " << ete_time << std::endl;
-//        //std::cout << "predict al exec_time: " << exe_time << std::endl;
-//        // 存储该平台的结果
-//        platform_times.emplace_back(platform_input.platform, ete_time, exe_time);
-//    }
-//    // 选择ete_time最小的平台
-//    auto min_ete_time_platform = std::min_element(platform_times.begin(), platform_times.end(),
-//                                                  [](const std::tuple<int, float, float>& a, const std::tuple<int, float, float>& b) {
-//                                                      return std::get<1>(a) < std::get<1>(b);  // 比较ete_time
-//                                                  });
-//
-//    // 输出最优平台的预测结果
-//    int devicetype=std::get<0>(*min_ete_time_platform);
-//    //cout<<"devicetype:"<<devicetype<<endl;
-//    std::cout << "predict ete_time: " << std::get<1>(*min_ete_time_platform) << std::endl;
-//    //std::cout << "predict exec_time: " << std::get<2>(*min_ete_time_platform) << std::endl;
-//    for (const auto &[device_id, device] : device_static_info) {
-//        if (devicetype == encodePlatform(device.type) ) {
-//            cout<<"DEVICE: ";
-//            switch (device.type)
-//            {
-//                case RK3588:
-//                std:cout<<"RK3588";
-//                    break;
-//                case ATLAS_L:
-//                    cout<<"ATLAS_L";
-//                    break;
-//                case ATLAS_H:
-//                    cout<<"ATLAS_H";
-//                    break;
-//                case ORIN:
-//                    cout<<"ORIN";
-//                    break;
-//                default:
-//                    cout<<"un_known?";
-//                    break;
-//            }
-//            cout<<endl;
-//            return device;
-//        }
-//    }
-//    throw std::runtime_error("cannot decide a device");
-//}
 
-Device Docker_scheduler::Pic_Schedule(TaskType Ttype) {
-    // Step 1. 快照一份设备ID列表
-    std::vector<DeviceID> device_ids;
-    {
-        std::shared_lock<std::shared_mutex> lock(devs_mutex);
-        device_ids.reserve(device_status.size());
-        for (const auto& [device_id, _] : device_status) {
-            device_ids.push_back(device_id);
+Device Docker_scheduler::Model_predict(TaskType Ttype) {
+    // 网关启动时按 --config_path 加载模型；当时没加载成功的，这里按同一路径重试
+    if (!GetLatencyModel()) {
+        std::string model_path;
+        {
+            std::lock_guard<std::mutex> lock(latency_model_path_mutex_);
+            model_path = latency_model_path_;
+        }
+        if (model_path.empty() || !loadModel(model_path)) {
+            throw std::runtime_error("latency model is not loaded");
         }
-    } // 锁在这里释放，之后不再持有
+    }
+    // 和原 onnx 版本一样对所有在线设备做预测，不限于已部署该服务的设备
+    const ClusterStatePtr state = GetClusterState();
+    return PredictPolicy::Select(*state, state->online_ids, Ttype);
+}
 
-    return selectDeviceByLoad(device_ids);
+Device Docker_scheduler::Pic_Schedule(TaskType Ttype) {
+    // Step 1. 取当前集群快照里的在线设备列表（无锁）
+    const ClusterStatePtr state = GetClusterState();
+    return LoadPolicy::Select(*state, state->online_ids, Ttype);
 }
 
 
 //轮询分配
 Device Docker_scheduler::RoundRobin_Schedule(TaskType Ttype) {
-    std::shared_lock<std::shared_mutex> lock(devs_mutex);
-    auto start_time = std::chrono::high_resolution_clock::now();
-    if (device_status.empty()) {
-        throw std::runtime_error("No available devices for scheduling.");
-    }
-
-    //  获取设备 ID 列表
-    std::vector<DeviceID> ids;
-    if (Ttype != TaskType::Unknown) {
-        for (const auto& [device_id, services] : device_active_services) {
-            if (device_status.find(device_id) == device_status.end()) {
-                continue;
-            }
-            if (std::find(services.begin(), services.end(), Ttype) != services.end()) {
-                ids.push_back(device_id);
-            }
-        }
-        if (ids.empty()) {
-            auto it = tdMap.find(Ttype);
-            if (it != tdMap.end()) {
-                ids.reserve(it->second.size());
-                for (const auto& [device_id, _] : it->second) {
-                    if (device_status.find(device_id) != device_status.end()) {
-                        ids.push_back(device_id);
-                    }
-                }
-            }
-        }
-    }
-    if (ids.empty()) {
-        ids.reserve(device_status.size());
-        for (const auto& [device_id, _] : device_status) {
-            ids.push_back(device_id);
-        }
-    }
-
-    //  取当前索引对应的设备
-    DeviceID selected_id = ids[rr_index % ids.size()];
-
-    //  更新索引，准备下次轮询
-    rr_index = (rr_index + 1) % ids.size();
-
-    spdlog::info("RoundRobin selected device: {}", device_static_info[selected_id].ip_address);
-    // 记录结束时间
-    auto end_time = std::chrono::high_resolution_clock::now();
-    // 计算耗时（单位：毫秒）
-    auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-
-    spdlog::info("[RoundRobin] Execution time: {} ms", duration_ms);
-    return device_static_info[selected_id];
+    const ClusterStatePtr state = GetClusterState();
+    return RoundRobinPolicy::Select(*state, state->Candidates(Ttype), Ttype);
 }
 
 bool Docker_scheduler::Disconnect_device(Device device) {
@@ -1736,6 +3093,7 @@ bool Docker_scheduler::Disconnect_device(Device device) {
         auto it = device_status.find(device.global_id);
         if (it != device_status.end()) {
             device_status.erase(it);
+            PublishClusterStateLocked();
             removed = true;
         } else {
             spdlog::warn("Device {} not found in device_status.", boost::uuids::to_string(device.global_id));
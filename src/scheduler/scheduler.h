@@ -9,17 +9,28 @@
 #include <deque>
 #include <unordered_map>
 #include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <httplib.h>
 #include <nlohmann/json.hpp>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <condition_variable>
 #include <boost/uuid/uuid_hash.hpp>
 #include "device.h"
+#include "LatencyPredictor.h"
+#include "ServiceTimeModel.h"
+#include "TelemetryCollector.h"
+#include "TelemetryReceiver.h"
 #include <optional>
 #include <unordered_set>
 #include "spdlog/spdlog.h"
 #include "TimeRecorder.h"
+#include "ConnectionPool.h"
+#include "PayloadStream.h"
 //#include <cpu_provider_factory.h>
 //#include <provider_options.h>
 //#include <onnxruntime_cxx_api.h>
@@ -34,14 +45,17 @@ enum class TaskStatus {
 
 enum class ScheduleStrategy {
     LOAD_BASED,
-    ROUND_ROBIN
+    ROUND_ROBIN,
+    COMPLETION_TIME, // profiled proc_time x backlog + transfer time, earliest finish wins
+    PREDICTED        // latency model (LatencyPredictor) end-to-end time, lowest wins
 };
 
 enum class TaskProgressStatus {
     WAITING,
     RUNNING,
     RESULT_READY,
-    SENT
+    SENT,
+    FAILED // retries exhausted, counted in ProgressCounters::failed
 };
 
 struct ImageTask {
@@ -54,6 +68,33 @@ struct ImageTask {
     ScheduleStrategy schedule_strategy{ScheduleStrategy::LOAD_BASED};
     int retry_count{0};
     TaskStatus status{TaskStatus::PENDING};
+    int64_t deadline_ms{0}; // client deadline (epoch ms), 0 = none
+    int64_t enqueue_time_ms{0}; // client request arrival (epoch ms), kept when the task is retried or recovered
+    uint64_t payload_bytes{0}; // bytes uploaded to the device, set on dispatch
+    int64_t dispatch_time_ms{0}; // upload finished (epoch ms), set by AddRunningTask
+    size_t dispatch_ahead{0};    // tasks already running on the device at that moment
+    bool speculative{false};     // backup copy of a straggler, tracked by SpeculationTracker only
+};
+
+// 每个设备的图片上传统计：bytes_copied 为 gateway 在用户态复制的图片字节数，mmap 路径下应为 0
+struct PayloadStats {
+    uint64_t tasks{0};
+    uint64_t bytes_sent{0};
+    uint64_t bytes_copied{0};
+    uint64_t mmap_fallbacks{0};
+};
+
+// master 侧的在途账本：下发、完成时即时更新，两次遥测之间据此估计设备的真实负载，避免突发请求扎堆到同一台设备
+struct DeviceInflight {
+    size_t queued_tasks{0};    // waiting in the device's dispatch queue
+    size_t uploading_tasks{0}; // popped by a dispatch worker, upload not finished (CreditUsage::uploading)
+    size_t running_tasks{0};   // uploaded, completion not reported yet
+    uint64_t running_bytes{0}; // payload bytes of the running tasks
+    size_t since_sample{0};    // tasks uploaded after the device's last telemetry sample and still running
+    // a task of a sub-request still being uploaded may already count as running until its upload ends
+    size_t outstanding() const { return queued_tasks + uploading_tasks + running_tasks; }
+    /// @brief tasks whose load the last telemetry sample cannot contain yet
+    size_t unsampled() const { return queued_tasks + uploading_tasks + since_sample; }
 };
 
 struct ClientRequest {
@@ -63,6 +104,7 @@ struct ClientRequest {
     ScheduleStrategy schedule_strategy{ScheduleStrategy::LOAD_BASED};
     int total_num{0};
     int64_t enqueue_time_ms{0};
+    int64_t deadline_ms{0}; // from /schedule deadline_ms or enqueue + slo_ms, 0 = none
     std::vector<ImageTask> tasks;
     std::vector<std::string> sub_req_ids;
 };
@@ -75,10 +117,11 @@ struct SubRequest {
     ScheduleStrategy schedule_strategy{ScheduleStrategy::LOAD_BASED};
     int sub_req_count{0};
     int64_t enqueue_time_ms{0};
-    int64_t expected_end_time_ms{0};
+    int64_t expected_end_time_ms{0}; // client deadline, 0 = none
     DeviceID dst_device_id{};
     std::string dst_device_ip;
     std::vector<ImageTask> tasks;
+    bool speculative{false}; // single backup copy of a straggler: never re-routed, stolen or re-tracked
 };
 
 struct TaskProgress {
@@ -90,6 +133,30 @@ struct TaskProgress {
     TaskProgressStatus status{TaskProgressStatus::WAITING};
 };
 
+// task counts per TaskProgressStatus, updated on every transition instead of rescanned per query
+struct ProgressCounters {
+    int waiting{0};
+    int running{0};
+    int result_ready{0};
+    int sent{0};
+    int failed{0};
+
+    int &At(TaskProgressStatus status) {
+        switch (status) {
+            case TaskProgressStatus::RUNNING:
+                return running;
+            case TaskProgressStatus::RESULT_READY:
+                return result_ready;
+            case TaskProgressStatus::SENT:
+                return sent;
+            case TaskProgressStatus::FAILED:
+                return failed;
+            default:
+                return waiting;
+        }
+    }
+};
+
 struct SubReqProgress {
     std::string sub_req_id;
     std::string req_id;
@@ -97,6 +164,7 @@ struct SubReqProgress {
     std::string device_id;
     std::string device_ip;
     std::vector<std::string> task_ids;
+    ProgressCounters counters;
 };
 
 struct ReqProgress {
@@ -105,6 +173,30 @@ struct ReqProgress {
     std::string tasktype;
     int total{0};
     std::vector<std::string> sub_req_ids;
+    ProgressCounters counters; // sum over sub_req_ids; counters.failed = tasks that exhausted their retries
+    int64_t finished_time_ms{0};   // set once every task is sent or failed
+    int64_t deadline_ms{0};
+    int deadline_missed{0};        // tasks whose result was sent after deadline_ms
+};
+
+// 已结束请求的保留策略：超过 TTL 或超出数量上限的请求从实时表移入归档环
+struct RetentionOptions {
+    int64_t finished_ttl_ms = 10 * 60 * 1000; // finished requests stay fully queryable this long
+    size_t max_finished = 1000;               // ... and at most this many of them
+    size_t archive_capacity = 10000;          // packed summaries kept after eviction, oldest overwritten
+};
+
+// 归档后的请求摘要，只保留 /req 需要的字段
+struct ArchivedReq {
+    std::string req_id;
+    std::string client_ip;
+    std::string tasktype;
+    int32_t total{0};
+    int32_t sub_req_count{0};
+    int32_t deadline_missed{0};
+    int64_t deadline_ms{0};
+    ProgressCounters counters;
+    int64_t finished_time_ms{0};
 };
 
 class RequestTracker {
@@ -114,18 +206,37 @@ public:
     void OnTaskRunning(const std::string &task_id);
     void OnTaskResultReady(const std::string &task_id);
     void OnTaskSent(const std::string &task_id);
+    void OnTaskFailed(const std::string &task_id);
+    void SetRetention(const RetentionOptions &options);
     nlohmann::json BuildSnapshot(const std::string &client_ip) const;
     nlohmann::json BuildReqList(const std::string &client_ip) const;
     std::optional<nlohmann::json> BuildReqDetail(const std::string &req_id) const;
     std::optional<nlohmann::json> BuildSubReqDetail(const std::string &sub_req_id) const;
+    /// @brief (tasks not sent or failed yet, total) of a live request
+    std::optional<std::pair<int, int>> RemainingTasks(const std::string &req_id) const;
+    std::optional<TaskProgressStatus> GetTaskStatus(const std::string &task_id) const;
     std::unordered_map<std::string, nlohmann::json> BuildDeviceSubReqs(
         const std::unordered_set<std::string> &pending_ids) const;
 
 private:
+    // add/remove one task's status to the counters of its sub-request and request
+    void CountTask(const TaskProgress &tp, int delta);
+    void SetTaskStatus(TaskProgress &tp, TaskProgressStatus status);
+    void MaybeFinish(const std::string &req_id, int64_t now_ms);
+    // archive and drop finished requests past the TTL / count limit
+    void EvictFinished(int64_t now_ms);
+    void Archive(const ReqProgress &req);
+
     mutable std::mutex mutex_;
     std::unordered_map<std::string, ReqProgress> reqs_;
     std::unordered_map<std::string, SubReqProgress> sub_reqs_;
     std::unordered_map<std::string, TaskProgress> tasks_;
+
+    RetentionOptions retention_;
+    std::deque<std::string> finished_order_;               // finished req_ids, oldest first
+    std::vector<ArchivedReq> archive_;                     // ring buffer
+    size_t archive_next_{0};
+    std::unordered_map<std::string, size_t> archive_index_; // req_id -> ring slot
 };
 
 struct StaticInfoItem {
@@ -154,11 +265,272 @@ struct StaticInfoItem {
 };
 
 
+// 按截止时间排序的队列（EDF）：key 越小越先出队，key 相同按入队顺序，high_priority 只在同 key 内插队
+class DeadlineQueue {
+public:
+    void Push(SubRequest sub_req, int64_t key, bool high_priority);
+    SubRequest Pop();
+    /// @brief least urgent sub-request (largest key), the one work stealing takes
+    SubRequest PopBack();
+    const SubRequest &Front() const { return items_.begin()->second; }
+    const SubRequest &Back() const { return std::prev(items_.end())->second; }
+    bool empty() const { return items_.empty(); }
+    size_t size() const { return items_.size(); }
+    template <typename Fn>
+    void ForEach(Fn &&fn) const {
+        for (const auto &pair : items_) {
+            fn(pair.second);
+        }
+    }
+    std::vector<SubRequest> Drain();
+
+private:
+    std::map<std::pair<int64_t, int64_t>, SubRequest> items_; // (key, seq) -> sub-request
+    int64_t front_seq_{0};
+    int64_t back_seq_{0};
+};
+
+struct FlowStats {
+    uint64_t enqueued_tasks{0}; // pushed and not put back (Unpop / StealBack)
+    uint64_t dequeued_sub_reqs{0};
+    uint64_t dequeued_tasks{0};
+    int64_t total_wait_ms{0}; // enqueue_time_ms -> dequeue, summed over dequeued sub-requests
+    int64_t max_wait_ms{0};
+};
+
+// 按 (client_ip, TaskType) 分流的加权公平队列：流之间做加权 deficit round robin（以任务数计费），
+// 流内仍按 DeadlineQueue 的截止时间出队；一个大请求只占用自己那一份带宽
+class FairQueue {
+public:
+    struct Flow {
+        std::string client_ip;
+        TaskType task_type{TaskType::Unknown};
+        int weight{1};
+        int64_t deficit{0};
+        size_t queued_tasks{0};
+        bool active{false};
+        int64_t last_active_ms{0}; // last push / pop, an empty flow idle for kFlowIdleMs is pruned
+        DeadlineQueue queue;
+        FlowStats stats;
+    };
+
+    static constexpr int64_t kFlowIdleMs = 60000;
+
+    void Push(SubRequest sub_req, int64_t key, int weight, bool high_priority);
+    SubRequest Pop();
+    /// @brief DRR pop over the flows whose task type passes eligible; call only when HasEligible(eligible)
+    SubRequest Pop(const std::function<bool(TaskType)> &eligible);
+    bool HasEligible(const std::function<bool(TaskType)> &eligible) const;
+    /// @brief put back the unsent tail of a popped sub-request at the head of its flow; it counts as never dequeued
+    void Unpop(SubRequest sub_req, int64_t key, int weight);
+    /// @brief least urgent sub-request of a flow whose task type passes can_run; the victim's DRR order is untouched
+    template <typename Pred>
+    std::optional<SubRequest> StealBack(Pred &&can_run);
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    size_t queued_tasks() const { return queued_tasks_; }
+    template <typename Fn>
+    void ForEach(Fn &&fn) const {
+        for (const auto &pair : flows_) {
+            pair.second.queue.ForEach(fn);
+        }
+    }
+    template <typename Fn>
+    void ForEachFlow(Fn &&fn) const {
+        for (const auto &pair : flows_) {
+            fn(pair.first, pair.second);
+        }
+    }
+    std::vector<SubRequest> Drain();
+    size_t flow_count() const { return flows_.size(); }
+    /// @brief drop empty flows idle for at least idle_ms, with their stats; Push does this once per kFlowIdleMs
+    size_t PruneIdleFlows(int64_t now_ms, int64_t idle_ms);
+
+    static std::string FlowKey(const std::string &client_ip, TaskType task_type);
+
+private:
+    std::unordered_map<std::string, Flow> flows_; // one per (client_ip, task_type) seen within kFlowIdleMs
+    std::deque<std::string> active_; // round-robin order of non-empty flows
+    size_t size_{0};
+    size_t queued_tasks_{0};
+    int64_t last_prune_ms_{0};
+};
+
+template <typename Pred>
+std::optional<SubRequest> FairQueue::StealBack(Pred &&can_run) {
+    for (auto flow_it = flows_.begin(); flow_it != flows_.end(); ++flow_it) {
+        Flow &flow = flow_it->second;
+        // a speculative copy is already placed away from its primary, moving it again gains nothing
+        if (!flow.active || !can_run(flow.task_type) || flow.queue.Back().speculative) {
+            continue;
+        }
+        SubRequest sub_req = flow.queue.PopBack();
+        flow.queued_tasks -= sub_req.tasks.size();
+        queued_tasks_ -= sub_req.tasks.size();
+        // never dequeued here, so it does not count as enqueued either
+        flow.stats.enqueued_tasks -= std::min<uint64_t>(flow.stats.enqueued_tasks, sub_req.tasks.size());
+        size_--;
+        if (flow.queue.empty()) {
+            flow.deficit = 0;
+            flow.active = false;
+            active_.erase(std::find(active_.begin(), active_.end(), flow_it->first));
+        }
+        return sub_req;
+    }
+    return std::nullopt;
+}
+
+// 工作窃取计数：stolen_* 为本设备从别的设备队列里拿走的，given_tasks 为被别的设备拿走的
+struct StealStats {
+    uint64_t stolen_sub_reqs{0};
+    uint64_t stolen_tasks{0};
+    uint64_t given_tasks{0};
+};
+
+// 设备在途任务的 credit：uploading 为已出队、正在上传的任务，running 为已上传、完成未回报的任务。
+// 两者之和不超过该设备 (DeviceType, TaskType) 的上限，完成回报归还 credit；超出的任务留在 master 的设备队列里，仍可被窃取或重新路由
+struct CreditUsage {
+    size_t uploading{0};
+    size_t running{0};
+    size_t used() const { return uploading + running; }
+};
+
+struct DeviceCredits {
+    std::unordered_map<TaskType, CreditUsage> usage;
+    uint64_t deferred_tasks{0}; // tasks left queued because the device had no credit for them
+    uint64_t expired_credits{0}; // running credits given back because no result came within the timeout
+};
+
+// 在途上限配置：最具体的匹配生效，(设备类型, 任务类型) > 设备类型 > 任务类型 > 默认值；0 表示不限
+struct CreditLimits {
+    size_t default_limit{0};
+    std::map<DeviceType, size_t> by_device;
+    std::map<TaskType, size_t> by_tasktype;
+    std::map<std::pair<DeviceType, TaskType>, size_t> by_pair;
+
+    size_t Limit(DeviceType dtype, TaskType ttype) const;
+    bool empty() const { return default_limit == 0 && by_device.empty() && by_tasktype.empty() && by_pair.empty(); }
+};
+
+// 落后任务的推测执行：请求只剩尾部任务、某个任务超出所在设备的预期完成时间时，在另一台设备上再跑一份副本。
+// 两份中先在 /task_result_ready 认领的结果被发送，另一份被丢弃；副本数受预算（占已下发任务的百分比）限制。
+class SpeculationTracker {
+public:
+    static constexpr size_t kWindow = 1024;        // completions kept for the p99 metrics
+    static constexpr size_t kMaxResolved = 4096;   // finished copies remembered to suppress late duplicates
+    static constexpr int64_t kCopyTtlMs = 600000;  // a copy is forgotten this long after its launch, whatever its state
+
+    void SetBudget(int budget_pct);
+    bool Enabled() const;
+    void OnTaskDispatched();
+    bool IsSpeculated(const std::string &task_id) const;
+    /// @brief reserve a copy within the budget; false when the budget is used up or the task already has one
+    bool TryLaunch(const ImageTask &task, const DeviceID &primary, const DeviceID &backup);
+    /// @brief the backup copy could not be uploaded
+    void Abandon(const std::string &task_id);
+    /// @brief the task will not complete through OnTaskCompleted (failed for good, result given up): forget its copy
+    void Drop(const std::string &task_id);
+    /// @brief forget copies launched kCopyTtlMs or more before now_ms
+    void ExpireCopies(int64_t now_ms);
+    /// @brief first result of a speculated task wins; false tells the reporting device to drop its result
+    bool ClaimResult(const std::string &reported_task_id, const std::optional<DeviceID> &reporter);
+    /// @brief the task completed (whichever copy); returns the device whose result won, nullopt if not speculated
+    std::optional<DeviceID> OnTaskCompleted(const std::string &reported_task_id, int64_t dispatch_time_ms);
+    nlohmann::json Stats() const;
+
+private:
+    struct Copy {
+        DeviceID primary;
+        DeviceID backup;
+        int64_t dispatch_time_ms{0}; // of the primary copy
+        std::optional<DeviceID> winner;
+        bool completed{false};
+        int64_t primary_result_ms{0}; // when a losing primary reported, 0 until then
+        size_t sample{0};             // slot of this task in samples_ once completed
+        uint64_t sample_seq{0};       // samples_seq_ + 1 at that time (0: no sample), to notice an overwritten slot
+        int64_t launch_ms{0};
+        uint64_t generation{0};       // launch number, tells this copy from a later one of the same stem
+    };
+    struct Sample {
+        double actual_ms{0.0};          // dispatch -> first result
+        double without_spec_ms{0.0};    // dispatch -> primary's result (lower bound until it reports)
+    };
+
+    void AddSample(Copy *copy, double latency_ms);
+
+    mutable std::mutex mutex_;
+    int budget_pct_{0};
+    uint64_t dispatched_{0};
+    uint64_t launched_{0};
+    uint64_t abandoned_{0};
+    uint64_t backup_won_{0};
+    uint64_t primary_won_{0};
+    uint64_t suppressed_{0};
+    uint64_t dropped_{0};
+    uint64_t expired_{0};
+    std::unordered_map<std::string, Copy> copies_; // normalized task stem -> copy
+    std::deque<std::pair<std::string, uint64_t>> resolved_; // (stem, generation) of completed copies, oldest first
+    std::vector<Sample> samples_;                  // ring buffer over all completions
+    uint64_t samples_seq_{0};
+};
+
 class TaskQueueManager {
 public:
+    /// @brief DRR weight of a flow is client weight * task type weight, both default 1
+    void SetFlowWeights(const std::unordered_map<std::string, int> &client_weights,
+                        const std::unordered_map<TaskType, int> &tasktype_weights);
+    /// @brief per-flow depth and wait metrics over the pending and device queues, served on /queues
+    nlohmann::json BuildQueueStats();
+    /// @brief queue key is min(expected_end_time_ms, enqueue_time_ms + max_wait_ms):
+    /// deadlines order the work, and anything older than max_wait_ms ages in ahead of fresh work
+    void SetMaxQueueWait(int64_t max_wait_ms);
     void PushPending(const SubRequest &sub_req, bool high_priority);
     std::optional<SubRequest> PopPending();
+    // per-device dispatch queues, filled by AllocateSubRequests / SchedulerLoop and drained by the device's workers
+    void PushDevice(const DeviceID &device_id, const SubRequest &sub_req, bool high_priority);
+    /// @brief credit_limit(ttype) is the device's in-flight limit for a task type (0 = unlimited). Only flows with a
+    /// free credit are served; a sub-request larger than the free credits is cut, the dispatched head goes out as
+    /// <sub_req_id>_c<n> and the tail stays queued. The returned tasks hold credits until ReleaseCredits.
+    using CreditLimitFn = std::function<size_t(TaskType)>;
+    std::optional<SubRequest> PopDevice(const DeviceID &device_id, const CreditLimitFn &credit_limit = nullptr);
+    /// @brief nullopt when the device's queue stays empty (or without credit) for wait
+    std::optional<SubRequest> PopDevice(const DeviceID &device_id, std::chrono::milliseconds wait,
+                                        const CreditLimitFn &credit_limit = nullptr);
+    /// @brief end of the upload attempt of a popped sub-request: tasks that made it hold their credit as running
+    void ReleaseCredits(const DeviceID &device_id, TaskType ttype, size_t count);
+    DeviceCredits GetDeviceCredits(const DeviceID &device_id);
+    /// @brief work stealing for an idle device: split the least urgent queued sub-request of the most backlogged
+    /// other device whose task type can_run accepts, keep the front half there and re-target the back half
+    /// (a single task moves whole) to thief as a new sub-request; RequestTracker follows the new placement
+    /// (with a credit_limit, only task types the thief has credit for, and at most that many tasks).
+    /// Backlogs are queued + uploading + running tasks: only victims at least kStealMinGap tasks heavier than
+    /// the thief qualify, and at most half the gap moves
+    std::optional<SubRequest> StealFor(const DeviceID &thief, const std::string &thief_ip,
+                                       const std::function<bool(TaskType)> &can_run,
+                                       const CreditLimitFn &credit_limit = nullptr);
+    StealStats GetStealStats(const DeviceID &device_id);
+    static constexpr size_t kStealMinGap = 4; // a thief is at least this many tasks lighter than its victim (hysteresis)
+    /// @brief running tasks for which is_straggler(device, task) holds; copies are taken under the queue lock.
+    /// Backup copies of speculated tasks are running tasks of their own device too (task.speculative)
+    template <typename Pred>
+    std::vector<std::pair<DeviceID, ImageTask>> FindRunning(Pred &&is_straggler);
+    /// @brief give back the running credit of every task for which is_overdue(device, task) holds, so a lost result
+    /// does not block the device's queue; the task stays running and a late result still completes it.
+    /// The task ids whose primary (not backup) credit expired are appended to expired_primaries
+    template <typename Pred>
+    size_t ExpireRunningCredits(Pred &&is_overdue, std::vector<std::string> *expired_primaries = nullptr);
+    size_t GetDeviceQueueDepth(const DeviceID &device_id);
+    /// @brief tasks queued for the device plus tasks dispatched to it and not completed yet
+    size_t GetDeviceBacklog(const DeviceID &device_id);
+    DeviceInflight GetDeviceInflight(const DeviceID &device_id);
+    /// @brief out[i] = GetDeviceInflight(ids[i]) for a whole candidate list under one lock, so scoring a decision
+    /// does not take the queue lock once per candidate
+    void GetDevicesInflight(const std::vector<DeviceID> &ids, std::vector<DeviceInflight> &out);
+    /// @brief a fresh telemetry sample of the device arrived: it now reflects everything already running
+    void OnTelemetrySample(const DeviceID &device_id);
     void RecoverTasks(const DeviceID &device_id);
+    /// @brief a backup copy (task.speculative) is charged to its own device, next to the primary's entry,
+    /// until either copy completes, the task fails or the backup's device is recovered
     bool AddRunningTask(const DeviceID &device_id, const ImageTask &task);
     std::optional<ImageTask> CompleteTaskAndGet(const std::string &reported_task_id);
     bool CompleteTask(const std::string &task_id);
@@ -166,13 +538,116 @@ public:
     std::vector<std::string> GetPendingSubReqIds();
 
 private:
-    std::deque<SubRequest> pending_queue_;
+    struct DeviceQueue {
+        FairQueue queue;
+        std::condition_variable cv;
+    };
+    // where a running task lives: its device's list and the node inside it (list iterators stay valid)
+    struct RunningEntry {
+        DeviceID device_id;
+        std::list<ImageTask>::iterator it;
+        bool holds_credit{true}; // false once ExpireRunningCredits gave the credit back
+    };
+
+    void IndexRunningTask(const DeviceID &device_id, std::list<ImageTask>::iterator it);
+    void UnindexRunningTask(const ImageTask &task);
+    /// @brief the running backup copy of the task's stem, if any, stops counting against its device
+    void DropBackupLocked(const std::string &task_id);
+    void RecordFailed(const ImageTask &task);
+    void ReleaseInflight(const DeviceID &device_id, const ImageTask &task);
+    int64_t QueueKey(const SubRequest &sub_req) const;
+    int FlowWeight(const SubRequest &sub_req) const;
+    /// @brief pop + credit reservation, mutex_ held; cut is set when the tail of the sub-request stayed queued
+    SubRequest PopWithCredits(DeviceQueue &dq, const DeviceID &device_id, const CreditLimitFn &credit_limit, bool &cut);
+    bool HasCredit(const DeviceID &device_id, const CreditLimitFn &credit_limit, TaskType ttype) const;
+    void ReleaseRunningCredit(const DeviceID &device_id, TaskType ttype);
+    /// @brief queued + uploading + running tasks of the device, mutex_ held
+    size_t BacklogLocked(const DeviceID &device_id) const;
+    DeviceInflight InflightLocked(const DeviceID &device_id) const;
+
+    int64_t max_queue_wait_ms_{30000};
+    std::unordered_map<std::string, int> client_weights_;
+    std::unordered_map<TaskType, int> tasktype_weights_;
+    FairQueue pending_queue_; // sub-requests without a target device
+    std::unordered_map<DeviceID, DeviceQueue> device_queues_;
     std::unordered_map<DeviceID, std::list<ImageTask>> running_index_;
-    std::list<ImageTask> failed_history_;
+    std::unordered_map<std::string, RunningEntry> running_by_id_;        // task_id -> running task
+    std::unordered_multimap<std::string, std::string> running_by_stem_;  // normalized stem -> task_id
+    std::unordered_map<std::string, RunningEntry> backups_by_stem_;     // normalized stem -> running backup copy
+    std::deque<ImageTask> failed_history_; // most recent kMaxFailedHistory failures
+    std::unordered_map<DeviceID, DeviceInflight> inflight_; // running_bytes / since_sample per device
+    std::unordered_map<DeviceID, StealStats> steal_stats_;
+    uint64_t steal_seq_{0}; // suffix of the sub_req_ids created by stealing
+    std::unordered_map<DeviceID, DeviceCredits> credits_;
+    uint64_t credit_seq_{0}; // suffix of the sub_req_ids cut off by credit limits
     std::mutex mutex_;
     std::condition_variable pending_cv_;
 };
 
+template <typename Pred>
+std::vector<std::pair<DeviceID, ImageTask>> TaskQueueManager::FindRunning(Pred &&is_straggler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<DeviceID, ImageTask>> out;
+    for (const auto &[device_id, tasks] : running_index_) {
+        for (const auto &task : tasks) {
+            if (is_straggler(device_id, task)) {
+                out.emplace_back(device_id, task);
+            }
+        }
+    }
+    return out;
+}
+
+template <typename Pred>
+size_t TaskQueueManager::ExpireRunningCredits(Pred &&is_overdue, std::vector<std::string> *expired_primaries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t expired = 0;
+    auto expire = [&](RunningEntry &entry) {
+        if (!entry.holds_credit || !is_overdue(entry.device_id, *entry.it)) {
+            return false;
+        }
+        entry.holds_credit = false;
+        ReleaseRunningCredit(entry.device_id, entry.it->task_type);
+        credits_[entry.device_id].expired_credits++;
+        expired++;
+        return true;
+    };
+    for (auto &[task_id, entry] : running_by_id_) {
+        if (expire(entry) && expired_primaries != nullptr) {
+            expired_primaries->push_back(task_id);
+        }
+    }
+    for (auto &[stem, entry] : backups_by_stem_) {
+        expire(entry);
+    }
+    return expired;
+}
+
+// 集群状态的不可变快照：写者在 devs_mutex 下改完权威表后整体发布新版本，调度读路径只 load 一次指针、全程无锁
+struct ClusterState {
+    uint64_t version{0};
+    std::map<DeviceID, Device> devices;                            // device_static_info
+    std::map<DeviceID, DeviceStatus> status;                       // device_status, key present = online
+    std::map<DeviceID, std::vector<TaskType>> active_services;     // device_active_services
+    std::map<TaskType, std::vector<DeviceID>> task_devices;        // tdMap membership (container state stays in tdMap)
+    // 发布时预先算好的候选索引：调度时按 TaskType 直接取引用，不再扫描服务列表、不分配内存
+    std::vector<DeviceID> online_ids;                              // every online device, the generic fallback
+    std::unordered_map<TaskType, std::vector<DeviceID>> candidates; // online devices running / supporting a task type
+
+    bool IsOnline(const DeviceID &id) const { return status.find(id) != status.end(); }
+    /// @brief online devices with the service started, else online devices tdMap lists for it, else all online devices
+    const std::vector<DeviceID> &Candidates(TaskType ttype) const {
+        if (ttype != TaskType::Unknown) {
+            auto it = candidates.find(ttype);
+            if (it != candidates.end() && !it->second.empty()) {
+                return it->second;
+            }
+        }
+        return online_ids;
+    }
+};
+using ClusterStatePtr = std::shared_ptr<const ClusterState>;
+
 class Docker_scheduler {
 private:
     static std::map<TaskType, std::map<DeviceType, StaticInfoItem> > static_info; // static task info
@@ -186,20 +661,60 @@ private:
     // static std::shared_mutex td_map_mutex_; // Thread-safe mutex for TDMap
     static std::map<TaskType, std::map<DeviceID, DevSrvInfos> > tdMap;
 
+    static ClusterStatePtr cluster_state_; // only touched through std::atomic_load / std::atomic_store
+    static uint64_t cluster_version_;      // guarded by devs_mutex
+
     //  dynamic device info unorder_map becaues of uuid_t cant compare for the need of map
 
     int scheduling_trget; // current scheduling_target
     static TaskQueueManager task_queue_manager_;
+    static ServiceTimeModel service_times_; // learned from /task_completed
+    static TelemetryCollector telemetry_;   // concurrent /usage/device_info polling
+    static TelemetryReceiver telemetry_push_; // samples pushed by agents over udp
+    static int telemetry_udp_port_;           // 0 = do not listen for pushed telemetry
     static std::once_flag scheduler_loop_once_flag_;
     static RequestTracker request_tracker_;
-
-    static Device selectDeviceByLoad(const std::vector<DeviceID>& devIds);
-
-    //onnx
-//    static Ort::Env env;
-//    static Ort::Session* onnx_session;  // 使用指针避免初始化时构造
-    static bool is_model_loaded;  // 标记模型是否已加载
-    static size_t rr_index; // 轮询用的索引
+    static SpeculationTracker speculation_;
+
+    static std::mutex dispatch_workers_mutex_;
+    static std::unordered_set<DeviceID> dispatch_workers_; // devices whose worker pool is already running
+    static int dispatch_workers_per_device_;
+    static ConnectionPool dispatch_pool_; // keep-alive connections to slave recv_server
+    static bool batch_upload_;            // meta + all images of a sub-request in one request
+    static std::mutex batch_unsupported_mutex_;
+    static std::unordered_set<DeviceID> batch_unsupported_; // answered 404 to /recv_sub_req_batch, until it re-registers
+    static int max_sub_req_tasks_;        // split a device's share into sub-requests of at most this many tasks
+    static int sample_choices_;           // power-of-d-choices for single-task placement, 0 = score every candidate
+    static int steal_idle_ms_;            // an idle dispatch worker steals after waiting this long, 0 = never
+    static CreditLimits credit_limits_;   // per-device in-flight task limits, set once at startup
+    static std::mutex payload_stats_mutex_;
+    static std::unordered_map<DeviceID, PayloadStats> payload_stats_;
+
+    static void DispatchWorkerLoop(DeviceID device_id);
+    /// @brief watch running tasks: launch backup copies of stragglers (SpeculationTracker) and expire the credits
+    /// of tasks whose result is long overdue
+    static void RunningTasksLoop();
+    static void SpeculateStragglers();
+    static void ExpireOverdueCredits();
+    /// @brief link latency plus the service time of the task and of everything running ahead of it at dispatch
+    static std::optional<double> ExpectedRunningMs(const ClusterState &state, const DeviceID &device_id,
+                                                   const ImageTask &task);
+    /// @brief an idle worker of device_id takes part of another device's queued work (TaskQueueManager::StealFor)
+    static std::optional<SubRequest> StealWork(const DeviceID &device_id, const TaskQueueManager::CreditLimitFn &credit_limit);
+    static bool DispatchSubRequest(const Device &target_device, SubRequest &sub_req);
+    // nullopt: the slave does not support batched upload
+    static std::optional<bool> DispatchSubRequestBatch(const Device &target_device, SubRequest &sub_req);
+    static void RequeueTask(ImageTask &task);
+    static std::shared_ptr<MappedFile> OpenTaskFile(const ImageTask &task);
+    static void RecordPayload(const DeviceID &device_id, const MappedFile &file);
+
+    static Device selectDeviceByLoad(const std::vector<DeviceID>& devIds, TaskType ttype = TaskType::Unknown);
+    /// @brief copy the authoritative maps into a new ClusterState and publish it; caller holds devs_mutex exclusively
+    static void PublishClusterStateLocked();
+
+    static std::shared_ptr<const LatencyPredictor> latency_model_; // null until loadModel succeeds; atomic_load / atomic_store
+    static std::mutex latency_model_path_mutex_;
+    static std::string latency_model_path_; // last path given to loadModel, Model_predict retries it
 public:
     Docker_scheduler();
 
@@ -227,6 +742,23 @@ public:
     // Methods to access device status information for logging
     static std::map<DeviceID, DeviceStatus>& getDeviceStatus() { return device_status; }
     static std::shared_mutex& getDeviceMutex() { return devs_mutex; }
+    /// @brief current cluster snapshot, never null; readers keep the pointer for the whole decision
+    static ClusterStatePtr GetClusterState();
+
+    // building blocks shared by the scheduling policies (SchedulePolicy.h)
+    /// @brief profiled per-task overhead of ttype on dtype; unprofiled pairs use the task type's mean
+    static TaskOverhead ProfiledOverhead(TaskType ttype, DeviceType dtype);
+    static double ProcTimeMs(TaskType ttype, DeviceType dtype);
+    /// @brief per-task service time of ttype on device: learned from /task_completed, ProcTimeMs before kMinSamples
+    static double ServiceTimeMs(TaskType ttype, const Device &device);
+    /// @brief weighted load score: last telemetry sample plus the profiled overhead of the tasks it has not seen yet
+    static double ProjectedLoad(const Device &device, const DeviceStatus &status, TaskType ttype, size_t unsampled);
+    /// @brief average uploaded bytes per task so far, a fixed guess before the first upload
+    static double EstimateTaskBytes();
+    /// @brief expected finish time (ms from now) of the device if it gets extra_tasks more tasks
+    static double EstimateFinishMs(const Device &device, const DeviceStatus &status, TaskType ttype,
+                                   size_t backlog, size_t extra_tasks, double task_bytes);
+    static int SampleChoices() { return sample_choices_; }
 
     /// @brief init scheduler
     /// @param filepath profiling file path
@@ -238,6 +770,10 @@ public:
     static std::map<TaskType, std::map<DeviceType, StaticInfoItem>> getStaticInfo() ;
 
     static RequestTracker &GetRequestTracker();
+    static SpeculationTracker &GetSpeculation() { return speculation_; }
+    /// @brief first result of a task wins; false when the reporter's copy is a suppressed duplicate
+    static bool ClaimTaskResult(const std::string &task_id, const std::string &device_id, const std::string &remote_ip);
+    static void SetSpeculationBudget(int budget_pct);
 
     static ImageInfo getImage(TaskType taskType, DeviceType devType);
 
@@ -249,6 +785,8 @@ public:
     static bool HotStartAllNodeByTType(TaskType ttype);
 
     static void startDeviceInfoCollection();
+    /// @brief write fresh samples back (polled or pushed) in one critical section and publish once
+    static void ApplyTelemetrySamples(std::map<DeviceID, TelemetrySample> &samples);
 
     /// @brief route a srvinfo for a quest with a specific task type
     /// @param TaskType ttype
@@ -273,18 +811,40 @@ public:
     /// @param Ttype the type of target task 
     /// @return target device
     static Device Schedule(TaskType Ttype);
+    /// @brief pick a device for one task with the policy registered for strategy; falls back to round robin
+    static Device ScheduleWith(ScheduleStrategy strategy, TaskType Ttype);
+    /// @brief lowest predicted end-to-end time (ScheduleStrategy::PREDICTED); retries the configured model path
+    /// when no model is loaded yet
     static Device Model_predict(TaskType Ttype);
     static Device Pic_Schedule(TaskType Ttype);
-    // 模型加载函数
-    static void loadModel(const std::string& model_path);
+    // 模型加载函数：读取线性模型系数并原子替换当前模型，失败时保留旧模型；路径会被记下，供 Model_predict 重试
+    static bool loadModel(const std::string& model_path);
+    static std::shared_ptr<const LatencyPredictor> GetLatencyModel();
     static int encodeTaskType(TaskType Ttype);
     static int encodePlatform(DeviceType dtype);
 
     static Device RoundRobin_Schedule(TaskType Ttype);
+    /// @brief earliest estimated finish time among the candidates (ScheduleStrategy::COMPLETION_TIME)
+    static Device CompletionTime_Schedule(TaskType Ttype);
 
     static bool Disconnect_device(Device device);
     static void StartSchedulerLoop();
+    /// @brief route sub-requests without a target device into the per-device dispatch queues
     static void SchedulerLoop();
+    /// @brief start the bounded dispatch worker pool of a device (idempotent)
+    static void EnsureDispatchWorkers(const DeviceID &device_id);
+    static void SetDispatchWorkersPerDevice(int workers);
+    static void SetBatchUpload(bool enabled);
+    static void SetMaxQueueWait(int64_t max_wait_ms);
+    static void SetMaxSubRequestTasks(int max_tasks);
+    static void SetSampleChoices(int choices);
+    static void SetStealIdleMs(int idle_ms);
+    static void SetCreditLimits(const CreditLimits &limits);
+    static void SetTelemetryDeadlineMs(int deadline_ms);
+    static void SetTelemetryUdpPort(int port);
+    static void SetFlowWeights(const std::unordered_map<std::string, int> &client_weights,
+                               const std::unordered_map<TaskType, int> &tasktype_weights);
+    static json BuildQueueSnapshot();
     static void SubmitTask(const ImageTask &task, bool high_priority = false);
     static void SubmitSubRequest(const SubRequest &sub_req, bool high_priority = false);
     static void SubmitClientRequest(const ClientRequest &req);
@@ -298,9 +858,11 @@ public:
     }
 
     void updateStatus(DeviceID id,DeviceStatus status){
+        std::unique_lock<std::shared_mutex> lock(devs_mutex);
         device_status[id].cpu_used+=status.cpu_used;
         device_status[id].mem_used+=status.mem_used;
         device_status[id].xpu_used+=status.xpu_used;
+        PublishClusterStateLocked();
     }
     void regissrv(DeviceID id,TaskType ttype){
         if(tdMap[ttype][id].dev_srv_info_status == NoExist){
@@ -309,6 +871,7 @@ public:
     }
 
     static TaskQueueManager& GetTaskQueueManager() { return task_queue_manager_; }
+    static ServiceTimeModel& GetServiceTimes() { return service_times_; }
 
 
 };
@@ -1,8 +1,35 @@
 #include <spdlog/spdlog.h>
+#include <filesystem>
+#include <fstream>
 #include <vector>
 #include <gtest/gtest.h>
 #include <nlohmann/json.hpp>
 #include<scheduler.h>
+#include "LatencyPredictor.h"
+
+namespace {
+nlohmann::json ModelJson() {
+    return {
+            {"features", {"cpu_used", "xpu_used", "cpu_square", "xpu_square", "cpu_xpu", "platform", "tasktype"}},
+            {"ete_time", {{"intercept", 10.0}, {"weights", {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0}}}},
+            {"exec_time", {{"intercept", 1.0}, {"weights", {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0}}}}
+    };
+}
+
+std::string WriteModel(const std::string &name, const nlohmann::json &j) {
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::ofstream(path) << j.dump();
+    return path.string();
+}
+
+// 与 PredictPolicy 相同的打分：遥测样本 + 平台编码 -> 预测端到端时间
+double PredictedEte(const LatencyPredictor &model, const DeviceStatus &status, DeviceType dtype, TaskType ttype) {
+    LatencyPredictor::Batch batch;
+    batch.Add(status.cpu_used, status.xpu_used, Docker_scheduler::encodePlatform(dtype));
+    model.PredictBatch(batch, Docker_scheduler::encodeTaskType(ttype));
+    return batch.ete_ms[0];
+}
+} // namespace
 nlohmann::json json_atlas_h = {
         {"type",       "ATLAS_H"},
         {"global_id",  "123e4567-e89b-12d3-a456-426614174584"},
@@ -27,21 +54,30 @@ nlohmann::json yolo43588 = {
         {"cpu_used", 0.05},
         {"xpu_used", 0.07},
         {"net_latency", 0},
-        {"net_bandwidth",0}
+        {"net_bandwidth",0},
+        {"disconnectTime",0},
+        {"reconnectTime",0},
+        {"timeWindow",0}
 };
 nlohmann::json yolo4Atlas_h = {
         {"mem", 0.1},
         {"cpu_used", 0.08},
         {"xpu_used", 0.03},
         {"net_latency", 0},
-        {"net_bandwidth",0}
+        {"net_bandwidth",0},
+        {"disconnectTime",0},
+        {"reconnectTime",0},
+        {"timeWindow",0}
 };
 nlohmann::json yolo4Atlas_l = {
         {"mem", 0.15},
         {"cpu_used", 0.05},
         {"xpu_used", 0.06},
         {"net_latency", 0},
-        {"net_bandwidth",0}
+        {"net_bandwidth",0},
+        {"disconnectTime",0},
+        {"reconnectTime",0},
+        {"timeWindow",0}
 };
 
 // test  parseJson and RegisNode
@@ -64,9 +100,58 @@ TEST(DeviceTest, ParseAndRegisterNodes) {
     //getchar();
 }
 
+TEST(ModelTest, LoadRejectsMismatchedSchema) {
+    LatencyPredictor model;
+    ASSERT_TRUE(model.Load(WriteModel("latency_model_ok.json", ModelJson())));
+    EXPECT_FALSE(model.placeholder());
+
+    nlohmann::json reordered = ModelJson();
+    std::swap(reordered["features"][0], reordered["features"][1]);
+    EXPECT_FALSE(model.Load(WriteModel("latency_model_order.json", reordered)));
+
+    nlohmann::json short_weights = ModelJson();
+    short_weights["ete_time"]["weights"].erase(6);
+    EXPECT_FALSE(model.Load(WriteModel("latency_model_weights.json", short_weights)));
+
+    nlohmann::json no_exec = ModelJson();
+    no_exec.erase("exec_time");
+    EXPECT_FALSE(model.Load(WriteModel("latency_model_exec.json", no_exec)));
+
+    EXPECT_FALSE(model.Load(std::filesystem::temp_directory_path().string() + "/latency_model_missing.json"));
+    // a rejected file leaves the loaded coefficients in place
+    EXPECT_DOUBLE_EQ(model.ete().intercept, 10.0);
+    EXPECT_DOUBLE_EQ(model.ete().weights[6], 7.0);
+}
+
+TEST(ModelTest, RepoModelIsMarkedPlaceholder) {
+    LatencyPredictor model;
+    ASSERT_TRUE(model.Load("../../config_files/latency_model.json"));
+    EXPECT_TRUE(model.placeholder());
+}
+
+TEST(ModelTest, PredictBatchMatchesHandComputed) {
+    LatencyPredictor model;
+    ASSERT_TRUE(model.Load(WriteModel("latency_model_ok.json", ModelJson())));
+    LatencyPredictor::Batch batch;
+    batch.Add(0.5, 0.25, 2);
+    batch.Add(0.0, 1.0, 0);
+    model.PredictBatch(batch, 3);
+    ASSERT_EQ(batch.ete_ms.size(), 2u);
+    // 10 + 1*0.5 + 2*0.25 + 3*0.25 + 4*0.0625 + 5*0.125 + 6*2 + 7*3
+    EXPECT_DOUBLE_EQ(batch.ete_ms[0], 45.625);
+    // 10 + 2*1 + 4*1 + 7*3
+    EXPECT_DOUBLE_EQ(batch.ete_ms[1], 37.0);
+    // 1 + 0.5 + 0.25 + 0.25 + 0.0625 + 0.125 + 2 + 3
+    EXPECT_DOUBLE_EQ(batch.exec_ms[0], 7.1875);
+    EXPECT_DOUBLE_EQ(batch.exec_ms[1], 6.0);
+}
+
 TEST(StatusTest, Status_Update) {
     std::string test_file = "../../config_files/static_info.json";
     Docker_scheduler scheduler(test_file);
+    ASSERT_TRUE(Docker_scheduler::loadModel("../../config_files/latency_model.json"));
+    const auto model = Docker_scheduler::GetLatencyModel();
+    ASSERT_TRUE(model);
     int counter_atlas_h=0;
     int counter_atlas_l=0;
     int counter_rk3588=0;
@@ -74,6 +159,13 @@ TEST(StatusTest, Status_Update) {
         spdlog::info("Running Predict test iteration: {}", i + 1);
         Device target = Docker_scheduler::Model_predict(YoloV5);
         scheduler.display_devstatus(target.global_id);
+        // nothing is queued in this test, so the pick is the device with the lowest predicted ete
+        const ClusterStatePtr state = Docker_scheduler::GetClusterState();
+        const double target_ms = PredictedEte(*model, state->status.at(target.global_id), target.type, YoloV5);
+        for (const auto &device_id : state->online_ids) {
+            const Device &dev = state->devices.at(device_id);
+            EXPECT_LE(target_ms, PredictedEte(*model, state->status.at(device_id), dev.type, YoloV5));
+        }
         DeviceStatus newstatus;
         if(target.type==ATLAS_H){
             counter_atlas_h++;
@@ -108,4 +200,5 @@ TEST(StatusTest, Status_Update) {
     spdlog::info("ATLAS_H: {}", counter_atlas_h);
     spdlog::info("ATLAS_L: {}", counter_atlas_l);
     spdlog::info("RK3588: {}", counter_rk3588);
+    EXPECT_EQ(counter_atlas_h + counter_atlas_l + counter_rk3588, 1000);
 }
@@ -0,0 +1,114 @@
+// 单任务调度决策的基准：对比穷举打分与 power-of-d 采样在不同集群规模下的决策耗时与负载均衡效果
+// usage: schedule_bench [decisions_per_device]
+#include <spdlog/spdlog.h>
+#include <boost/uuid/uuid_generators.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "scheduler.h"
+
+namespace {
+
+struct BenchResult {
+    double mean_us;
+    double p99_us;
+    double imbalance; // max / mean dispatch queue length at the end of the run
+};
+
+std::vector<DeviceID> RegisterCluster(size_t devices, std::mt19937 &rng) {
+    Docker_scheduler scheduler;
+    std::uniform_real_distribution<double> usage(0.0, 0.6);
+    boost::uuids::random_generator gen;
+    std::vector<DeviceID> ids;
+    ids.reserve(devices);
+    for (size_t i = 0; i < devices; ++i) {
+        Device dev;
+        dev.global_id = gen();
+        dev.ip_address = "10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+        dev.type = RK3588;
+        dev.services = {TaskType::YoloV5};
+        Docker_scheduler::RegisNode(dev);
+        DeviceStatus status{};
+        status.cpu_used = usage(rng);
+        status.mem_used = usage(rng);
+        status.xpu_used = usage(rng);
+        status.net_latency = 20.0;
+        status.net_bandwidth = 100.0;
+        scheduler.updateStatus(dev.global_id, status);
+        ids.push_back(dev.global_id);
+    }
+    return ids;
+}
+
+BenchResult Run(const std::vector<DeviceID> &ids, int choices, size_t decisions) {
+    Docker_scheduler::SetSampleChoices(choices);
+    auto &queues = Docker_scheduler::GetTaskQueueManager();
+    std::vector<double> latencies;
+    latencies.reserve(decisions);
+    for (size_t i = 0; i < decisions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        Device dev = Docker_scheduler::Schedule(TaskType::YoloV5);
+        const auto end = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+
+        // the picked device gets the task queued, which is what the next decision sees
+        SubRequest sub_req;
+        sub_req.sub_req_id = "bench_" + std::to_string(i);
+        sub_req.task_type = TaskType::YoloV5;
+        sub_req.tasks.resize(1);
+        queues.PushDevice(dev.global_id, sub_req, false);
+    }
+
+    size_t max_depth = 0;
+    size_t total_depth = 0;
+    for (const auto &id : ids) {
+        const size_t depth = queues.GetDeviceQueueDepth(id);
+        max_depth = std::max(max_depth, depth);
+        total_depth += depth;
+        // drain so the next run starts from empty queues and no uploading credits
+        while (auto sub_req = queues.PopDevice(id, std::chrono::milliseconds(1))) {
+            queues.ReleaseCredits(id, sub_req->task_type, sub_req->tasks.size());
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for (double v : latencies) {
+        sum += v;
+    }
+    BenchResult result;
+    result.mean_us = sum / static_cast<double>(latencies.size());
+    result.p99_us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    const double mean_depth = static_cast<double>(total_depth) / static_cast<double>(ids.size());
+    result.imbalance = mean_depth > 0.0 ? static_cast<double>(max_depth) / mean_depth : 0.0;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    // decision cost without log output; the per-candidate detail is only built at debug level
+    spdlog::set_level(spdlog::level::warn);
+    const size_t per_device = argc > 1 ? static_cast<size_t>(std::stoul(argv[1])) : 20;
+    std::mt19937 rng(42);
+
+    std::printf("%8s %8s %12s %12s %12s\n", "devices", "choices", "mean_us", "p99_us", "max/mean");
+    for (size_t devices : {8, 32, 128, 512}) {
+        const auto ids = RegisterCluster(devices, rng);
+        for (int choices : {0, 2, 3}) {
+            const BenchResult r = Run(ids, choices, devices * per_device);
+            std::printf("%8zu %8s %12.2f %12.2f %12.3f\n", devices,
+                        choices == 0 ? "all" : std::to_string(choices).c_str(), r.mean_us, r.p99_us, r.imbalance);
+        }
+        // take the cluster offline so the next size starts from its own devices only
+        for (const auto &id : ids) {
+            Device dev;
+            dev.global_id = id;
+            Docker_scheduler::Disconnect_device(dev);
+        }
+    }
+    return 0;
+}
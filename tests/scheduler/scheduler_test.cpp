@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <spdlog/spdlog.h>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
 #include "scheduler.h"  // include Docker_scheduler
 
 std::map<TaskType, std::string> taskTypeToString = {
@@ -54,5 +56,557 @@ TEST(DockerSchedulerTest, TestJsonToMap) {
     DisplayStaticInfo(Docker_scheduler::getStaticInfo());
 }
 
+namespace {
+boost::uuids::random_generator uuid_gen;
 
+// the request and its single sub-request, registered with tracker like HandleSchedule + AllocateSubRequests do
+void Track(RequestTracker &tracker, const SubRequest &sub_req) {
+    ClientRequest req;
+    req.req_id = sub_req.req_id;
+    req.client_ip = sub_req.client_ip;
+    req.task_type = sub_req.task_type;
+    req.total_num = static_cast<int>(sub_req.tasks.size());
+    req.tasks = sub_req.tasks;
+    tracker.OnClientRequest(req);
+    tracker.OnSubRequestAllocated(sub_req);
+}
+
+// a sub-request of n tasks, known to the scheduler's RequestTracker
+SubRequest MakeSubRequest(const std::string &req_id, const DeviceID &device_id, int n) {
+    SubRequest sub_req;
+    sub_req.req_id = req_id;
+    sub_req.sub_req_id = req_id + "_0";
+    sub_req.client_ip = "127.0.0.1";
+    sub_req.task_type = YoloV5;
+    sub_req.dst_device_id = device_id;
+    sub_req.sub_req_count = n;
+    for (int i = 0; i < n; ++i) {
+        ImageTask task;
+        task.task_id = req_id + "_t" + std::to_string(i);
+        task.req_id = req_id;
+        task.sub_req_id = sub_req.sub_req_id;
+        task.task_type = YoloV5;
+        sub_req.tasks.push_back(task);
+    }
+    Track(Docker_scheduler::GetRequestTracker(), sub_req);
+    return sub_req;
+}
+
+void DrainDevice(const DeviceID &device_id) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    while (auto sub_req = manager.PopDevice(device_id, std::chrono::milliseconds(1))) {
+        manager.ReleaseCredits(device_id, sub_req->task_type, sub_req->tasks.size());
+    }
+}
+} // namespace
+
+// an empty dispatch queue is not enough: running tasks count towards the thief's backlog
+TEST(TaskQueueManagerTest, StealNeedsClearlyLargerBacklog) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID thief = uuid_gen(), victim = uuid_gen();
+    auto can_run = [](TaskType) { return true; };
+    SubRequest running = MakeSubRequest("steal_gap_run", thief, 3);
+    for (const auto &task : running.tasks) {
+        manager.AddRunningTask(thief, task);
+    }
+    manager.PushDevice(victim, MakeSubRequest("steal_gap_q", victim, 6), false);
+
+    // 6 queued vs 3 running: gap below kStealMinGap
+    EXPECT_FALSE(manager.StealFor(thief, "thief", can_run).has_value());
+    EXPECT_EQ(manager.GetDeviceInflight(victim).queued_tasks, 6u);
+
+    for (const auto &task : running.tasks) {
+        manager.CompleteTask(task.task_id);
+    }
+    auto stolen = manager.StealFor(thief, "thief", can_run);
+    ASSERT_TRUE(stolen.has_value());
+    EXPECT_EQ(stolen->tasks.size(), 3u);
+    EXPECT_EQ(stolen->dst_device_id, thief);
+    manager.ReleaseCredits(thief, stolen->task_type, stolen->tasks.size());
+    DrainDevice(victim);
+}
+
+// at most half the gap moves, and the balanced pair does not steal again
+TEST(TaskQueueManagerTest, StealMovesAtMostHalfTheGap) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID thief = uuid_gen(), victim = uuid_gen();
+    auto can_run = [](TaskType) { return true; };
+    SubRequest running = MakeSubRequest("steal_half_run", thief, 4);
+    for (const auto &task : running.tasks) {
+        manager.AddRunningTask(thief, task);
+    }
+    manager.PushDevice(victim, MakeSubRequest("steal_half_q", victim, 10), false);
+
+    auto stolen = manager.StealFor(thief, "thief", can_run);
+    ASSERT_TRUE(stolen.has_value());
+    EXPECT_EQ(stolen->tasks.size(), 3u);
+    EXPECT_EQ(manager.GetDeviceInflight(victim).queued_tasks, 7u);
+    // thief: 4 running + 3 uploading, victim: 7 queued
+    EXPECT_FALSE(manager.StealFor(thief, "thief", can_run).has_value());
+
+    manager.ReleaseCredits(thief, stolen->task_type, stolen->tasks.size());
+    for (const auto &task : running.tasks) {
+        manager.CompleteTask(task.task_id);
+    }
+    DrainDevice(victim);
+}
+
+// back-to-back LOAD_BASED decisions between two telemetry samples: each pick is charged to its device,
+// and a few ms / Mbps of network jitter must not outweigh that charge
+TEST(DockerSchedulerTest, LoadScheduleSpreadsAcrossEqualDevices) {
+    Docker_scheduler scheduler;
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    std::map<DeviceID, int> picks;
+    for (int i = 0; i < 4; ++i) {
+        Device dev;
+        dev.global_id = uuid_gen();
+        dev.ip_address = "10.1.0." + std::to_string(i);
+        dev.type = RK3588;
+        dev.services = {TaskType::YoloV5};
+        Docker_scheduler::RegisNode(dev);
+        DeviceStatus status{};
+        status.cpu_used = 0.2;
+        status.mem_used = 0.3;
+        status.xpu_used = 0.1;
+        status.net_latency = 20.0 + i;
+        status.net_bandwidth = 100.0 - 3.0 * i;
+        scheduler.updateStatus(dev.global_id, status);
+        picks[dev.global_id] = 0;
+    }
+
+    const int decisions = 40;
+    for (int i = 0; i < decisions; ++i) {
+        Device dev = Docker_scheduler::Schedule(TaskType::YoloV5);
+        ASSERT_TRUE(picks.count(dev.global_id) > 0);
+        picks[dev.global_id]++;
+        SubRequest sub_req;
+        sub_req.sub_req_id = "spread_" + std::to_string(i);
+        sub_req.task_type = TaskType::YoloV5;
+        sub_req.tasks.resize(1);
+        manager.PushDevice(dev.global_id, sub_req, false);
+    }
+    for (const auto &[device_id, count] : picks) {
+        EXPECT_GE(count, decisions / 4 - 2);
+        EXPECT_LE(count, decisions / 4 + 2);
+        DrainDevice(device_id);
+    }
+}
+
+// a task whose retries are exhausted leaves its waiting/running bucket instead of being counted twice
+TEST(RequestTrackerTest, FailedTaskLeavesLiveBuckets) {
+    RequestTracker tracker;
+    SubRequest sub_req = MakeSubRequest("track_failed", uuid_gen(), 3);
+    Track(tracker, sub_req);
+    tracker.OnTaskRunning("track_failed_t0");
+    tracker.OnTaskFailed("track_failed_t0");
+    tracker.OnTaskFailed("track_failed_t0"); // reported twice, counted once
+
+    auto detail = tracker.BuildReqDetail("track_failed");
+    ASSERT_TRUE(detail.has_value());
+    EXPECT_EQ((*detail)["waiting"], 2);
+    EXPECT_EQ((*detail)["processing"], 0);
+    EXPECT_EQ((*detail)["failed"], 1);
+    EXPECT_EQ((*detail)["sub_reqs"][0]["failed_task_num"], 1);
+    EXPECT_EQ(tracker.GetTaskStatus("track_failed_t0"), TaskProgressStatus::FAILED);
+    EXPECT_EQ(tracker.RemainingTasks("track_failed")->first, 2);
+
+    tracker.OnTaskSent("track_failed_t1");
+    tracker.OnTaskSent("track_failed_t2");
+    detail = tracker.BuildReqDetail("track_failed");
+    ASSERT_TRUE(detail.has_value());
+    EXPECT_EQ((*detail)["status"], "failed");
+    EXPECT_EQ((*detail)["waiting"], 0);
+    EXPECT_EQ((*detail)["rst_sended"], 2);
+    EXPECT_EQ((*detail)["sub_reqs"][0]["status"], "failed");
+}
+
+// evicted requests are still answered from the archive ring, the oldest slot is overwritten first
+TEST(RequestTrackerTest, EvictedRequestFallsBackToArchive) {
+    RequestTracker tracker;
+    RetentionOptions retention;
+    retention.finished_ttl_ms = 0;
+    retention.max_finished = 0;
+    retention.archive_capacity = 2;
+    tracker.SetRetention(retention);
+
+    const DeviceID device_id = uuid_gen();
+    for (const std::string req_id : {"track_arch_a", "track_arch_b", "track_arch_c"}) {
+        SubRequest sub_req = MakeSubRequest(req_id, device_id, 2);
+        Track(tracker, sub_req);
+        tracker.OnTaskSent(req_id + "_t0");
+        if (req_id == "track_arch_b") {
+            tracker.OnTaskFailed(req_id + "_t1");
+        } else {
+            tracker.OnTaskSent(req_id + "_t1");
+        }
+    }
+
+    EXPECT_FALSE(tracker.BuildReqDetail("track_arch_a").has_value());
+    auto b = tracker.BuildReqDetail("track_arch_b");
+    ASSERT_TRUE(b.has_value());
+    EXPECT_EQ((*b)["archived"], true);
+    EXPECT_EQ((*b)["status"], "failed");
+    EXPECT_EQ((*b)["failed"], 1);
+    EXPECT_EQ((*b)["processing"], 0);
+    auto c = tracker.BuildReqDetail("track_arch_c");
+    ASSERT_TRUE(c.has_value());
+    EXPECT_EQ((*c)["archived"], true);
+    EXPECT_EQ((*c)["status"], "completed");
+    EXPECT_EQ((*c)["rst_sended"], 2);
+    EXPECT_EQ((*c)["sub_req_count"], 1);
+    EXPECT_FALSE(tracker.BuildSubReqDetail("track_arch_c_0").has_value());
+}
+
+// a task recovered from a lost device is re-queued with its original arrival time, not "now"
+TEST(TaskQueueManagerTest, RecoveredTaskKeepsEnqueueTime) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID device_id = uuid_gen();
+    SubRequest sub_req = MakeSubRequest("recover_age", device_id, 1);
+    ImageTask task = sub_req.tasks.front();
+    task.enqueue_time_ms = 1000;
+    manager.AddRunningTask(device_id, task);
+
+    manager.RecoverTasks(device_id);
+    auto retry = manager.PopPending();
+    ASSERT_TRUE(retry.has_value());
+    ASSERT_EQ(retry->tasks.size(), 1u);
+    EXPECT_EQ(retry->tasks.front().task_id, task.task_id);
+    EXPECT_EQ(retry->tasks.front().retry_count, 1);
+    EXPECT_EQ(retry->enqueue_time_ms, 1000);
+    // the slave may already have registered the original sub_req_id
+    EXPECT_EQ(retry->sub_req_id, "sub_" + task.task_id + "_r1");
+    EXPECT_EQ(retry->tasks.front().sub_req_id, retry->sub_req_id);
+    EXPECT_TRUE(Docker_scheduler::GetRequestTracker().BuildSubReqDetail(retry->sub_req_id).has_value());
+}
+
+// duplicate results of a speculated task are dropped per (task, device); the device is named by its uuid,
+// else by a source ip that only it uses
+TEST(DockerSchedulerTest, ClaimTaskResultIdentifiesReporter) {
+    auto &speculation = Docker_scheduler::GetSpeculation();
+    std::vector<Device> devs(4);
+    for (size_t i = 0; i < devs.size(); ++i) {
+        devs[i].global_id = uuid_gen();
+        devs[i].type = RK3588;
+        // devs[2] and devs[3] sit behind the same address
+        devs[i].ip_address = "10.2.0." + std::to_string(std::min<size_t>(i, 2));
+        Docker_scheduler::RegisNode(devs[i]);
+    }
+    speculation.SetBudget(100);
+    for (int i = 0; i < 10; ++i) {
+        speculation.OnTaskDispatched();
+    }
+    ImageTask by_ip;
+    by_ip.task_id = "claim_ip.jpg";
+    ASSERT_TRUE(speculation.TryLaunch(by_ip, devs[0].global_id, devs[1].global_id));
+    ImageTask shared;
+    shared.task_id = "claim_shared.jpg";
+    ASSERT_TRUE(speculation.TryLaunch(shared, devs[0].global_id, devs[2].global_id));
+
+    // primary wins with its uuid; the backup's "slave-1" is not a uuid, its unique ip names it
+    EXPECT_TRUE(Docker_scheduler::ClaimTaskResult("claim_ip.jpg", boost::uuids::to_string(devs[0].global_id), "10.2.0.0"));
+    EXPECT_FALSE(Docker_scheduler::ClaimTaskResult("claim_ip.jpg", "slave-1", "10.2.0.1"));
+    EXPECT_TRUE(Docker_scheduler::ClaimTaskResult("claim_ip.jpg", "", "10.2.0.0"));
+
+    // backup wins by uuid; a later report from the shared address cannot be attributed and is delivered
+    EXPECT_TRUE(Docker_scheduler::ClaimTaskResult("claim_shared.jpg", boost::uuids::to_string(devs[2].global_id), "10.2.0.2"));
+    EXPECT_FALSE(Docker_scheduler::ClaimTaskResult("claim_shared.jpg", boost::uuids::to_string(devs[0].global_id), "10.2.0.0"));
+    EXPECT_TRUE(Docker_scheduler::ClaimTaskResult("claim_shared.jpg", "unknown", "10.2.0.2"));
+    speculation.SetBudget(0);
+}
+
+// a task whose result never comes gives its credit back once overdue, and its late completion does not release twice
+TEST(TaskQueueManagerTest, OverdueRunningCreditExpires) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID device_id = uuid_gen();
+    auto limit = [](TaskType) -> size_t { return 2; };
+    auto running_credits = [&]() {
+        const DeviceCredits credits = manager.GetDeviceCredits(device_id);
+        auto it = credits.usage.find(YoloV5);
+        return it == credits.usage.end() ? 0u : it->second.running;
+    };
+    SubRequest sub_req = MakeSubRequest("credit_expire", device_id, 3);
+    manager.PushDevice(device_id, sub_req, false);
+    auto head = manager.PopDevice(device_id, limit);
+    ASSERT_TRUE(head.has_value());
+    ASSERT_EQ(head->tasks.size(), 2u);
+    manager.ReleaseCredits(device_id, YoloV5, 2);
+    for (const auto &task : head->tasks) {
+        manager.AddRunningTask(device_id, task);
+    }
+    EXPECT_EQ(running_credits(), 2u);
+    EXPECT_FALSE(manager.PopDevice(device_id, std::chrono::milliseconds(1), limit).has_value());
 
+    const std::string lost = head->tasks.front().task_id;
+    auto is_lost = [&lost](const DeviceID &, const ImageTask &task) { return task.task_id == lost; };
+    EXPECT_EQ(manager.ExpireRunningCredits(is_lost), 1u);
+    EXPECT_EQ(manager.ExpireRunningCredits(is_lost), 0u);
+    EXPECT_EQ(running_credits(), 1u);
+    EXPECT_EQ(manager.GetDeviceCredits(device_id).expired_credits, 1u);
+
+    auto tail = manager.PopDevice(device_id, limit);
+    ASSERT_TRUE(tail.has_value());
+    ASSERT_EQ(tail->tasks.size(), 1u);
+    manager.ReleaseCredits(device_id, YoloV5, 1);
+    manager.AddRunningTask(device_id, tail->tasks.front());
+    EXPECT_EQ(running_credits(), 2u);
+
+    // the late result still completes the task, without giving back a credit it no longer holds
+    EXPECT_TRUE(manager.CompleteTask(lost));
+    EXPECT_EQ(running_credits(), 2u);
+    EXPECT_TRUE(manager.CompleteTask(head->tasks.back().task_id));
+    EXPECT_TRUE(manager.CompleteTask(tail->tasks.front().task_id));
+    EXPECT_EQ(running_credits(), 0u);
+}
+
+// a lost device starts over without credits, whatever its workers were still uploading
+TEST(TaskQueueManagerTest, RecoverTasksReleasesCredits) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID device_id = uuid_gen();
+    auto limit = [](TaskType) -> size_t { return 4; };
+    SubRequest sub_req = MakeSubRequest("credit_recover", device_id, 2);
+    manager.PushDevice(device_id, sub_req, false);
+    auto popped = manager.PopDevice(device_id, limit);
+    ASSERT_TRUE(popped.has_value());
+    manager.AddRunningTask(device_id, popped->tasks.front());
+    DeviceCredits credits = manager.GetDeviceCredits(device_id);
+    EXPECT_EQ(credits.usage[YoloV5].uploading, 2u);
+    EXPECT_EQ(credits.usage[YoloV5].running, 1u);
+
+    manager.RecoverTasks(device_id);
+    EXPECT_TRUE(manager.GetDeviceCredits(device_id).usage.empty());
+    // the worker's upload attempt ends after the recovery
+    manager.ReleaseCredits(device_id, YoloV5, 2);
+    credits = manager.GetDeviceCredits(device_id);
+    EXPECT_EQ(credits.usage[YoloV5].uploading, 0u);
+    EXPECT_EQ(credits.usage[YoloV5].running, 0u);
+
+    auto retry = manager.PopPending();
+    ASSERT_TRUE(retry.has_value());
+    EXPECT_EQ(retry->tasks.front().task_id, popped->tasks.front().task_id);
+}
+
+// flows of clients that stopped submitting are dropped once empty and idle; busy or recent ones stay
+TEST(FairQueueTest, PrunesIdleEmptyFlows) {
+    FairQueue queue;
+    for (const std::string ip : {"10.3.0.1", "10.3.0.2", "10.3.0.3"}) {
+        SubRequest sub_req;
+        sub_req.client_ip = ip;
+        sub_req.task_type = YoloV5;
+        sub_req.tasks.resize(2);
+        queue.Push(sub_req, 0, 1, false);
+    }
+    queue.Pop();
+    queue.Pop();
+    ASSERT_EQ(queue.flow_count(), 3u);
+    const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    EXPECT_EQ(queue.PruneIdleFlows(now_ms, FairQueue::kFlowIdleMs), 0u);
+    EXPECT_EQ(queue.PruneIdleFlows(now_ms + FairQueue::kFlowIdleMs, FairQueue::kFlowIdleMs), 2u);
+    EXPECT_EQ(queue.flow_count(), 1u);
+    EXPECT_EQ(queue.size(), 1u);
+    EXPECT_EQ(queue.Pop().tasks.size(), 2u);
+    EXPECT_TRUE(queue.empty());
+}
+
+// /queues reports what entered the device queues next to what was dispatched; a credit cut is put back, not counted twice
+TEST(TaskQueueManagerTest, QueueStatsReportEnqueuedTasks) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID device_id = uuid_gen();
+    SubRequest sub_req = MakeSubRequest("queue_stats", device_id, 5);
+    sub_req.client_ip = "10.4.0.1";
+    manager.PushDevice(device_id, sub_req, false);
+    auto head = manager.PopDevice(device_id, [](TaskType) -> size_t { return 2; });
+    ASSERT_TRUE(head.has_value());
+    ASSERT_EQ(head->tasks.size(), 2u);
+
+    const auto stats = manager.BuildQueueStats();
+    const nlohmann::json *row = nullptr;
+    for (const auto &flow : stats["flows"]) {
+        if (flow["client_ip"] == "10.4.0.1") {
+            row = &flow;
+        }
+    }
+    ASSERT_NE(row, nullptr);
+    EXPECT_EQ((*row)["enqueued_tasks"], 5);
+    EXPECT_EQ((*row)["dispatched_tasks"], 2);
+    EXPECT_EQ((*row)["queued_tasks"], 3);
+    manager.ReleaseCredits(device_id, head->task_type, head->tasks.size());
+    DrainDevice(device_id);
+}
+
+// the batched lookup used by the policies sees the same counts as one lookup per device
+TEST(TaskQueueManagerTest, DevicesInflightMatchesPerDeviceLookup) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID queued = uuid_gen(), running = uuid_gen(), idle = uuid_gen();
+    manager.PushDevice(queued, MakeSubRequest("inflight_batch_q", queued, 3), false);
+    SubRequest sub_req = MakeSubRequest("inflight_batch_r", running, 2);
+    for (auto &task : sub_req.tasks) {
+        task.payload_bytes = 100;
+        manager.AddRunningTask(running, task);
+    }
+
+    const std::vector<DeviceID> ids = {queued, running, idle, running};
+    std::vector<DeviceInflight> inflight;
+    manager.GetDevicesInflight(ids, inflight);
+    ASSERT_EQ(inflight.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const DeviceInflight one = manager.GetDeviceInflight(ids[i]);
+        EXPECT_EQ(inflight[i].queued_tasks, one.queued_tasks);
+        EXPECT_EQ(inflight[i].running_tasks, one.running_tasks);
+        EXPECT_EQ(inflight[i].running_bytes, one.running_bytes);
+        EXPECT_EQ(inflight[i].since_sample, one.since_sample);
+    }
+    EXPECT_EQ(inflight[0].queued_tasks, 3u);
+    EXPECT_EQ(inflight[1].running_tasks, 2u);
+    EXPECT_EQ(inflight[1].running_bytes, 200u);
+    EXPECT_EQ(inflight[2].outstanding(), 0u);
+
+    for (const auto &task : sub_req.tasks) {
+        manager.CompleteTask(task.task_id);
+    }
+    DrainDevice(queued);
+}
+
+// a sub-request being uploaded has left the queue but still loads its device
+TEST(TaskQueueManagerTest, UploadingTasksCountAsUnsampled) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID device_id = uuid_gen();
+    manager.PushDevice(device_id, MakeSubRequest("inflight_upload", device_id, 4), false);
+    auto popped = manager.PopDevice(device_id, std::chrono::milliseconds(1));
+    ASSERT_TRUE(popped.has_value());
+    DeviceInflight inflight = manager.GetDeviceInflight(device_id);
+    EXPECT_EQ(inflight.queued_tasks, 0u);
+    EXPECT_EQ(inflight.uploading_tasks, 4u);
+    EXPECT_EQ(inflight.unsampled(), 4u);
+    EXPECT_EQ(inflight.outstanding(), 4u);
+
+    for (const auto &task : popped->tasks) {
+        manager.AddRunningTask(device_id, task);
+    }
+    manager.ReleaseCredits(device_id, popped->task_type, popped->tasks.size());
+    inflight = manager.GetDeviceInflight(device_id);
+    EXPECT_EQ(inflight.uploading_tasks, 0u);
+    EXPECT_EQ(inflight.unsampled(), 4u);
+    EXPECT_EQ(inflight.outstanding(), 4u);
+    for (const auto &task : popped->tasks) {
+        manager.CompleteTask(task.task_id);
+    }
+}
+
+// a backup copy occupies its own device until the task completes (either copy), its device is lost or the task fails
+TEST(TaskQueueManagerTest, BackupCopyChargedToItsDevice) {
+    auto &manager = Docker_scheduler::GetTaskQueueManager();
+    const DeviceID primary = uuid_gen(), backup = uuid_gen();
+    auto running_credits = [&manager](const DeviceID &device_id) {
+        const DeviceCredits credits = manager.GetDeviceCredits(device_id);
+        auto it = credits.usage.find(YoloV5);
+        return it == credits.usage.end() ? 0u : it->second.running;
+    };
+    SubRequest sub_req = MakeSubRequest("backup_charge", primary, 3);
+    std::vector<ImageTask> copies;
+    for (auto &task : sub_req.tasks) {
+        manager.AddRunningTask(primary, task);
+        ImageTask copy = task;
+        copy.speculative = true;
+        copy.payload_bytes = 50;
+        manager.AddRunningTask(backup, copy);
+        copies.push_back(copy);
+    }
+    DeviceInflight inflight = manager.GetDeviceInflight(backup);
+    EXPECT_EQ(inflight.running_tasks, 3u);
+    EXPECT_EQ(inflight.running_bytes, 150u);
+    EXPECT_EQ(inflight.since_sample, 3u);
+    EXPECT_EQ(running_credits(backup), 3u);
+    EXPECT_EQ(manager.GetDeviceBacklog(primary), 3u);
+
+    // completion, whichever copy reported it (the loser never does)
+    EXPECT_TRUE(manager.CompleteTask(sub_req.tasks[0].task_id));
+    EXPECT_EQ(manager.GetDeviceInflight(backup).running_tasks, 2u);
+    EXPECT_EQ(running_credits(backup), 2u);
+    EXPECT_EQ(manager.GetDeviceBacklog(primary), 2u);
+
+    // the task failed for good
+    manager.MoveToFailed(sub_req.tasks[1]);
+    EXPECT_EQ(manager.GetDeviceInflight(backup).running_tasks, 1u);
+    EXPECT_EQ(running_credits(backup), 1u);
+
+    // the backup's device is lost: the copy is gone, not retried, and the primary keeps running
+    manager.RecoverTasks(backup);
+    EXPECT_EQ(manager.GetDeviceInflight(backup).running_tasks, 0u);
+    EXPECT_EQ(running_credits(backup), 0u);
+    EXPECT_EQ(manager.GetDeviceBacklog(primary), 2u);
+    EXPECT_TRUE(manager.CompleteTask(sub_req.tasks[2].task_id));
+    EXPECT_TRUE(manager.CompleteTask(sub_req.tasks[1].task_id));
+    EXPECT_EQ(manager.GetDeviceBacklog(primary), 0u);
+}
+
+// copies of tasks that never complete are forgotten: dropped explicitly or aged out
+TEST(SpeculationTrackerTest, DroppedAndExpiredCopiesAreForgotten) {
+    SpeculationTracker tracker;
+    tracker.SetBudget(100);
+    for (int i = 0; i < 10; ++i) {
+        tracker.OnTaskDispatched();
+    }
+    ImageTask failed, lost;
+    failed.task_id = "spec_failed.jpg";
+    lost.task_id = "spec_lost.jpg";
+    ASSERT_TRUE(tracker.TryLaunch(failed, uuid_gen(), uuid_gen()));
+    ASSERT_TRUE(tracker.TryLaunch(lost, uuid_gen(), uuid_gen()));
+
+    tracker.Drop("spec_failed.json");
+    EXPECT_FALSE(tracker.IsSpeculated(failed.task_id));
+    EXPECT_TRUE(tracker.IsSpeculated(lost.task_id));
+
+    const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    tracker.ExpireCopies(now_ms);
+    EXPECT_TRUE(tracker.IsSpeculated(lost.task_id));
+    tracker.ExpireCopies(now_ms + SpeculationTracker::kCopyTtlMs);
+    EXPECT_FALSE(tracker.IsSpeculated(lost.task_id));
+    const auto stats = tracker.Stats();
+    EXPECT_EQ(stats["dropped"], 1);
+    EXPECT_EQ(stats["expired"], 1);
+    EXPECT_EQ(stats["outstanding"], 0);
+}
+
+// evicting an old completed entry must not take a newer copy of the same stem with it
+TEST(SpeculationTrackerTest, EvictionKeepsNewerCopyOfSameStem) {
+    SpeculationTracker tracker;
+    tracker.SetBudget(100);
+    for (size_t i = 0; i < SpeculationTracker::kMaxResolved + 10; ++i) {
+        tracker.OnTaskDispatched();
+    }
+    const DeviceID primary = uuid_gen(), backup = uuid_gen();
+    ImageTask task;
+    task.task_id = "spec_again.jpg";
+    ASSERT_TRUE(tracker.TryLaunch(task, primary, backup));
+    EXPECT_TRUE(tracker.ClaimResult(task.task_id, primary));
+    tracker.OnTaskCompleted(task.task_id, 0);
+    EXPECT_FALSE(tracker.ClaimResult(task.task_id, backup)); // the loser's late result clears the copy
+    EXPECT_FALSE(tracker.IsSpeculated(task.task_id));
+
+    // speculated again (e.g. retried), then enough other completions to evict the first resolution
+    ASSERT_TRUE(tracker.TryLaunch(task, primary, backup));
+    for (size_t i = 0; i < SpeculationTracker::kMaxResolved; ++i) {
+        ImageTask other;
+        other.task_id = "spec_other_" + std::to_string(i) + ".jpg";
+        ASSERT_TRUE(tracker.TryLaunch(other, primary, backup));
+        tracker.OnTaskCompleted(other.task_id, 0);
+    }
+    EXPECT_TRUE(tracker.IsSpeculated(task.task_id));
+}
+
+// a task that exhausted its retries never completes, so its copy goes with it
+TEST(SpeculationTrackerTest, FailedTaskDropsCopy) {
+    auto &speculation = Docker_scheduler::GetSpeculation();
+    speculation.SetBudget(100);
+    for (int i = 0; i < 10; ++i) {
+        speculation.OnTaskDispatched();
+    }
+    ImageTask task;
+    task.task_id = "spec_exhausted.jpg";
+    ASSERT_TRUE(speculation.TryLaunch(task, uuid_gen(), uuid_gen()));
+    Docker_scheduler::GetTaskQueueManager().MoveToFailed(task);
+    EXPECT_FALSE(speculation.IsSpeculated(task.task_id));
+    speculation.SetBudget(0);
+}
@@ -0,0 +1,109 @@
+// 设备状态编码的基准：对比 /usage/device_info 的 JSON 与定长二进制编码（telemetry.h）的编解码耗时和字节数
+// usage: telemetry_bench [iterations]
+#include <spdlog/spdlog.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "TelemetryCollector.h"
+#include "telemetry.h"
+
+namespace {
+
+struct CodecResult {
+    double encode_ns;
+    double decode_ns;
+    size_t bytes;
+};
+
+TelemetryDatagram MakeSample(size_t services) {
+    TelemetryDatagram dgram;
+    dgram.global_id = "4f0c3b7e-2a51-4d8e-9b0a-6c2f1e7d3a95";
+    dgram.ts_ms = 1700000000000;
+    dgram.status = DeviceStatus{};
+    dgram.status.cpu_used = 0.4375;
+    dgram.status.mem_used = 0.61;
+    dgram.status.xpu_used = 0.2;
+    dgram.status.net_latency = 12.5;
+    dgram.status.net_bandwidth = 183.25;
+    dgram.status.disconnectTime = 30;
+    dgram.status.reconnectTime = 20;
+    dgram.status.timeWindow = 5;
+    const std::vector<std::string> names = {"YoloV5", "MobileNet", "Bert", "ResNet50"};
+    for (size_t i = 0; i < services; ++i) {
+        dgram.services.push_back(names[i % names.size()]);
+    }
+    return dgram;
+}
+
+template <typename Fn>
+double NsPerOp(size_t iterations, Fn &&fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(iterations);
+}
+
+// the agent endpoint's JSON body and the collector's parse, as on the polling path
+CodecResult RunJson(const TelemetryDatagram &dgram, size_t iterations) {
+    std::string body;
+    size_t sink = 0;
+    CodecResult r{};
+    r.encode_ns = NsPerOp(iterations, [&]() {
+        DeviceStatus status = dgram.status;
+        json payload = status.to_json();
+        payload["services"] = dgram.services;
+        json j;
+        j["status"] = "success";
+        j["result"] = payload;
+        body = j.dump();
+    });
+    r.decode_ns = NsPerOp(iterations, [&]() {
+        auto sample = TelemetryCollector::ParseDeviceInfo(body);
+        sink += sample && sample->services ? sample->services->size() : 0;
+    });
+    r.bytes = body.size();
+    if (sink == 0 && !dgram.services.empty()) {
+        std::fprintf(stderr, "json decode lost the services list\n");
+    }
+    return r;
+}
+
+CodecResult RunBinary(const TelemetryDatagram &dgram, size_t iterations) {
+    std::string body;
+    size_t sink = 0;
+    CodecResult r{};
+    r.encode_ns = NsPerOp(iterations, [&]() { body = dgram.EncodeBinary(); });
+    r.decode_ns = NsPerOp(iterations, [&]() {
+        auto decoded = TelemetryDatagram::DecodeBinary(body.data(), body.size());
+        if (decoded) {
+            sink += TelemetryCollector::FromDatagram(std::move(*decoded)).services->size();
+        }
+    });
+    r.bytes = body.size();
+    auto check = TelemetryDatagram::DecodeBinary(body.data(), body.size());
+    if (!check || check->status.net_bandwidth != dgram.status.net_bandwidth || check->services != dgram.services) {
+        std::fprintf(stderr, "binary round trip mismatch\n");
+    }
+    (void) sink;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    spdlog::set_level(spdlog::level::warn);
+    const size_t iterations = argc > 1 ? static_cast<size_t>(std::stoul(argv[1])) : 200000;
+
+    std::printf("%9s %8s %12s %12s %8s\n", "services", "codec", "encode_ns", "decode_ns", "bytes");
+    for (size_t services : {0, 2, 8}) {
+        const TelemetryDatagram dgram = MakeSample(services);
+        const CodecResult j = RunJson(dgram, iterations);
+        const CodecResult b = RunBinary(dgram, iterations);
+        std::printf("%9zu %8s %12.1f %12.1f %8zu\n", services, "json", j.encode_ns, j.decode_ns, j.bytes);
+        std::printf("%9zu %8s %12.1f %12.1f %8zu\n", services, "binary", b.encode_ns, b.decode_ns, b.bytes);
+    }
+    return 0;
+}
@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <boost/uuid/string_generator.hpp>
+#include "TelemetryReceiver.h"
+#include "telemetry.h"
+
+namespace {
+constexpr size_t kStatusOffset = 32;                 // magic, version, id_len, service_count, epoch, seq, ts, interval
+constexpr size_t kIdOffset = kStatusOffset + 9 * 8;  // 9 x f64 DeviceStatus
+
+TelemetryDatagram MakeDatagram() {
+    TelemetryDatagram dgram;
+    dgram.global_id = "4f0c3b7e-2a51-4d8e-9b0a-6c2f1e7d3a95";
+    dgram.epoch = 1700000000123;
+    dgram.seq = 42;
+    dgram.ts_ms = 1700000005123;
+    dgram.interval_ms = 500;
+    dgram.status = DeviceStatus{};
+    dgram.status.mem_used = 0.61;
+    dgram.status.cpu_used = 0.4375;
+    dgram.status.xpu_used = 0.2;
+    dgram.status.net_latency = 12.5;
+    dgram.status.net_bandwidth = 183.25;
+    dgram.status.last_runtime = 7.0;
+    dgram.status.disconnectTime = 30;
+    dgram.status.reconnectTime = 20;
+    dgram.status.timeWindow = 3;
+    dgram.services = {"YoloV5", "MobileNet"};
+    return dgram;
+}
+
+// CRC-32 (IEEE 802.3), written independently of the codec, to re-seal a datagram after editing it
+uint32_t Crc32(const std::string &data) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (unsigned char byte : data) {
+        c ^= byte;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+std::string Reseal(std::string wire) {
+    wire.resize(wire.size() - 4);
+    const uint32_t crc = Crc32(wire);
+    for (int i = 0; i < 4; ++i) {
+        wire.push_back(static_cast<char>((crc >> (8 * i)) & 0xFF));
+    }
+    return wire;
+}
+
+std::optional<TelemetryDatagram> Decode(const std::string &wire) {
+    return TelemetryDatagram::DecodeBinary(wire.data(), wire.size());
+}
+
+// the JSON form does not carry last_runtime, the binary form carries every field
+void ExpectSame(const TelemetryDatagram &a, const TelemetryDatagram &b, bool with_runtime = true) {
+    EXPECT_EQ(a.global_id, b.global_id);
+    EXPECT_EQ(a.epoch, b.epoch);
+    EXPECT_EQ(a.seq, b.seq);
+    EXPECT_EQ(a.ts_ms, b.ts_ms);
+    EXPECT_EQ(a.interval_ms, b.interval_ms);
+    EXPECT_EQ(a.status.mem_used, b.status.mem_used);
+    EXPECT_EQ(a.status.cpu_used, b.status.cpu_used);
+    EXPECT_EQ(a.status.xpu_used, b.status.xpu_used);
+    EXPECT_EQ(a.status.net_latency, b.status.net_latency);
+    EXPECT_EQ(a.status.net_bandwidth, b.status.net_bandwidth);
+    if (with_runtime) {
+        EXPECT_EQ(a.status.last_runtime, b.status.last_runtime);
+    }
+    EXPECT_EQ(a.status.disconnectTime, b.status.disconnectTime);
+    EXPECT_EQ(a.status.reconnectTime, b.status.reconnectTime);
+    EXPECT_EQ(a.status.timeWindow, b.status.timeWindow);
+    EXPECT_EQ(a.services, b.services);
+}
+} // namespace
+
+TEST(TelemetryCodecTest, BinaryRoundTrip) {
+    const TelemetryDatagram dgram = MakeDatagram();
+    const std::string wire = dgram.EncodeBinary();
+    EXPECT_EQ(static_cast<unsigned char>(wire[0]), kTelemetryBinaryMagic);
+    EXPECT_EQ(wire.size(), kIdOffset + dgram.global_id.size() + (1 + 6) + (1 + 9) + 4);
+    auto decoded = Decode(wire);
+    ASSERT_TRUE(decoded.has_value());
+    ExpectSame(dgram, *decoded);
+
+    // Decode picks the codec by the first byte
+    auto by_magic = TelemetryDatagram::Decode(wire.data(), wire.size());
+    ASSERT_TRUE(by_magic.has_value());
+    ExpectSame(dgram, *by_magic);
+    const std::string json = dgram.EncodeJson();
+    auto from_json = TelemetryDatagram::Decode(json.data(), json.size());
+    ASSERT_TRUE(from_json.has_value());
+    ExpectSame(dgram, *from_json, false);
+}
+
+TEST(TelemetryCodecTest, BinaryRoundTripWithoutServices) {
+    TelemetryDatagram dgram = MakeDatagram();
+    dgram.services.clear();
+    auto decoded = Decode(dgram.EncodeBinary());
+    ASSERT_TRUE(decoded.has_value());
+    ExpectSame(dgram, *decoded);
+}
+
+TEST(TelemetryCodecTest, RejectsBadMagic) {
+    std::string wire = MakeDatagram().EncodeBinary();
+    wire[0] = static_cast<char>(0xD6);
+    EXPECT_FALSE(Decode(Reseal(wire)).has_value());
+}
+
+TEST(TelemetryCodecTest, RejectsUnsupportedVersion) {
+    std::string wire = MakeDatagram().EncodeBinary();
+    wire[1] = static_cast<char>(kTelemetryBinaryVersion + 1);
+    EXPECT_FALSE(Decode(Reseal(wire)).has_value());
+}
+
+TEST(TelemetryCodecTest, RejectsLengthMismatch) {
+    const std::string wire = MakeDatagram().EncodeBinary();
+    // shorter than the fixed header + status + crc
+    EXPECT_FALSE(Decode(wire.substr(0, kIdOffset + 3)).has_value());
+    EXPECT_FALSE(Decode(std::string()).has_value());
+
+    // declared id shorter than the bytes present: trailing bytes are left over
+    std::string short_id = wire;
+    short_id[2] = static_cast<char>(static_cast<unsigned char>(short_id[2]) - 1);
+    EXPECT_FALSE(Decode(Reseal(short_id)).has_value());
+
+    // declared id longer than the whole datagram
+    std::string long_id = wire;
+    long_id[2] = static_cast<char>(0xFF);
+    EXPECT_FALSE(Decode(Reseal(long_id)).has_value());
+
+    // an extra byte after the last service
+    std::string trailing = wire;
+    trailing.insert(trailing.size() - 4, 1, 'x');
+    EXPECT_FALSE(Decode(Reseal(trailing)).has_value());
+}
+
+TEST(TelemetryCodecTest, RejectsCrcMismatch) {
+    std::string wire = MakeDatagram().EncodeBinary();
+    wire[kStatusOffset + 8] ^= 0x01; // one bit of cpu_used
+    EXPECT_FALSE(Decode(wire).has_value());
+
+    std::string crc = MakeDatagram().EncodeBinary();
+    crc.back() ^= 0x01;
+    EXPECT_FALSE(Decode(crc).has_value());
+}
+
+TEST(TelemetryCodecTest, RejectsTruncatedServiceEntries) {
+    const TelemetryDatagram dgram = MakeDatagram();
+    const std::string wire = dgram.EncodeBinary();
+    const size_t first_service = kIdOffset + dgram.global_id.size();
+
+    // more services announced than present
+    std::string more = wire;
+    more[3] = static_cast<char>(3);
+    EXPECT_FALSE(Decode(Reseal(more)).has_value());
+
+    // the last service name is cut short
+    std::string cut = wire;
+    cut.erase(cut.size() - 4 - 2, 2);
+    EXPECT_FALSE(Decode(Reseal(cut)).has_value());
+
+    // a length prefix running past the end
+    std::string overlong = wire;
+    overlong[first_service] = static_cast<char>(0xFF);
+    EXPECT_FALSE(Decode(Reseal(overlong)).has_value());
+}
+
+namespace {
+bool Push(TelemetryReceiver &receiver, int64_t epoch, uint64_t seq, int64_t now_ms,
+          const std::string &src_ip = "10.0.0.7") {
+    TelemetryDatagram dgram = MakeDatagram();
+    dgram.epoch = epoch;
+    dgram.seq = seq;
+    dgram.status.cpu_used = 0.01 * static_cast<double>(seq); // not a heartbeat
+    const std::string wire = dgram.EncodeBinary();
+    return receiver.Accept(wire.data(), wire.size(), now_ms, src_ip);
+}
+
+const DeviceID kPushDevice = boost::uuids::string_generator()(MakeDatagram().global_id);
+} // namespace
+
+// an agent restarted with a clock behind its previous run is taken back once the old run went quiet
+TEST(TelemetryReceiverTest, OlderEpochAcceptedOnceStale) {
+    TelemetryReceiver receiver;
+    ASSERT_TRUE(Push(receiver, 2000, 5, 10000));
+    EXPECT_FALSE(Push(receiver, 2000, 5, 10050));  // duplicate
+    EXPECT_FALSE(Push(receiver, 1000, 1, 10100));  // older run while the current one is fresh
+    EXPECT_TRUE(receiver.IsFresh(kPushDevice, 10100));
+    EXPECT_FALSE(receiver.IsFresh(kPushDevice, 12000));
+    EXPECT_TRUE(Push(receiver, 1000, 2, 12000));   // interval 500ms: fresh for 1.5s
+    EXPECT_TRUE(Push(receiver, 1000, 3, 12500));
+    EXPECT_FALSE(Push(receiver, 1000, 3, 12600));
+    EXPECT_TRUE(Push(receiver, 3000, 1, 12700));   // a newer run wins right away
+    const auto stats = receiver.Stats(kPushDevice);
+    EXPECT_EQ(stats["restarts"], 2);
+    EXPECT_EQ(stats["stale_dropped"], 3);
+    EXPECT_EQ(stats["lost"], 0);
+}
+
+TEST(TelemetryReceiverTest, IgnoresUnregisteredDevices) {
+    TelemetryReceiver receiver;
+    receiver.SetDeviceFilter([](const DeviceID &, const std::string &) { return false; });
+    EXPECT_FALSE(Push(receiver, 1000, 1, 10000));
+    EXPECT_EQ(receiver.source_count(), 0u);
+    receiver.SetDeviceFilter([](const DeviceID &id, const std::string &) { return id == kPushDevice; });
+    EXPECT_TRUE(Push(receiver, 1000, 2, 10000));
+    EXPECT_EQ(receiver.source_count(), 1u);
+}
+
+// a registered global_id pushed from another host must not overwrite the device's load
+TEST(TelemetryReceiverTest, IgnoresPushesFromOtherAddresses) {
+    TelemetryReceiver receiver;
+    receiver.SetDeviceFilter([](const DeviceID &id, const std::string &src_ip) {
+        return id == kPushDevice && src_ip == "10.0.0.7";
+    });
+    EXPECT_FALSE(Push(receiver, 5000, 1, 10000, "10.0.0.99"));
+    EXPECT_EQ(receiver.source_count(), 0u);
+    EXPECT_FALSE(receiver.IsFresh(kPushDevice, 10000));
+    EXPECT_TRUE(Push(receiver, 1000, 1, 10000, "10.0.0.7"));
+    EXPECT_FALSE(Push(receiver, 5000, 1, 10100, "10.0.0.99")); // a forged newer epoch is not adopted
+    EXPECT_EQ(receiver.Stats(kPushDevice)["restarts"], 0);
+}
+
+TEST(TelemetryReceiverTest, ForgetsLongSilentSources) {
+    TelemetryReceiver receiver;
+    ASSERT_TRUE(Push(receiver, 1000, 1, 10000));
+    receiver.Flush(10000); // hands the sample over
+    receiver.Flush(10000 + TelemetryReceiver::kSourceTtlMs);
+    EXPECT_EQ(receiver.source_count(), 1u);
+    receiver.Flush(10001 + TelemetryReceiver::kSourceTtlMs);
+    EXPECT_EQ(receiver.source_count(), 0u);
+    // back after the sweep: accepted as a new source
+    EXPECT_TRUE(Push(receiver, 1000, 2, 20000 + TelemetryReceiver::kSourceTtlMs));
+}